@@ -3,8 +3,14 @@
 #include "camera.h"
 #include "context.h"
 #include "creation_callbacks.h"
+#include "curvemesh.h"
 #include "exporter.h"
+#include "export_memory.h"
+#include "export_trace.h"
 #include "idisplay_port.h"
+#include "ipr_crop_culling.h"
+#include "ipr_frame_cache.h"
+#include "ipr_latency.h"
 #include "light.h"
 #include "object_attributes.h"
 #include "object_visibility_resolver.h"
@@ -37,6 +43,8 @@
 #include "delight.h"
 
 #include <iostream>
+#include <memory>
+#include <unordered_set>
 
 
 namespace
@@ -231,7 +239,10 @@ void ROP_3Delight::UpdateCrop(const float* i_window)
 		OBJ_Camera *cam = GetCamera(m_current_render->m_current_time);
 		assert( cam );
 		if( !cam )
+		{
+			m_render_end_mutex.unlock();
 			return;
+		}
 
 		std::string screen_name(camera::screen_handle(cam, *m_current_render));
 
@@ -247,6 +258,19 @@ void ROP_3Delight::UpdateCrop(const float* i_window)
 				->SetCount(2)
 				->SetValuePointer(i_window));
 
+		// The crop is also part of the recorded camera attributes
+		if(m_current_render->frame_cache())
+		{
+			m_current_render->frame_cache()->clear();
+		}
+
+		// Export what has come into the new region, and delete what has left
+		if(ipr_crop_culling* culling = m_current_render->crop_culling())
+		{
+			culling->set_crop(i_window);
+			culling->update(*m_current_render);
+		}
+
 		m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
 	}
 	m_render_end_mutex.unlock();
@@ -586,6 +610,16 @@ ROP_3Delight::renderFrame(fpreal time, UT_Interrupt*)
 
 	m_current_render->set_current_time(time);
 
+	// Nothing has been exported to the new NSI context yet
+	m_current_render->m_vop_fingerprints.clear();
+	m_current_render->m_shader_aliases.clear();
+	m_current_render->m_exported_standins.clear();
+	m_current_render->m_object_materials.clear();
+	m_current_render->m_standin_files.clear();
+
+	export_trace::get_instance().begin_frame();
+	export_memory::get_instance().begin_frame();
+
 	std::string frame_nsi_file;
 	if(m_current_render->m_export_nsi)
 	{
@@ -593,6 +627,7 @@ ROP_3Delight::renderFrame(fpreal time, UT_Interrupt*)
 		assert(!export_file.empty());
 		m_current_render->set_export_path(export_file);
 		InitNSIExport(m_nsi, export_file);
+		frame_nsi_file = export_file;
 	}
 	else if(m_sequence_context)
 	{
@@ -653,7 +688,28 @@ ROP_3Delight::renderFrame(fpreal time, UT_Interrupt*)
 		ExportAtmosphere(*m_current_render);
 		if(m_current_render->m_rop_type == rop_type::viewport)
 		{
-			viewport_hook_builder::instance().connect(&m_nsi);
+			viewport_hook_builder::instance().connect(
+				&m_nsi,
+				m_settings.get_viewport_settle_time(time),
+				m_settings.get_viewport_refresh_rate(time),
+				[this](const viewport_view& i_view)
+				{
+					if(!m_current_render->m_ipr)
+					{
+						return;
+					}
+
+					// The hair LOD follows the viewport's camera
+					m_current_render->queue_camera_change(
+						[this, i_view]()
+						{
+							if(curvemesh::update_lod(
+								*m_current_render, nullptr, &i_view))
+							{
+								m_current_render->request_synchronize();
+							}
+						});
+				});
 			m_nsi.SetAttribute(
 				NSI_SCENE_GLOBAL,
 				NSI::CStringPArg("bucketorder", "circle"));
@@ -666,6 +722,46 @@ ROP_3Delight::renderFrame(fpreal time, UT_Interrupt*)
 		export_render_notes( *m_current_render );
 	}
 
+	if(export_trace::enabled())
+	{
+		/*
+			Keep the trace next to the exported NSI file, or in a temporary
+			file that is kept after rendering, since it's meant to be read
+			later.
+		*/
+		std::string trace_file;
+		if(!frame_nsi_file.empty() && frame_nsi_file != k_stdout)
+		{
+			trace_file = m_current_render->m_export_path_prefix + ".trace.json";
+		}
+
+		trace_file = export_trace::get_instance().end_frame(trace_file);
+		if(!trace_file.empty())
+		{
+			std::cerr
+				<< "3Delight for Houdini: export trace written to "
+				<< trace_file << std::endl;
+		}
+	}
+
+	if(export_memory::enabled())
+	{
+		// Same location as the export trace, for pipeline tools
+		std::string memory_file;
+		if(!frame_nsi_file.empty() && frame_nsi_file != k_stdout)
+		{
+			memory_file = m_current_render->m_export_path_prefix + ".memory.json";
+		}
+
+		memory_file = export_memory::get_instance().end_frame(memory_file);
+		if(!memory_file.empty())
+		{
+			std::cerr
+				<< "3Delight for Houdini: export memory report written to "
+				<< memory_file << std::endl;
+		}
+	}
+
 	if(m_current_render->m_ipr)
 	{
 		// Get notifications for newly created nodes
@@ -984,8 +1080,7 @@ void ROP_3Delight::changed_cb(
 	{
 		context* ctx = (context*)i_callee;
 		rop->ExportAtmosphere(*ctx, true);
-		ctx->m_nsi.RenderControl(
-			NSI::CStringPArg("action", "synchronize"));
+		ctx->request_synchronize();
 	}
 	else if (name == settings::k_camera)
 	{
@@ -994,8 +1089,7 @@ void ROP_3Delight::changed_cb(
 		if (cam)
 		{
 			rop->ExportOutputs(*ctx, true);
-			ctx->m_nsi.RenderControl(
-				NSI::CStringPArg("action", "synchronize"));
+			ctx->request_synchronize();
 		}
 	}
 }
@@ -1066,7 +1160,7 @@ ROP_3Delight::ExportAtmosphere(const context& i_ctx, bool ipr_update)
 	i_ctx.m_nsi.Create( attr_handle, "attributes" );
 
 	i_ctx.m_nsi.Connect(
-		vop::handle(*atmo_vop, i_ctx), "",
+		vop::shader_handle(*atmo_vop, i_ctx), "",
 		attr_handle, "volumeshader",
 		NSI::IntegerArg("strength", 1) );
 
@@ -1122,6 +1216,8 @@ std::string getImageFilenamePerAOV(UT_String image_file_name, std::string aov_la
 void
 ROP_3Delight::ExportOutputs(const context& i_ctx, bool i_ipr_camera_change)const
 {
+	export_trace::scope trace("ExportOutputs", this);
+
 	OBJ_Camera* cam = GetCamera( i_ctx.m_current_time );
 	double current_time = i_ctx.m_current_time;
 
@@ -1978,32 +2074,224 @@ ROP_3Delight::HasDepthOfField( double t )const
 	return !(HasSpeedBoost(t) && evalInt(settings::k_disable_depth_of_field, 0, t));
 }
 
+/**
+	The objects of each stage and the recording context are kept between the
+	stages. Objects are kept by ID since they could be deleted meanwhile.
+*/
+struct ROP_3Delight::time_change
+{
+	time_change() : m_stream(GetNSIAPI()) {}
+
+	/// Next stage to export, -1 before the first one
+	int m_stage{-1};
+	/// Unique ID of the render camera, -1 if there is none
+	int m_camera_id{-1};
+	/// Unique IDs of the objects of each stage
+	std::vector<int> m_objects[scene::e_nb_priorities];
+	/// Materials already exported by previous stages
+	std::unordered_set<std::string> m_materials;
+
+	/// Recording of the stages, when frames are cached
+	NSI::Context m_stream;
+	std::unique_ptr<context> m_recording;
+};
+
 void ROP_3Delight::time_change_cb(double i_time)
 {
 	assert(m_current_render);
 	assert(m_current_render->m_ipr);
 
-	m_current_render->m_time_dependent = true;
-	m_current_render->set_current_time(i_time);
+	/*
+		Dragging the playhead generates lots of time changes. Only the latest
+		one is exported, from the IPR event queue, which also cancels the
+		export in progress when a new time arrives.
+	*/
+	std::shared_ptr<time_change> change = std::make_shared<time_change>();
+	m_current_render->queue_time_change(
+		i_time,
+		[this, change](double time)
+		{
+			return export_time_change(time, *change);
+		});
+}
+
+/**
+	Time-dependent objects are exported in 3 stages, each followed by a
+	synchronization of the render, so that the most visible changes are
+	rendered first : the render camera, then the objects in its frustum and
+	light sources, and finally the objects that can't be seen directly. Each
+	stage is refined right before it's exported, along with the materials it
+	needs, and the IPR event queue releases Houdini's lock between stages. The
+	export is abandoned before refining a stage if a more recent time change
+	has been received meanwhile : the remaining stages will be exported again
+	anyway.
+
+	When frames are recorded (\ref ipr_frame_cache), the stages are exported
+	through a recording context and going back to an already exported frame
+	simply replays its recorded stages.
+*/
+bool ROP_3Delight::export_time_change(double i_time, time_change& io_change)
+{
+	assert(m_current_render);
+	context& ctx = *m_current_render;
 
-	scene::convert_to_nsi(*m_current_render);
-	if (m_current_render->m_rop_type != rop_type::viewport)
+	ipr_frame_cache* cache = ctx.frame_cache();
+
+	if(io_change.m_stage < 0)
 	{
-		ExportAtmosphere(*m_current_render, true);
+		ctx.m_time_dependent = true;
+		ctx.set_current_time(i_time);
+
+		if(cache && cache->replay(i_time, ctx))
+		{
+			// The hair LOD of static objects depends on the animated camera
+			curvemesh::update_lod(ctx);
+
+			ipr_latency::get_instance().synchronizing();
+			ctx.m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+			ipr_latency::get_instance().synchronized();
+			return false;
+		}
+
+		if(cache)
+		{
+			io_change.m_recording.reset(new context(ctx, io_change.m_stream));
+		}
 
 		/*
-			Camera attributes are are set on viewport_hook for viewport rendering
-			so we don't need to set them for viewport rendering again.
+			Camera attributes are set by viewport_hook for viewport rendering,
+			so there is no render camera to export (or to test visibility
+			against).
 		*/
-		OBJ_Camera* cam = GetCamera(m_current_render->m_current_time);
-		if (cam)
+		OBJ_Camera* cam =
+			ctx.m_rop_type != rop_type::viewport ? GetCamera(i_time) : nullptr;
+		if(cam)
 		{
-			camera* cam_obj = new camera(*m_current_render, cam);
-			cam_obj->set_attributes();
+			io_change.m_camera_id = cam->getUniqueId();
 		}
+
+		std::vector<OBJ_Node*> objects[scene::e_nb_priorities];
+		scene::get_objects_by_priority(ctx, cam, objects);
+		for(int s = 0; s < scene::e_nb_priorities; s++)
+		{
+			for(OBJ_Node* obj : objects[s])
+			{
+				io_change.m_objects[s].push_back(obj->getUniqueId());
+			}
+		}
+
+		io_change.m_stage = 0;
 	}
-	m_current_render->m_nsi.RenderControl(
-		NSI::CStringPArg("action", "synchronize"));
+
+	context* recording = io_change.m_recording.get();
+	const context& export_ctx = recording ? *recording : ctx;
+
+	bool cancelled = ctx.ipr_update_cancelled();
+	if(!cancelled)
+	{
+		int s = io_change.m_stage++;
+
+		OBJ_Camera* cam = nullptr;
+		if(s == scene::e_camera_priority && io_change.m_camera_id >= 0)
+		{
+			OP_Node* node = OP_Node::lookupNode(io_change.m_camera_id);
+			OBJ_Node* obj = node ? node->castToOBJNode() : nullptr;
+			cam = obj ? obj->castToOBJCamera() : nullptr;
+		}
+
+		std::vector<OBJ_Node*> objects;
+		for(int id : io_change.m_objects[s])
+		{
+			OP_Node* node = OP_Node::lookupNode(id);
+			if(node && node->castToOBJNode())
+			{
+				objects.push_back(node->castToOBJNode());
+			}
+		}
+
+		if(!objects.empty() || cam)
+		{
+			std::vector<exporter*> to_export;
+			scene::create_exporters(
+				export_ctx, objects, io_change.m_materials, to_export);
+
+			if(recording)
+			{
+				cache->begin_stage(io_change.m_stream);
+			}
+
+			scene::export_nsi(export_ctx, to_export, false);
+
+			if(cam)
+			{
+				ExportAtmosphere(export_ctx, true);
+
+				camera cam_obj(export_ctx, cam);
+				cam_obj.set_attributes();
+			}
+
+			if(recording)
+			{
+				cache->end_stage(io_change.m_stream, ctx.m_nsi);
+			}
+
+			// The time change's latency is measured at the first stage
+			ipr_latency::get_instance().synchronizing();
+			ctx.m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+			ipr_latency::get_instance().synchronized();
+		}
+
+		if(io_change.m_stage < scene::e_nb_priorities)
+		{
+			return true;
+		}
+
+		/*
+			Objects that are not time-dependent might still have come into the
+			crop region, or left it, if the camera is animated.
+		*/
+		ipr_crop_culling* culling = ctx.crop_culling();
+		bool culling_changed = culling && culling->update(ctx);
+
+		// Their hair LOD might have changed as well
+		bool lod_changed = curvemesh::update_lod(ctx);
+
+		if(culling_changed || lod_changed)
+		{
+			ctx.m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+		}
+	}
+
+	if(!recording)
+	{
+		return false;
+	}
+
+	// Keep the state of what has been exported through the recording context
+	ctx.m_temp_filenames.insert(
+		ctx.m_temp_filenames.end(),
+		recording->m_temp_filenames.begin(),
+		recording->m_temp_filenames.end());
+	recording->m_temp_filenames.clear();
+	for(const auto& f : recording->m_vop_fingerprints)
+	{
+		ctx.m_vop_fingerprints[f.first] = f.second;
+	}
+	for(const auto& s : recording->m_geometry_signatures)
+	{
+		ctx.m_geometry_signatures[s.first] = s.second;
+	}
+
+	if(cancelled)
+	{
+		cache->discard();
+	}
+	else
+	{
+		cache->commit(i_time, recording->m_geometry_signatures);
+	}
+
+	return false;
 }
 
 std::string
@@ -2032,7 +2320,12 @@ ROP_3Delight::GetNSIExportFilename(double i_time)const
 
 void ROP_3Delight::NewOBJNode(OBJ_Node& i_node)
 {
+	m_current_render->update_visibility(i_node);
 	scene::insert_obj_node(i_node, *m_current_render);
+	if(m_current_render->frame_cache())
+	{
+		m_current_render->frame_cache()->clear();
+	}
 	m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
 }
 
@@ -2081,6 +2374,21 @@ void ROP_3Delight::export_render_notes( const context &i_context ) const
 	notes += "  |  ";
 	notes += frameid;
 
+	if( i_context.m_ipr )
+	{
+		/* Number of watched nodes, which affects the IPR's responsiveness. */
+		notes += "\nIPR interests: ";
+		notes += std::to_string( i_context.nb_interests() );
+	}
+
+	std::string memory_report = export_memory::get_instance().report();
+	if( !memory_report.empty() )
+	{
+		/* Objects that might be responsible for running out of memory. */
+		notes += "\n";
+		notes += memory_report;
+	}
+
 	i_context.m_nsi.SetAttribute(
 		NSI_SCENE_GLOBAL,
 		(
@@ -218,6 +218,17 @@ private:
 	/// Called when the application's current time has changed.
 	void time_change_cb(double i_time);
 
+	/// Progress of a time change being exported in stages
+	struct time_change;
+
+	/**
+		\brief Re-exports a stage of the time-dependent parts of the IPR scene
+		at i_time.
+
+		\returns true if stages remain to be exported.
+	*/
+	bool export_time_change(double i_time, time_change& io_change);
+
 private:
 	std::vector<OBJ_Node*> m_lights;
 	rop_type m_rop_type;
@@ -5,6 +5,7 @@
 
 #include <PRM/PRM_Include.h>
 #include <PRM/PRM_SpareData.h>
+#include <iostream>
 #include <unordered_set>
 
 
@@ -691,6 +692,14 @@ VOP_ExternalOSL::alloc(OP_Network* net, const char* name, OP_Operator* entry)
 	VOP_ExternalOSLOperator* osl_entry =
 		dynamic_cast<VOP_ExternalOSLOperator*>(entry);
 	assert(osl_entry);
+	if(!osl_entry->shader_info())
+	{
+		return nullptr;
+	}
+
+	// Ensures the templates are there before the node's parameters are built
+	osl_entry->updateParmTemplates();
+
     return new VOP_ExternalOSL(net, name, osl_entry);
 }
 
@@ -900,7 +909,7 @@ VOP_ExternalOSL::GetTemplates(const StructuredShaderInfo& i_shader_info)
 VOP_ExternalOSL::VOP_ExternalOSL(
 	OP_Network* parent, const char* name, VOP_ExternalOSLOperator* entry)
     :	VOP_Node(parent, name, entry),
-		m_shader_info(entry->m_shader_info)
+		m_shader_info(*entry->shader_info())
 {
 	if(m_shader_info.IsTerminal())
 	{
@@ -1290,17 +1299,26 @@ void VOP_ExternalOSL::CollapseMaterialsInputGroups()
 	}
 }
 
+namespace
+{
+	/*
+		Placeholder parameter templates, used until the actual ones are built.
+		\ref VOP_ExternalOSLOperator::updateParmTemplates
+	*/
+	PRM_Template k_no_templates[] = { PRM_Template() };
+}
+
 VOP_ExternalOSLOperator::VOP_ExternalOSLOperator(
-	const StructuredShaderInfo& i_shader_info,
+	const shader_library::shader_description& i_description,
 	const std::string& i_menu_name)
 	:	VOP_Operator(
-			("3Delight::" + i_shader_info.m_dl.shadername().string()).c_str(),
-			i_shader_info.m_dl.shadername().c_str(),
+			("3Delight::" + i_description.m_name).c_str(),
+			i_description.m_name.c_str(),
 			VOP_ExternalOSL::alloc,
-			VOP_ExternalOSL::GetTemplates(i_shader_info),
+			k_no_templates,
 			VOP_ExternalOSL::theChildTableName,
-			i_shader_info.NumInputs(),
-			i_shader_info.NumInputs(),
+			i_description.m_num_inputs,
+			i_description.m_num_inputs,
 			// Put nsi here so Houdini's Material Builder won't see our VOPs
 			"nsi",
 			nullptr,
@@ -1308,12 +1326,11 @@ VOP_ExternalOSLOperator::VOP_ExternalOSLOperator(
 				FIXME : this might be useless. We probably meant to set the
 				material flag on the node, instead.
 			*/
-			i_shader_info.IsTerminal() ? OP_FLAG_OUTPUT : 0u,
-			i_shader_info.NumOutputs()),
-		m_shader_info(i_shader_info)
+			i_description.m_terminal ? OP_FLAG_OUTPUT : 0u,
+			i_description.m_num_outputs),
+		m_description(i_description)
 {
-	const char* name = i_shader_info.m_dl.shadername().c_str();
-	osl_utilities::FindMetaData(name, i_shader_info.m_dl.metadata(), "niceName");
+	const char* name = m_description.m_nice_name.c_str();
 
 	std::string better;
 	if( ::islower(name[0]))
@@ -1330,8 +1347,7 @@ VOP_ExternalOSLOperator::VOP_ExternalOSLOperator(
 
 	// Set default icon name for those that are not already defined by
 	// VOP_3Delight-xxx in ui
-	const DlShaderInfo::conststring& shadername =
-		i_shader_info.m_dl.shadername();
+	const std::string& shadername = m_description.m_name;
 	if (shadername != "dlColorToFloat" &&
 		shadername != "dlFloatToColor" &&
 		shadername != "dlGlass" &&
@@ -1368,10 +1384,7 @@ VOP_ExternalOSLOperator::VOP_ExternalOSLOperator(
 */
 bool VOP_ExternalOSLOperator::getOpHelpURL(UT_String &url)
 {
-	const char* name = m_shader_info.m_dl.shadername().c_str();
-	osl_utilities::FindMetaData(name, m_shader_info.m_dl.metadata(), "niceName");
-
-	std::string shader_ui_name = name;
+	std::string shader_ui_name = m_description.m_nice_name;
 	if (shader_ui_name == "vdbVolume")
 		shader_ui_name = "Open+VDB";
 
@@ -1381,3 +1394,37 @@ bool VOP_ExternalOSLOperator::getOpHelpURL(UT_String &url)
 	url.hardenIfNeeded(url_name.c_str());
 	return true;
 }
+
+bool VOP_ExternalOSLOperator::updateParmTemplates()
+{
+	if(m_templates_built || !shader_info())
+	{
+		return VOP_Operator::updateParmTemplates();
+	}
+
+	m_templates_built = true;
+	myParmTemplates = VOP_ExternalOSL::GetTemplates(*m_shader_info);
+
+	return true;
+}
+
+const StructuredShaderInfo* VOP_ExternalOSLOperator::shader_info()
+{
+	if(!m_shader_info)
+	{
+		const shader_library &library = shader_library::get_instance();
+		const DlShaderInfo* info =
+			library.get_shader_info(m_description.m_path.c_str());
+		if(!info)
+		{
+			std::cerr
+				<< "3Delight for Houdini: unable to load shader "
+				<< m_description.m_path << std::endl;
+			return nullptr;
+		}
+
+		m_shader_info.reset(new StructuredShaderInfo(info));
+	}
+
+	return m_shader_info.get();
+}
@@ -1,11 +1,15 @@
 #pragma once
 
+#include "shader_library.h"
+
 #include <3Delight/ShaderQuery.h>
 
 #include <UT/UT_HDKVersion.h>
 #include <VOP/VOP_Node.h>
 #include <VOP/VOP_Operator.h>
 
+#include <memory>
+
 class DlShaderInfo;
 struct VOP_ExternalOSLOperator;
 
@@ -216,18 +220,39 @@ private:
 	VOP_ExternalOSL nodes.
 
 	This is used to register many different operator types, each based on a
-	different OSL shader.
+	different OSL shader. In order to keep Houdini's startup fast, the operator
+	is registered from a summary of the shader only. The shader is loaded, and
+	the operator's parameter templates are built, the first time they are
+	needed.
 */
 struct VOP_ExternalOSLOperator : public VOP_Operator
 {
 	/// Constructor.
 	VOP_ExternalOSLOperator(
-		const StructuredShaderInfo& i_shader_info,
+		const shader_library::shader_description& i_description,
 		const std::string& i_menu_name);
 
 	// overriding function which is responsible for help URL
 	virtual bool getOpHelpURL(UT_String& url);
 
-	/// The shader information we want to pass to the VOP_ExternalOSL node
-	StructuredShaderInfo m_shader_info;
+	/// Builds the parameter templates when Houdini first needs them
+	virtual bool updateParmTemplates() override;
+
+	/**
+		\brief Returns the shader information to pass to VOP_ExternalOSL nodes.
+
+		The shader is loaded on the first call. Returns nullptr if the shader
+		could not be loaded.
+	*/
+	const StructuredShaderInfo* shader_info();
+
+	/// Summary of the shader this operator stands for
+	shader_library::shader_description m_description;
+
+private:
+
+	/// The shader information, allocated by shader_info()
+	std::unique_ptr<StructuredShaderInfo> m_shader_info;
+	/// True once the actual parameter templates have been built
+	bool m_templates_built{false};
 };
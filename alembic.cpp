@@ -152,7 +152,7 @@ void alembic::set_attributes( void ) const
 		{
 			if(mat.m_vops[s])
 			{
-				strings_holder.push_back(vop::handle(*mat.m_vops[s], m_context));
+				strings_holder.push_back(vop::shader_handle(*mat.m_vops[s], m_context));
 				shader_handles[s].push_back(strings_holder.back().c_str());
 			}
 			else
@@ -1,6 +1,8 @@
 #include "camera.h"
 
 #include "context.h"
+#include "curvemesh.h"
+#include "ipr_crop_culling.h"
 #include "null.h"
 #include "shader_library.h"
 #include "time_sampler.h"
@@ -11,11 +13,20 @@
 */
 #include "ROP_3Delight.h"
 
+#include <GU/GU_DetailHandle.h>
+#include <GU/GU_Detail.h>
 #include <OBJ/OBJ_Node.h>
 #include <OBJ/OBJ_Camera.h>
+#include <SOP/SOP_Node.h>
+#include <UT/UT_BoundingBox.h>
 
 #include <nsi.hpp>
 
+#include <algorithm>
+
+#include <math.h>
+#include <string.h>
+
 namespace
 {
 	/**
@@ -570,11 +581,34 @@ void camera::changed_cb(
 	{
 		//If changing one of the camera crop values during IPR, ignore the i-display crop.
 		ctx->m_rop->m_is_cropped_on_iDisplay = false;
+
+		if(ipr_crop_culling* culling = ctx->crop_culling())
+		{
+			OBJ_Camera* cam = obj->castToOBJCamera();
+			float cam_crop[4] =
+			{
+				float(cam->CROPL(0)), 1.0f - float(cam->CROPT(0)),
+				float(cam->CROPR(0)), 1.0f - float(cam->CROPB(0))
+			};
+			culling->set_crop(cam_crop);
+		}
 	}
 
 	// Simply re-export all attributes.  It's not that expensive.
 	node.set_attributes();
-	ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+
+	// The frustum, and the hair LOD, might have changed
+	if(obj == ctx->rop()->GetCamera(ctx->current_time()))
+	{
+		if(ipr_crop_culling* culling = ctx->crop_culling())
+		{
+			culling->update(*ctx);
+		}
+
+		curvemesh::update_lod(*ctx);
+	}
+
+	ctx->request_synchronize();
 }
 
 /**
@@ -741,6 +775,174 @@ void camera::get_screen_window(
 	}
 }
 
+/**
+	Computes the bounds of an object's projection on the screen. The
+	perspective projection is scaled so that the fov spans the [-1, 1] range
+	vertically, which is the space of the screen window.
+
+	\returns
+		false if the projection can't be computed (no geometry, unusual
+		projection, or an object crossing the camera's plane), in which case
+		the object should be considered visible and close to the camera.
+*/
+bool camera::project_bounds(
+	OBJ_Camera& i_camera,
+	OBJ_Node& i_object,
+	double i_time,
+	double o_min[2],
+	double o_max[2],
+	bool& o_in_front)
+{
+	if(is_light(i_camera))
+	{
+		return false;
+	}
+
+	std::string type;
+	std::string mapping;
+	get_projection(i_camera, i_time, type, mapping);
+	bool ortho = type == "orthographiccamera";
+	if(!ortho && type != k_default_camera_type)
+	{
+		// Wide angle projections could see almost anything
+		return false;
+	}
+
+	SOP_Node* sop = i_object.getRenderSopPtr();
+	if(!sop)
+	{
+		return false;
+	}
+
+	OP_Context context(i_time);
+	UT_BoundingBox box;
+	{
+		GU_DetailHandleAutoReadLock detail(sop->getCookedGeoHandle(context));
+		if(!detail.isValid() || !detail.getGdp()->getBBox(&box))
+		{
+			return false;
+		}
+	}
+
+	UT_DMatrix4 object_to_world;
+	UT_DMatrix4 camera_to_world;
+	i_object.getWorldTransform(object_to_world, context);
+	i_camera.getWorldTransform(camera_to_world, context);
+	if(camera_to_world.invert() != 0)
+	{
+		return false;
+	}
+	UT_DMatrix4 object_to_camera = object_to_world * camera_to_world;
+
+	double tan_half_fov = tan(get_fov(i_camera, i_time) * M_PI / 360.0);
+	o_min[0] = o_min[1] = 1e30;
+	o_max[0] = o_max[1] = -1e30;
+	o_in_front = false;
+	for(int c = 0; c < 8; c++)
+	{
+		UT_Vector3D p(
+			(c & 1) ? box.xmax() : box.xmin(),
+			(c & 2) ? box.ymax() : box.ymin(),
+			(c & 4) ? box.zmax() : box.zmin());
+		p *= object_to_camera;
+
+		// Houdini cameras look down the negative Z axis
+		double depth = -p.z();
+		double x = p.x();
+		double y = p.y();
+		if(!ortho)
+		{
+			if(depth <= 0.0)
+			{
+				// The box crosses the camera's plane
+				return false;
+			}
+
+			x /= depth * tan_half_fov;
+			y /= depth * tan_half_fov;
+		}
+
+		o_in_front = o_in_front || depth > 0.0;
+		o_min[0] = std::min(o_min[0], x);
+		o_min[1] = std::min(o_min[1], y);
+		o_max[0] = std::max(o_max[0], x);
+		o_max[1] = std::max(o_max[1], y);
+	}
+
+	return true;
+}
+
+bool camera::is_in_frustum(
+	OBJ_Camera& i_camera,
+	OBJ_Node& i_object,
+	double i_time,
+	const float* i_crop,
+	double i_margin)
+{
+	double screen_min[2];
+	double screen_max[2];
+	bool in_front = false;
+	if(!project_bounds(
+		i_camera, i_object, i_time, screen_min, screen_max, in_front))
+	{
+		return true;
+	}
+
+	double sw[4];
+	get_screen_window(sw, i_camera, i_time);
+
+	double width = sw[2] - sw[0];
+	double height = sw[3] - sw[1];
+	if(i_crop)
+	{
+		// The crop window's origin is the top-left corner of the screen
+		double window[4] =
+		{
+			sw[0] + i_crop[0] * width,
+			sw[3] - i_crop[3] * height,
+			sw[0] + i_crop[2] * width,
+			sw[3] - i_crop[1] * height
+		};
+		memcpy(sw, window, sizeof(sw));
+	}
+
+	sw[0] -= i_margin * width;
+	sw[1] -= i_margin * height;
+	sw[2] += i_margin * width;
+	sw[3] += i_margin * height;
+
+	return
+		in_front &&
+		screen_max[0] >= sw[0] && screen_min[0] <= sw[2] &&
+		screen_max[1] >= sw[1] && screen_min[1] <= sw[3];
+}
+
+bool camera::get_screen_size(
+	OBJ_Camera& i_camera,
+	OBJ_Node& i_object,
+	double i_time,
+	double& o_width,
+	double& o_height)
+{
+	double screen_min[2];
+	double screen_max[2];
+	bool in_front = false;
+	if(!project_bounds(
+		i_camera, i_object, i_time, screen_min, screen_max, in_front) ||
+		!in_front)
+	{
+		return false;
+	}
+
+	double sw[4];
+	get_screen_window(sw, i_camera, i_time);
+
+	o_width = (screen_max[0] - screen_min[0]) / (sw[2] - sw[0]);
+	o_height = (screen_max[1] - screen_min[1]) / (sw[3] - sw[1]);
+
+	return true;
+}
+
 std::string camera::screen_handle( void ) const
 {
 	return screen_handle( m_object, m_context );
@@ -70,11 +70,58 @@ public:
 		double i_time,
 		bool i_use_houdini_projection = false);
 
+	/**
+		\brief Returns true if an object might be visible from a camera.
+
+		This is a conservative test of the object's bounding box against the
+		camera's frustum. Objects that can't be tested (no geometry, unusual
+		projection) are always considered visible.
+
+		\param i_crop
+			Optional crop window, in the same format as the "crop" attribute of
+			an NSI screen, that restricts the frustum to a region of the image.
+		\param i_margin
+			Amount by which the tested region is enlarged on each side, as a
+			fraction of the screen window's size.
+	*/
+	static bool is_in_frustum(
+		OBJ_Camera& i_camera,
+		OBJ_Node& i_object,
+		double i_time,
+		const float* i_crop = nullptr,
+		double i_margin = 0.0);
+
+	/**
+		\brief Computes the size of an object's projection on the screen.
+
+		\param o_width, o_height
+			The size of the projection of the object's bounding box, as a
+			fraction of the screen window's size.
+		\returns
+			False if the size can't be computed, in which case the object
+			should be considered as possibly covering the whole screen.
+	*/
+	static bool get_screen_size(
+		OBJ_Camera& i_camera,
+		OBJ_Node& i_object,
+		double i_time,
+		double& o_width,
+		double& o_height);
+
 	/*
 	*/
 	static std::string screen_handle( OBJ_Node *i_cam, const context & );
 
 private:
+	/// Projects an object's bounding box on the screen
+	static bool project_bounds(
+		OBJ_Camera& i_camera,
+		OBJ_Node& i_object,
+		double i_time,
+		double o_min[2],
+		double o_max[2],
+		bool& o_in_front);
+
 	std::string screen_handle( void ) const;
 
 	/// Exports time-dependent attributes to NSI
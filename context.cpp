@@ -1,10 +1,15 @@
 #include "context.h"
 
 #include "ROP_3Delight.h"
+#include "ipr_crop_culling.h"
+#include "ipr_event_queue.h"
+#include "ipr_frame_cache.h"
 #include <nsi_dynamic.hpp>
 
 #include <UT/UT_TempFileManager.h>
 
+#include <algorithm>
+
 static NSI::DynamicAPI s_api;
 static NSI::Context s_bad_context(s_api);
 
@@ -46,6 +51,71 @@ context::context(
 	m_object_visibility_resolver =
 		new object_visibility_resolver(m_rop_path, i_settings, i_start_time);
 	set_export_path(i_export_path);
+
+	if(m_ipr)
+	{
+		m_event_queue = std::make_shared<ipr_event_queue>(*this);
+		m_event_queue->start();
+
+		// The viewport has no crop region, it renders what's on screen
+		if(!m_export_nsi && m_rop_type != rop_type::viewport)
+		{
+			m_crop_culling = std::make_shared<ipr_crop_culling>(*this);
+			if(!m_crop_culling->enabled())
+			{
+				m_crop_culling.reset();
+			}
+			else if(i_rop->idisplay_rendering())
+			{
+				m_crop_culling->set_crop(i_rop->idisplay_crop_window());
+			}
+		}
+
+		/*
+			Recorded frames would restore objects that have been culled (or
+			miss those that have been exported again) since they were recorded.
+		*/
+		if(!m_crop_culling)
+		{
+			m_frame_cache.reset(
+				new ipr_frame_cache(i_settings.get_ipr_frame_cache(i_start_time)));
+			if(!m_frame_cache->enabled())
+			{
+				m_frame_cache.reset();
+			}
+		}
+	}
+}
+
+context::context(const context& i_context, NSI::Context& i_nsi)
+:
+	m_rop(i_context.m_rop),
+	m_nsi(i_nsi),
+	m_static_nsi(i_nsi),
+	m_start_time(i_context.m_start_time),
+	m_end_time(i_context.m_end_time),
+	m_current_time(i_context.m_current_time),
+	m_frame_duration(i_context.m_frame_duration),
+	m_shutter(i_context.m_shutter),
+	m_shutter_offset(i_context.m_shutter_offset),
+	m_dof(i_context.m_dof),
+	m_batch(i_context.m_batch),
+	m_ipr(i_context.m_ipr),
+	m_time_dependent(i_context.m_time_dependent),
+	m_export_nsi(i_context.m_export_nsi),
+	m_export_path_prefix(i_context.m_export_path_prefix),
+	m_rop_type(i_context.m_rop_type),
+	m_rop_path(i_context.m_rop_path),
+	m_settings(i_context.m_settings),
+	m_fps(i_context.m_fps),
+	material_to_objects(i_context.material_to_objects),
+	m_vop_fingerprints(i_context.m_vop_fingerprints),
+	m_shader_aliases(i_context.m_shader_aliases),
+	m_hair_lod_fractions(i_context.m_hair_lod_fractions),
+	m_crop_culling(i_context.m_crop_culling)
+{
+	m_object_visibility_resolver =
+		new object_visibility_resolver(m_rop_path, m_settings, m_current_time);
 }
 
 void context::set_export_path(const std::string& i_path)
@@ -84,6 +154,11 @@ context::context(
 
 context::~context()
 {
+	if(m_event_queue)
+	{
+		m_event_queue->stop();
+	}
+
 	for( const auto &f : m_temp_filenames )
 	{
 		UT_TempFileManager::removeTempFile( f.data() );
@@ -93,6 +168,86 @@ context::~context()
 }
 
 
+void context::register_interest(OP_Node* i_node, OP_EventMethod i_cb)const
+{
+	assert(m_ipr);
+	if(!m_event_queue)
+	{
+		// This is a recording context, the nodes are already watched
+		return;
+	}
+
+	void* callee = m_event_queue->subscribe(i_cb);
+
+	std::vector<std::unique_ptr<safe_interest>>& interests =
+		m_interests[i_node];
+	for(const auto& interest : interests)
+	{
+		if(interest->callee() == callee)
+		{
+			// Already registered
+			return;
+		}
+	}
+
+	interests.emplace_back(
+		new safe_interest(i_node, callee, &ipr_event_queue::event_cb));
+}
+
+void context::forget_interests(OP_Node* i_node)const
+{
+	auto interests = m_interests.find(i_node);
+	if(interests != m_interests.end())
+	{
+		for(auto& interest : interests->second)
+		{
+			m_forgotten_interests.push_back(std::move(interest));
+		}
+		m_interests.erase(interests);
+	}
+
+	// Destroy the interests of nodes that have been deleted since last time
+	m_forgotten_interests.erase(
+		std::remove_if(
+			m_forgotten_interests.begin(),
+			m_forgotten_interests.end(),
+			[](const std::unique_ptr<safe_interest>& i_interest)
+			{
+				return !i_interest->active();
+			}),
+		m_forgotten_interests.end());
+}
+
+size_t context::nb_interests()const
+{
+	size_t nb = m_forgotten_interests.size();
+	for(const auto& interests : m_interests)
+	{
+		nb += interests.second.size();
+	}
+
+	return nb;
+}
+
+bool context::ipr_update_cancelled()const
+{
+	return m_event_queue && m_event_queue->cancelled();
+}
+
+void context::queue_time_change(
+	double i_time,
+	const std::function<bool(double)>& i_cb)const
+{
+	assert(m_event_queue);
+	m_event_queue->push_time_change(i_time, i_cb);
+}
+
+void context::queue_camera_change(const std::function<void()>& i_cb)const
+{
+	assert(m_event_queue);
+	m_event_queue->push_camera_change(i_cb);
+}
+
 bool context::object_displayed( const OBJ_Node& i_node ) const
 {
 	return m_object_visibility_resolver->object_displayed( i_node )
@@ -110,6 +265,11 @@ bool context::object_is_phantom(const OBJ_Node& i_node) const
 	return m_object_visibility_resolver->object_is_phantom(i_node);
 }
 
+void context::update_visibility(const OBJ_Node& i_node)const
+{
+	m_object_visibility_resolver->update(i_node);
+}
+
 const OP_BundlePattern* context::lights_to_render()const
 {
 	assert(m_object_visibility_resolver);
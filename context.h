@@ -8,18 +8,41 @@
 #include <SYS/SYS_Types.h>
 
 #include <assert.h>
+#include <stdint.h>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
 
+class ipr_crop_culling;
+class ipr_event_queue;
+class ipr_frame_cache;
 class OBJ_Node;
 class ROP_Node;
 class VOP_Node;
 class ROP_3Delight;
 typedef std::map<VOP_Node*, std::unordered_set<std::string>> ObjectsMapping;
 
+/**
+	\brief What was exported for a refined primitive, used to detect which of
+	its attributes have changed in IPR.
+
+	\ref primitive::signature
+*/
+struct primitive_signature
+{
+	/// GT primitive type
+	int m_type{0};
+	/// Hash of everything that can't be updated without re-creating the node
+	size_t m_topology{0};
+	/// Data ID of each attribute, by name (-1 when it's unknown)
+	std::map<std::string, int64_t> m_attributes;
+};
+
 enum rop_type
 {
 	standard,
@@ -37,6 +60,8 @@ enum rop_type
 class context
 {
 	friend class camera;
+	friend class ipr_event_queue;
+	friend class ipr_frame_cache;
 
 public:
 
@@ -68,6 +93,16 @@ public:
 		const std::string& i_export_path,
 		rop_type i_rop_type );
 
+	/**
+		\brief A context that exports the same IPR render as i_context, but
+		into another NSI context.
+
+		It's used to record scene updates into NSI streams. It doesn't watch
+		the scene for changes.
+		\ref ipr_frame_cache
+	*/
+	context(const context& i_context, NSI::Context& i_nsi);
+
 	~context();
 
 	/// Returns true if motion blur is required for this render
@@ -107,6 +142,14 @@ public:
 	/// Returns true if an object is in the phantom bundle.
 	bool object_is_phantom(const OBJ_Node& i_node)const;
 
+	/**
+		\brief Resolves the visibility of an object again.
+
+		Visibility is resolved once per frame, so this must be called when an
+		object is created or modified during an IPR render.
+	*/
+	void update_visibility(const OBJ_Node& i_node)const;
+
 	/// Returns the bundle pattern built from the "lights to render" setting
 	const OP_BundlePattern* lights_to_render()const;
 
@@ -118,11 +161,64 @@ public:
 		\param i_cb
 			Pointer to the function callback.
 	*/
-	void register_interest(OP_Node* i_node, OP_EventMethod i_cb)const
-	{
-		assert(m_ipr);
-		m_interests.emplace_back(i_node, const_cast<context*>(this), i_cb);
-	}
+	void register_interest(OP_Node* i_node, OP_EventMethod i_cb)const;
+
+	/**
+		\brief Stops looking up the interests registered for a node.
+
+		They can't be removed immediately since they will still receive the
+		node's deletion events, so they're destroyed later, once inactive.
+		Registering an interest on the same node again will create a new one.
+	*/
+	void forget_interests(OP_Node* i_node)const;
+
+	/// Returns the number of interests registered in IPR mode
+	size_t nb_interests()const;
+
+	/**
+		\brief Requests a "synchronize" render control to be sent to the
+		renderer once the IPR events being processed are all handled.
+
+		IPR callbacks should call this instead of sending the render control
+		themselves, so that a single one is sent for many events.
+		\ref ipr_event_queue
+	*/
+	void request_synchronize()const { m_synchronize_requested = true; }
+
+	/**
+		\brief Returns true if the IPR time change being processed has been
+		superseded by a more recent one.
+
+		Long IPR updates can check this to stop early, since the remaining
+		work will be done again for the new time.
+		\ref ipr_event_queue::cancelled
+	*/
+	bool ipr_update_cancelled()const;
+
+	/**
+		\brief Queues a time change during an IPR render.
+
+		i_cb will be called with i_time from the IPR event queue, once per
+		export stage until it returns false, unless another time change occurs
+		before. \ref ipr_event_queue::push_time_change
+	*/
+	void queue_time_change(
+		double i_time,
+		const std::function<bool(double)>& i_cb)const;
+
+	/**
+		\brief Queues a change of the viewport camera during an IPR render.
+
+		i_cb will be called from the IPR event queue, once for all the changes
+		received meanwhile. \ref ipr_event_queue::push_camera_change
+	*/
+	void queue_camera_change(const std::function<void()>& i_cb)const;
+
+	/// Returns the IPR frame cache, or null if frames are not recorded
+	ipr_frame_cache* frame_cache()const { return m_frame_cache.get(); }
+
+	/// Returns the IPR crop region culling, or null if it's disabled
+	ipr_crop_culling* crop_culling()const { return m_crop_culling.get(); }
 
 	/**
 		\brief Returns the animation time used for rendering.
@@ -139,6 +235,65 @@ public:
 	/** For each material store the objects to where they are connected. */
 	mutable ObjectsMapping material_to_objects;
 
+	/**
+		Material VOPs assigned to each object, by object unique ID. Filled
+		while geometry is refined, so that incandescence lights don't have to
+		cook and scan the objects they select again. It must be cleared for
+		each frame.
+		\ref geometry::update_materials_mapping
+	*/
+	mutable std::unordered_map<int, std::unordered_set<VOP_Node*>>
+		m_object_materials;
+
+	/**
+		Fingerprints of the VOPs already exported into the current NSI context,
+		by NSI handle. It must be cleared whenever a new NSI context is begun.
+		\ref vop::fingerprint
+	*/
+	mutable std::unordered_map<std::string, size_t> m_vop_fingerprints;
+
+	/**
+		Handles of VOPs that are not exported because a structurally identical
+		shader network is exported instead, mapped to the handle of that
+		network's node. It must be cleared along with m_vop_fingerprints.
+		\ref scene::deduplicate_shaders
+	*/
+	mutable std::unordered_map<std::string, std::string> m_shader_aliases;
+
+	/**
+		Stand-in NSI file of each geometry file checked so far, or an empty
+		string when there is none. It must be cleared for each frame, since
+		stand-ins could be written meanwhile.
+		\ref standin::find
+	*/
+	mutable std::unordered_map<std::string, std::string> m_standin_files;
+
+	/**
+		Handles of the stand-in procedurals already exported into the current
+		NSI context, each with true if the bounds of its geometry file have
+		been looked for. It must be cleared along with m_vop_fingerprints.
+		\ref standin::export_procedural
+	*/
+	mutable std::unordered_map<std::string, bool> m_exported_standins;
+
+	/**
+		Signatures of the primitives of each geometry exported in IPR, by
+		geometry handle. They allow SOP changes to be applied in place when
+		only some attributes are modified.
+		\ref geometry::update_attributes
+	*/
+	mutable std::unordered_map<std::string, std::vector<primitive_signature>>
+		m_geometry_signatures;
+
+	/**
+		Fraction of curves kept by the hair LOD for each object exported in
+		IPR, by unique ID, so that it can be updated when the camera moves.
+		It's shared with recording contexts.
+		\ref curvemesh::update_lod
+	*/
+	std::shared_ptr<std::unordered_map<int, double>> m_hair_lod_fractions{
+		std::make_shared<std::unordered_map<int, double>>()};
+
 	/// Updates the context with the main exported .nsi file name. 
 	void set_export_path(const std::string& i_path);
 
@@ -174,15 +329,32 @@ private:
 	std::string m_rop_path;
 
 	/*
-		List of interests (callbacks) created in IPR mode.
-		We don't use a vector because there might be a lot of items (1 or 2 per
-		node) and the re-allocation pattern of std::vector implies copying its
-		into a bigger array. In the case of our safe_interest class, this would
-		mean additional connections (in copy-constructor) and disconnections (in
-		destructor) from nodes, so the callbacks point to the right
-		safe_interest object.
-	*/
-	mutable std::deque<safe_interest> m_interests;
+		Queue through which the callbacks of IPR interests are called. It must
+		outlive m_interests.
+	*/
+	std::shared_ptr<ipr_event_queue> m_event_queue;
+
+	/// Updates exported for recently visited frames, in IPR
+	std::unique_ptr<ipr_frame_cache> m_frame_cache;
+
+	/// Objects culled from the crop region, shared with recording contexts
+	std::shared_ptr<ipr_crop_culling> m_crop_culling;
+
+	/// Set by request_synchronize()
+	mutable bool m_synchronize_requested{false};
+
+	/*
+		Interests (callbacks) created in IPR mode, by node, with at most one
+		per callback. There are usually 1 or 2 per node. They're allocated
+		individually because copying a safe_interest means additional
+		connections (in copy-constructor) and disconnections (in destructor)
+		from nodes.
+	*/
+	mutable std::unordered_map<
+		OP_Node*,
+		std::vector<std::unique_ptr<safe_interest>>> m_interests;
+	/// Interests of deleted nodes, waiting to become inactive
+	mutable std::vector<std::unique_ptr<safe_interest>> m_forgotten_interests;
 
 protected:
 	ROP_3Delight *m_rop{ nullptr };
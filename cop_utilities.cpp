@@ -2,6 +2,7 @@
 #include "ROP_3Delight.h"
 #include "context.h"
 #include "dl_system.h"
+#include "export_trace.h"
 
 #include <OP/OP_Node.h>
 #include <OP/OP_Director.h>
@@ -45,6 +46,8 @@ std::string cop_utilities::convert_to_texture(
 		return {};
 	}
 
+	export_trace::scope trace( "bake cop", cop );
+
 	short key;
 	TIL_Raster *image = NULL;
 	if( cop->open(key) )
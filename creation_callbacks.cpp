@@ -2,6 +2,7 @@
 
 #include "ROP_3Delight.h"
 #include "safe_interest.h"
+#include "scene_node_index.h"
 
 #include "OBJ/OBJ_Node.h"
 #include "OP/OP_Director.h"
@@ -92,7 +93,8 @@ namespace
 	/**
 		\brief Called when a child of an obj manager changes.
 
-		We only react to the creation of geometry nodes.
+		We react to the creation of geometry nodes, and keep the scene node
+		index up to date.
 	*/
 	void obj_node_cb(
 		OP_Node* i_caller,
@@ -100,6 +102,12 @@ namespace
 		OP_EventType i_type,
 		void* i_data)
 	{
+		if(i_type == OP_CHILD_DELETED)
+		{
+			scene_node_index::get_instance().remove(*(OP_Node*)i_data);
+			return;
+		}
+
 		if(i_type != OP_CHILD_CREATED)
 		{
 			return;
@@ -112,6 +120,8 @@ namespace
 			return;
 		}
 
+		scene_node_index::get_instance().insert(*obj_node);
+
 		// Notify registered ROPs of the new OBJ node
 		rops_mutex.lock();
 		for(ROP_3Delight* rop : rops)
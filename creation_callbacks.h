@@ -16,7 +16,8 @@ class ROP_3Delight;
 	call the appropriate scripts manually *each time* an object is created or a
 	scene is opened.
 	
-	This is also used to notify a ROP of new nodes to be added to an IPR render.
+	This is also used to notify a ROP of new nodes to be added to an IPR render,
+	and to maintain the scene_node_index.
 */
 namespace creation_callbacks
 {
@@ -1,13 +1,92 @@
 #include "curvemesh.h"
+#include "camera.h"
 #include "context.h"
+#include "geometry.h"
+#include "ROP_3Delight.h"
+#include "viewport_hook.h"
 
 #include <GA/GA_Names.h>
+#include <GT/GT_DANumeric.h>
 #include <GT/GT_PrimCurveMesh.h>
+#include <OBJ/OBJ_Camera.h>
 #include <OBJ/OBJ_Node.h>
 #include <nsi.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <type_traits>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	/*
+		Don't go below this fraction of curves, which would require very wide
+		curves to preserve coverage.
+	*/
+	const double k_min_lod_fraction = 0.1;
+
+	/*
+		Ratio by which the fraction of curves must change before an object is
+		re-exported in IPR.
+	*/
+	const double k_lod_update_ratio = 1.25;
+
+	/// Default curve width, when not specified as an attribute
+	const float k_default_width = 0.001f;
+
+	/// Maps an ID to a pseudo-random, but stable, value in [0, 1)
+	double strand_hash(uint32 i_id)
+	{
+		uint32 h = i_id;
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+		return h / 4294967296.0;
+	}
+
+	/// Returns a copy of i_attributes where widths are multiplied by i_scale
+	GT_AttributeListHandle scale_widths(
+		const GT_AttributeListHandle& i_attributes,
+		float i_scale,
+		bool& io_has_width)
+	{
+		if(!i_attributes)
+		{
+			return i_attributes;
+		}
+
+		GT_AttributeListHandle result = i_attributes;
+		for(const char* name : { "width", "pscale" })
+		{
+			GT_DataArrayHandle widths = i_attributes->get(name);
+			if(!widths)
+			{
+				continue;
+			}
+
+			io_has_width = true;
+
+			GT_Size count = widths->entries() * widths->getTupleSize();
+			GT_Real32Array* scaled =
+				new GT_Real32Array(widths->entries(), widths->getTupleSize());
+
+			GT_DataArrayHandle buffer;
+			const fpreal32* values = widths->getF32Array(buffer);
+			for(GT_Size i = 0; i < count; i++)
+			{
+				scaled->data()[i] = values[i] * i_scale;
+			}
+
+			result = result->addAttribute(name, GT_DataArrayHandle(scaled), true);
+		}
+
+		return result;
+	}
+}
 
 curvemesh::curvemesh(
 	const context& i_ctx,
@@ -24,6 +103,230 @@ curvemesh::curvemesh(
 {
 }
 
+double curvemesh::lod_fraction(
+	const context& i_context,
+	OBJ_Node& i_object,
+	const viewport_view* i_view)
+{
+	const ROP_3Delight* rop = i_context.rop();
+	if(!rop)
+	{
+		return 1.0;
+	}
+
+	double time = i_context.current_time();
+	double lod_size = rop->get_settings().get_hair_lod_size(time);
+	if(lod_size <= 0.0)
+	{
+		return 1.0;
+	}
+
+	/*
+		Viewport renders use the viewport's own camera, rather than the ROP's.
+		Free views are not associated to a camera node, so the LOD can't be
+		evaluated for them.
+	*/
+	OBJ_Camera* cam = nullptr;
+	int resolution[2];
+	if(i_context.m_rop_type == rop_type::viewport)
+	{
+		viewport_view view =
+			i_view ? *i_view
+			: viewport_hook_builder::instance().active_vport_view();
+		OP_Node* node = OP_Node::lookupNode(view.m_camera_id);
+		OBJ_Node* obj = node ? node->castToOBJNode() : nullptr;
+		cam = obj ? obj->castToOBJCamera() : nullptr;
+		resolution[0] = view.m_resolution[0];
+		resolution[1] = view.m_resolution[1];
+	}
+	else
+	{
+		cam = rop->GetCamera(time);
+		if(cam && !rop->GetScaledResolution(resolution[0], resolution[1]))
+		{
+			cam = nullptr;
+		}
+	}
+
+	double size[2];
+	if(!cam || !camera::get_screen_size(*cam, i_object, time, size[0], size[1]))
+	{
+		return 1.0;
+	}
+
+	double pixels =
+		std::max(size[0] * resolution[0], size[1] * resolution[1]);
+	if(pixels >= lod_size)
+	{
+		return 1.0;
+	}
+
+	// Keep roughly the same number of curves per pixel
+	double fraction = (pixels / lod_size) * (pixels / lod_size);
+	return std::max(fraction, k_min_lod_fraction);
+}
+
+bool curvemesh::update_lod(
+	const context& i_context,
+	OBJ_Node* i_object,
+	const viewport_view* i_view)
+{
+	std::unordered_map<int, double>& fractions =
+		*i_context.m_hair_lod_fractions;
+
+	std::vector<OBJ_Node*> changed;
+	for(auto f = fractions.begin(); f != fractions.end(); )
+	{
+		OP_Node* node = OP_Node::lookupNode(f->first);
+		OBJ_Node* obj = node ? node->castToOBJNode() : nullptr;
+		if(!obj)
+		{
+			f = fractions.erase(f);
+			continue;
+		}
+
+		if(!i_object || obj == i_object)
+		{
+			double fraction = lod_fraction(i_context, *obj, i_view);
+			double ratio =
+				std::max(fraction, f->second) / std::min(fraction, f->second);
+			if(ratio >= k_lod_update_ratio)
+			{
+				changed.push_back(obj);
+			}
+		}
+
+		++f;
+	}
+
+	// This records the new fractions
+	for(OBJ_Node* obj : changed)
+	{
+		geometry::re_export(i_context, *obj);
+	}
+
+	return !changed.empty();
+}
+
+/**
+	Removing curves keeps the coverage if their widths are scaled by the
+	inverse of the fraction that is kept. Vertices are reduced according to
+	the square root of that fraction, which follows the curves' projected
+	length, keeping both ends and enough vertices for the basis.
+*/
+GT_PrimitiveHandle curvemesh::simplify(
+	const GT_PrimitiveHandle& i_curves,
+	double i_fraction,
+	bool i_reduce_vertices)
+{
+	const GT_PrimCurveMesh *curves =
+		static_cast<const GT_PrimCurveMesh *>(i_curves.get());
+
+	if(i_fraction >= 1.0 || !curves->isUniformOrder())
+	{
+		return i_curves;
+	}
+
+	GT_Size min_vertices = curves->getBasis() == GT_BASIS_LINEAR ? 2 : 4;
+	double vertex_fraction = i_reduce_vertices ? sqrt(i_fraction) : 1.0;
+
+	const GT_AttributeListHandle& uniform = curves->getUniformAttributes();
+	GT_DataArrayHandle ids = uniform ? uniform->get("id") : GT_DataArrayHandle();
+	GT_DataArrayHandle ids_buffer;
+	const int32* id_values =
+		ids && ids->getTupleSize() == 1 ? ids->getI32Array(ids_buffer) : nullptr;
+
+	const GT_CountArray &count_array = curves->getCurveCountArray();
+
+	std::vector<int32> kept_curves;
+	std::vector<int32> kept_vertices;
+	std::vector<int32> counts;
+	for(GT_Size c = 0; c < count_array.entries(); c++)
+	{
+		uint32 id = id_values ? uint32(id_values[c]) : uint32(c);
+		if(strand_hash(id) >= i_fraction)
+		{
+			continue;
+		}
+
+		GT_Size nb_vertices = count_array.getCount(c);
+		GT_Size offset = count_array.getOffset(c);
+
+		GT_Size kept = nb_vertices;
+		if(i_reduce_vertices && nb_vertices > min_vertices)
+		{
+			kept = std::max(
+				min_vertices, GT_Size(ceil(nb_vertices * vertex_fraction)));
+		}
+
+		for(GT_Size v = 0; v < kept; v++)
+		{
+			GT_Size source =
+				kept == nb_vertices
+				?	v
+				:	GT_Size(floor(
+						double(v) * (nb_vertices-1) / (kept-1) + 0.5));
+			kept_vertices.push_back(int32(offset + source));
+		}
+
+		kept_curves.push_back(int32(c));
+		counts.push_back(int32(kept));
+	}
+
+	if(kept_curves.empty())
+	{
+		// A very small mesh, not worth simplifying
+		return i_curves;
+	}
+
+	auto make_array = [](const std::vector<int32>& i_values)
+	{
+		GT_Int32Array* array = new GT_Int32Array(i_values.size(), 1);
+		std::copy(i_values.begin(), i_values.end(), array->data());
+		return GT_DataArrayHandle(array);
+	};
+
+	float width_scale = float(1.0 / i_fraction);
+	bool has_width = false;
+
+	GT_AttributeListHandle vertex = scale_widths(
+		curves->getVertexAttributes()->createIndirect(
+			make_array(kept_vertices)),
+		width_scale,
+		has_width);
+
+	GT_AttributeListHandle uniform_kept = scale_widths(
+		uniform ? uniform->createIndirect(make_array(kept_curves)) : uniform,
+		width_scale,
+		has_width);
+
+	GT_AttributeListHandle detail =
+		scale_widths(curves->getDetailAttributes(), width_scale, has_width);
+
+	if(!has_width)
+	{
+		// Scale the width that export_basic_attributes would use by default
+		GT_Real32Array* width = new GT_Real32Array(1, 1);
+		width->data()[0] = k_default_width * width_scale;
+		detail =
+			detail
+			?	detail->addAttribute("width", GT_DataArrayHandle(width), true)
+			:	GT_AttributeList::createAttributeList(
+					"width", GT_DataArrayHandle(width), nullptr);
+	}
+
+	GT_PrimCurveMesh* simplified = new GT_PrimCurveMesh(
+		curves->getBasis(),
+		make_array(counts),
+		vertex,
+		uniform_kept,
+		detail,
+		curves->getWrap());
+	simplified->setPrimitiveTransform(curves->getPrimitiveTransform());
+
+	return GT_PrimitiveHandle(simplified);
+}
+
 void curvemesh::create( void ) const
 {
 	const GT_PrimCurveMesh *curve =
@@ -157,6 +460,29 @@ void curvemesh::export_basic_attributes(
 			anyway.
 		*/
 		m_nsi.SetAttributeAtTime( m_handle, i_time,
-			NSI::FloatArg("width", 0.001f) );
+			NSI::FloatArg("width", k_default_width) );
+	}
+}
+
+/**
+	Curve widths follow the same time samples as the vertices' positions. uvs
+	are always exported, at the current time.
+*/
+primitive::attribute_update curvemesh::get_attribute_update(
+	const std::string& i_name)const
+{
+	if( i_name == "uv" )
+	{
+		return attribute_update::e_current_time;
+	}
+
+	if( i_name == "width" || i_name == "pscale" )
+	{
+		return
+			has_velocity_blur()
+			?	attribute_update::e_rebuild
+			:	attribute_update::e_time_samples;
 	}
+
+	return common_attribute_update(i_name);
 }
@@ -2,6 +2,8 @@
 
 #include "primitive.h"
 
+struct viewport_view;
+
 class curvemesh : public primitive
 {
 public:
@@ -11,12 +13,71 @@ public:
 	void create( void ) const override;
 	void set_attributes( void ) const override;
 
+	/**
+		\brief Returns the fraction of an object's curves to keep with the
+		hair LOD.
+
+		The LOD is enabled by setting the ROP's "Hair LOD Size" to a size in
+		pixels. Objects whose projection on the rendered image is smaller than
+		that keep a fraction of their curves proportional to their projected
+		area. The image is that of the render camera or, for viewport renders,
+		of the camera through which a viewport looks. Otherwise, and when the
+		LOD is disabled, 1 is returned.
+
+		\param i_view
+			The viewport's camera and resolution, for viewport renders. When
+			null, those copied during the last viewport refresh are used.
+	*/
+	static double lod_fraction(
+		const context& i_context,
+		OBJ_Node& i_object,
+		const viewport_view* i_view = nullptr);
+
+	/**
+		\brief Returns a curve mesh with only a fraction of i_curves' curves.
+
+		The selection of each curve only depends on its "id" attribute (or its
+		index when there isn't one) so it remains the same from one time
+		sample, or one frame, to the next. The width of the remaining curves
+		is scaled to preserve the coverage of the whole mesh. When
+		i_reduce_vertices is true, the number of vertices of each curve is
+		also reduced.
+	*/
+	static GT_PrimitiveHandle simplify(
+		const GT_PrimitiveHandle& i_curves,
+		double i_fraction,
+		bool i_reduce_vertices);
+
+	/**
+		\brief Re-exports the IPR objects whose hair LOD has changed.
+
+		This must be called when the camera moves, or when i_object does, since
+		the LOD depends on their relative positions. Objects are only
+		re-exported when their fraction of curves changes significantly, so
+		that small camera moves don't re-export them over and over.
+
+		\param i_object
+			The object to update, or null to update all objects with curves.
+		\param i_view
+			The viewport's camera and resolution, \ref lod_fraction.
+		\returns
+			True if any object was re-exported.
+		\ref context::m_hair_lod_fractions
+	*/
+	static bool update_lod(
+		const context& i_context,
+		OBJ_Node* i_object = nullptr,
+		const viewport_view* i_view = nullptr);
+
 protected:
 	/// Exports time-dependent attributes to NSI
 	void set_attributes_at_time(
 		double i_time,
 		const GT_PrimitiveHandle i_gt_primitive)const override;
 
+	attribute_update get_attribute_update(
+		const std::string& i_name)const override;
+
 private:
 	/**
 		\brief Exports "width" and possibly also "P" and "id" attributes.
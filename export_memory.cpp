@@ -0,0 +1,313 @@
+#include "export_memory.h"
+
+#include "dl_system.h"
+#include "json_utilities.h"
+
+#include <GT/GT_DataArray.h>
+#include <OP/OP_Node.h>
+#include <UT/UT_TempFileManager.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+	/// Returns the number of objects listed in reports
+	unsigned nb_reported_objects()
+	{
+		static const unsigned s_nb_objects =
+			[]()
+			{
+				const char* env = dl_system::get_env("_3DELIGHT_EXPORT_MEMORY");
+				int n = env ? atoi(env) : 0;
+				return n > 0 ? unsigned(n) : 10u;
+			}();
+		return s_nb_objects;
+	}
+
+	/// Formats an amount of memory for humans
+	std::string megabytes(size_t i_bytes)
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.1f MB", i_bytes / (1024.0*1024.0));
+		return buffer;
+	}
+}
+
+export_memory::transient::transient(const OP_Node* i_node)
+	:	m_node(i_node),
+		m_bytes(0),
+		m_recording(export_memory::get_instance().m_recording)
+{
+}
+
+export_memory::transient::~transient()
+{
+	if(!m_recording || m_bytes == 0)
+	{
+		return;
+	}
+
+	export_memory& memory = export_memory::get_instance();
+	std::lock_guard<std::mutex> lock(memory.m_mutex);
+
+	/*
+		Statistics might have been reset by a new frame while this scope was
+		alive.
+	*/
+	auto object = memory.m_objects.find(m_node);
+	if(object == memory.m_objects.end())
+	{
+		return;
+	}
+
+	size_t bytes = std::min(m_bytes, object->second.m_transient);
+	object->second.m_transient -= bytes;
+	memory.m_transient -= std::min(bytes, memory.m_transient);
+}
+
+void export_memory::transient::add(size_t i_bytes)
+{
+	if(!m_recording || i_bytes == 0)
+	{
+		return;
+	}
+
+	export_memory& memory = export_memory::get_instance();
+	std::lock_guard<std::mutex> lock(memory.m_mutex);
+
+	if(!memory.m_recording)
+	{
+		return;
+	}
+
+	m_bytes += i_bytes;
+	memory.m_transient += i_bytes;
+
+	usage& object = memory.m_objects[m_node];
+	object.m_transient += i_bytes;
+	memory.update_peaks(object);
+}
+
+void export_memory::transient::add(const GT_DataArrayHandle& i_buffer)
+{
+	if(m_recording && i_buffer)
+	{
+		add(size_t(i_buffer->getMemoryUsage()));
+	}
+}
+
+export_memory& export_memory::get_instance()
+{
+	/* Our only instance */
+	static export_memory s_memory;
+	return s_memory;
+}
+
+bool export_memory::enabled()
+{
+	static const bool s_enabled =
+		dl_system::get_env("_3DELIGHT_EXPORT_MEMORY") != nullptr;
+	return s_enabled;
+}
+
+void export_memory::begin_frame()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_retained = 0;
+	m_transient = 0;
+	m_objects.clear();
+	m_phases.clear();
+	m_recording = true;
+}
+
+void export_memory::begin_phase(const char* i_name)
+{
+	if(!m_recording)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_phases.push_back(phase{i_name, m_retained + m_transient});
+}
+
+void export_memory::add_retained(const OP_Node* i_node, size_t i_bytes)
+{
+	if(!m_recording || i_bytes == 0)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_retained += i_bytes;
+
+	usage& object = m_objects[i_node];
+	object.m_retained += i_bytes;
+	update_peaks(object);
+}
+
+/**
+	The object's own retained memory is left as is, since it's the most it
+	has ever retained during the frame that matters.
+*/
+void export_memory::release_retained(size_t i_bytes)
+{
+	if(!m_recording)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_retained -= std::min(i_bytes, m_retained);
+}
+
+std::string export_memory::report()const
+{
+	if(!m_recording)
+	{
+		return {};
+	}
+
+	std::vector<std::pair<std::string, usage>> objects = top_objects();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const phase* peak = nullptr;
+	for(const phase& p : m_phases)
+	{
+		if(!peak || p.m_peak > peak->m_peak)
+		{
+			peak = &p;
+		}
+	}
+
+	std::string report = "Export memory peak: ";
+	if(peak)
+	{
+		report += megabytes(peak->m_peak);
+		report += " (";
+		report += peak->m_name;
+		report += ")";
+	}
+	else
+	{
+		report += megabytes(m_retained + m_transient);
+	}
+
+	for(const auto& object : objects)
+	{
+		report += "\n";
+		report += object.first;
+		report += ": ";
+		report += megabytes(object.second.m_retained);
+		report += " retained, ";
+		report += megabytes(object.second.m_transient_peak);
+		report += " transient";
+	}
+
+	return report;
+}
+
+std::string export_memory::end_frame(const std::string& i_file)
+{
+	if(!m_recording)
+	{
+		return {};
+	}
+
+	std::vector<std::pair<std::string, usage>> objects = top_objects();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_recording = false;
+
+	std::string file_name = i_file;
+	if(file_name.empty())
+	{
+		file_name =
+			UT_TempFileManager::getTempFilename().toStdString() + ".memory.json";
+	}
+
+	std::ofstream file(file_name);
+	if(!file)
+	{
+		return {};
+	}
+
+	file << "{\n\"phases\":[";
+	for(size_t p = 0; p < m_phases.size(); p++)
+	{
+		file << (p > 0 ? "," : "") << "\n{\"name\":\"" << m_phases[p].m_name
+			<< "\",\"peak\":" << m_phases[p].m_peak << "}";
+	}
+	file << "\n],\n\"objects\":[";
+	for(size_t o = 0; o < objects.size(); o++)
+	{
+		file << (o > 0 ? "," : "") << "\n{\"object\":";
+		json_utilities::write_string(file, objects[o].first);
+		file << ",\"retained\":" << objects[o].second.m_retained
+			<< ",\"transient\":" << objects[o].second.m_transient_peak << "}";
+	}
+	file << "\n]\n}\n";
+
+	return file ? file_name : std::string();
+}
+
+/**
+	A phase's peak is only updated when memory is added, which is also the
+	only time the total can increase.
+*/
+void export_memory::update_peaks(usage& io_usage)
+{
+	io_usage.m_transient_peak =
+		std::max(io_usage.m_transient_peak, io_usage.m_transient);
+
+	if(!m_phases.empty())
+	{
+		m_phases.back().m_peak =
+			std::max(m_phases.back().m_peak, m_retained + m_transient);
+	}
+}
+
+std::vector<std::pair<std::string, export_memory::usage>>
+export_memory::top_objects()const
+{
+	std::vector<std::pair<const OP_Node*, usage>> objects;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		objects.assign(m_objects.begin(), m_objects.end());
+	}
+
+	auto total = [](const usage& u) { return u.m_retained + u.m_transient_peak; };
+
+	size_t nb_objects = std::min(size_t(nb_reported_objects()), objects.size());
+	std::partial_sort(
+		objects.begin(), objects.begin() + nb_objects, objects.end(),
+		[&total](
+			const std::pair<const OP_Node*, usage>& a,
+			const std::pair<const OP_Node*, usage>& b)
+		{
+			return total(a.second) > total(b.second);
+		});
+
+	std::vector<std::pair<std::string, usage>> top;
+	for(size_t o = 0; o < nb_objects; o++)
+	{
+		std::string path =
+			objects[o].first
+			?	objects[o].first->getFullPath().toStdString()
+			:	std::string("(none)");
+		top.emplace_back(path, objects[o].second);
+	}
+
+	return top;
+}
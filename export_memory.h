@@ -0,0 +1,129 @@
+#pragma once
+
+#include <GT/GT_Handles.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class OP_Node;
+
+/**
+	\brief Accounts for the memory used by each object during a frame's
+	export.
+
+	Two kinds of memory are tracked, by object :
+	- Retained memory is what primitive exporters keep alive from refinement
+	  until they're deleted, mostly GT arrays preserved for all time samples
+	  and VDB grids waiting to be written.
+	- Transient memory is used by temporary buffers while exporting, such as
+	  data converted to the types expected by NSI. The largest amount in use
+	  at any given time is kept for each object.
+
+	The peak of the total (retained and transient) is also kept for each
+	phase of the export. The objects that use the most memory are listed in
+	the render notes and in a JSON file written next to the exported NSI file,
+	or in a temporary file.
+
+	Accounting is enabled by setting _3DELIGHT_EXPORT_MEMORY, optionally to
+	the number of objects to report (10 by default). As with export_trace,
+	only memory used between begin_frame() and end_frame() is accounted for.
+*/
+class export_memory
+{
+public:
+
+	/**
+		\brief Temporary memory used by an object, until the end of the scope.
+
+		Allocations are declared after they're made, with add().
+	*/
+	class transient
+	{
+	public:
+		explicit transient(const OP_Node* i_node);
+		~transient();
+
+		transient(const transient&) = delete;
+		transient& operator=(const transient&) = delete;
+
+		/// Accounts for i_bytes more
+		void add(size_t i_bytes);
+
+		/// Accounts for a conversion buffer returned by GT, if any
+		void add(const GT_DataArrayHandle& i_buffer);
+
+	private:
+		const OP_Node* m_node;
+		size_t m_bytes;
+		bool m_recording;
+	};
+
+	static export_memory& get_instance();
+
+	/// Returns true if accounting was requested through the environment
+	static bool enabled();
+
+	/// Discards the previous frame's statistics and starts accounting
+	void begin_frame();
+
+	/// Starts a new export phase, whose peak will be reported separately
+	void begin_phase(const char* i_name);
+
+	/// Accounts for memory kept alive by an object's exporters
+	void add_retained(const OP_Node* i_node, size_t i_bytes);
+
+	/// Accounts for the release of memory added with add_retained()
+	void release_retained(size_t i_bytes);
+
+	/// Returns a short report of the frame so far, for render notes
+	std::string report()const;
+
+	/**
+		\brief Stops accounting and writes the frame's report into a JSON
+		file.
+
+		\param i_file
+			The JSON file to write. A temporary file is used when it's empty.
+		\returns
+			The name of the file that was written, or an empty string on
+			failure.
+	*/
+	std::string end_frame(const std::string& i_file);
+
+private:
+
+	/// Memory used by a single object
+	struct usage
+	{
+		size_t m_retained{0};
+		size_t m_transient{0};
+		size_t m_transient_peak{0};
+	};
+
+	/// Highest total memory used during an export phase
+	struct phase
+	{
+		const char* m_name;
+		size_t m_peak;
+	};
+
+	export_memory() = default;
+
+	/// Updates the object's and the phase's peaks. m_mutex must be locked.
+	void update_peaks(usage& io_usage);
+
+	/// Returns the objects that use the most memory, with their paths
+	std::vector<std::pair<std::string, usage>> top_objects()const;
+
+	std::atomic<bool> m_recording{false};
+
+	size_t m_retained{0};
+	size_t m_transient{0};
+
+	std::unordered_map<const OP_Node*, usage> m_objects;
+	std::vector<phase> m_phases;
+	mutable std::mutex m_mutex;
+};
@@ -0,0 +1,148 @@
+#include "export_trace.h"
+
+#include "dl_system.h"
+#include "json_utilities.h"
+
+#include <OP/OP_Node.h>
+#include <UT/UT_TempFileManager.h>
+
+#include <fstream>
+
+export_trace::scope::scope(const char* i_name, const OP_Node* i_node)
+	:	m_name(i_name),
+		m_node(i_node),
+		m_recording(export_trace::get_instance().m_recording)
+{
+	if(m_recording)
+	{
+		m_start = std::chrono::steady_clock::now();
+	}
+}
+
+export_trace::scope::~scope()
+{
+	if(m_recording)
+	{
+		export_trace::get_instance().add(
+			m_name, m_node, m_start, std::chrono::steady_clock::now());
+	}
+}
+
+export_trace::export_trace()
+	:	m_origin(std::chrono::steady_clock::now())
+{
+}
+
+export_trace& export_trace::get_instance()
+{
+	/* Our only instance */
+	static export_trace s_trace;
+	return s_trace;
+}
+
+bool export_trace::enabled()
+{
+	static const bool s_enabled =
+		dl_system::get_env("_3DELIGHT_EXPORT_TRACE") != nullptr;
+	return s_enabled;
+}
+
+void export_trace::begin_frame()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_events.clear();
+	m_recording = true;
+}
+
+/**
+	Events are written as they were recorded, in the order in which they
+	ended, since the viewers sort them anyway. All events belong to the same
+	process.
+*/
+std::string export_trace::end_frame(const std::string& i_file)
+{
+	if(!m_recording)
+	{
+		return {};
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_recording = false;
+
+	std::string file_name = i_file;
+	if(file_name.empty())
+	{
+		file_name =
+			UT_TempFileManager::getTempFilename().toStdString() + ".trace.json";
+	}
+
+	std::ofstream file(file_name);
+	if(!file)
+	{
+		m_events.clear();
+		return {};
+	}
+
+	file << "{\"traceEvents\":[\n";
+	for(size_t e = 0; e < m_events.size(); e++)
+	{
+		const event& ev = m_events[e];
+
+		file << "{\"name\":\"" << ev.m_name << "\",\"cat\":\"export\""
+			<< ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.m_thread
+			<< ",\"ts\":" << ev.m_start << ",\"dur\":" << ev.m_duration;
+		if(!ev.m_object.empty())
+		{
+			file << ",\"args\":{\"object\":";
+			json_utilities::write_string(file, ev.m_object);
+			file << "}";
+		}
+		file << (e+1 < m_events.size() ? "},\n" : "}\n");
+	}
+	file << "],\"displayTimeUnit\":\"ms\"}\n";
+
+	m_events.clear();
+
+	return file ? file_name : std::string();
+}
+
+void export_trace::add(
+	const char* i_name,
+	const OP_Node* i_node,
+	std::chrono::steady_clock::time_point i_start,
+	std::chrono::steady_clock::time_point i_end)
+{
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	event ev;
+	ev.m_name = i_name;
+	if(i_node)
+	{
+		ev.m_object = i_node->getFullPath().toStdString();
+	}
+	ev.m_start = duration_cast<microseconds>(i_start - m_origin).count();
+	ev.m_duration = duration_cast<microseconds>(i_end - i_start).count();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// The frame might have ended while the event was being timed
+	if(!m_recording)
+	{
+		return;
+	}
+
+	ev.m_thread = thread_number(std::this_thread::get_id());
+	m_events.push_back(std::move(ev));
+}
+
+int export_trace::thread_number(std::thread::id i_thread)
+{
+	auto t = m_threads.emplace(i_thread, int(m_threads.size()) + 1);
+	return t.first->second;
+}
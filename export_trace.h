@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class OP_Node;
+
+/**
+	\brief Records a timeline of the scene export, in the Chrome trace event
+	format.
+
+	The resulting JSON file can be opened with chrome://tracing or Perfetto.
+	Each event has a name, such as "refine" or "connect", a duration, the
+	thread on which it occurred and, when it concerns a node, that node's
+	full path.
+
+	Tracing is enabled by setting _3DELIGHT_EXPORT_TRACE. Events are only
+	recorded between begin_frame() and end_frame(), which writes them to a
+	file.
+*/
+class export_trace
+{
+public:
+
+	/**
+		\brief Times its own lifetime and records it as an event.
+
+		Scopes are meant to be declared on the stack. They do nothing when no
+		frame is being traced, so they can be left in production code.
+	*/
+	class scope
+	{
+	public:
+		explicit scope(const char* i_name, const OP_Node* i_node = nullptr);
+		~scope();
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+	private:
+		const char* m_name;
+		const OP_Node* m_node;
+		std::chrono::steady_clock::time_point m_start;
+		bool m_recording;
+	};
+
+	static export_trace& get_instance();
+
+	/// Returns true if tracing was requested through the environment
+	static bool enabled();
+
+	/// Discards previous events and starts recording
+	void begin_frame();
+
+	/**
+		\brief Stops recording and writes the events into a file.
+
+		\param i_file
+			The JSON file to write. A temporary file is used when it's empty.
+		\returns
+			The name of the file that was written, or an empty string on
+			failure.
+	*/
+	std::string end_frame(const std::string& i_file);
+
+private:
+
+	/// A "complete" event, in microseconds from m_origin
+	struct event
+	{
+		const char* m_name;
+		std::string m_object;
+		int64_t m_start;
+		int64_t m_duration;
+		int m_thread;
+	};
+
+	export_trace();
+
+	/// Records an event, from any thread
+	void add(
+		const char* i_name,
+		const OP_Node* i_node,
+		std::chrono::steady_clock::time_point i_start,
+		std::chrono::steady_clock::time_point i_end);
+
+	/// Returns a small, stable number for a thread, for readable traces
+	int thread_number(std::thread::id i_thread);
+
+	std::atomic<bool> m_recording{false};
+	std::chrono::steady_clock::time_point m_origin;
+
+	std::vector<event> m_events;
+	std::unordered_map<std::thread::id, int> m_threads;
+	std::mutex m_mutex;
+};
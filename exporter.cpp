@@ -1,6 +1,7 @@
 #include "exporter.h"
 
 #include "context.h"
+#include "export_memory.h"
 #include "vop.h"
 #include "VOP_3DelightMaterialBuilder.h"
 
@@ -131,6 +132,9 @@ void exporter::export_attributes(
 		vertices = i_vertices_list->getI32Array( buffer_in_case_we_need_it );
 	}
 
+	export_memory::transient vertices_memory( m_object );
+	vertices_memory.add( buffer_in_case_we_need_it );
+
 	for(int w = io_which_ones.size()-1; w >= 0; w--)
 	{
 		std::string name = io_which_ones[w];
@@ -149,18 +153,13 @@ void exporter::export_attributes(
 
 		io_which_ones.erase(io_which_ones.begin()+w);
 
-		if( name == "uv" )
-			name = "st";
-
 		if( name == "rest" )
 		{
-			name = "Pref";
 			nsi_type = NSITypePoint;
 		}
 
 		if( name == "rnml" )
 		{
-			name = "Nref";
 			nsi_type = NSITypeNormal;
 		}
 
@@ -170,10 +169,7 @@ void exporter::export_attributes(
 			nsi_type = NSITypePoint;
 		}
 
-		if( name == "pscale" )
-		{
-			name = "width";
-		}
+		name = nsi_attribute_name( name );
 
 		if( owner==GT_OWNER_POINT && i_vertices_list )
 		{
@@ -194,6 +190,9 @@ void exporter::export_attributes(
 					->SetValuePointer(
 						data->getF32Array(buffer_in_case_we_need_it_2))
 					->SetFlags(nsi_flags));
+
+			export_memory::transient conversion_memory( m_object );
+			conversion_memory.add( buffer_in_case_we_need_it_2 );
 			continue;
 		}
 
@@ -211,6 +210,9 @@ void exporter::export_attributes(
 				nsi_data = data->getF32Array(buffer_in_case_we_need_it_2);
 		}
 
+		export_memory::transient conversion_memory( m_object );
+		conversion_memory.add( buffer_in_case_we_need_it_2 );
+
 		if( nsi_type == NSITypeFloat && data->getTupleSize()>1 )
 		{
 			nsi.SetAttributeAtTime( m_handle, i_time,
@@ -244,6 +246,20 @@ void exporter::export_attributes(
 	return; // so that we don't fall into the void.
 }
 
+std::string exporter::nsi_attribute_name( const std::string &i_name )
+{
+	if( i_name == "uv" )
+		return "st";
+	if( i_name == "rest" )
+		return "Pref";
+	if( i_name == "rnml" )
+		return "Nref";
+	if( i_name == "pscale" )
+		return "width";
+
+	return i_name;
+}
+
 void exporter::resolve_material_path(
 	OP_Node *i_relative_path_root, const char *i_path,
 	VOP_Node *o_materials[3] )
@@ -113,6 +113,12 @@ protected:
 		double i_time,
 		GT_DataArrayHandle i_vertices_list = GT_DataArrayHandle()) const;
 
+	/**
+		\brief Returns the name under which export_attributes() exports a
+		Houdini attribute.
+	*/
+	static std::string nsi_attribute_name( const std::string &i_name );
+
 	void resolve_material_path(
 		const char *i_path, VOP_Node **o_materials ) const
 	{
@@ -3,17 +3,23 @@
 
 #include "context.h"
 #include "curvemesh.h"
+#include "export_memory.h"
+#include "export_trace.h"
 #include "instance.h"
+#include "ipr_crop_culling.h"
+#include "light_linking_index.h"
 #include "null.h"
 #include "object_attributes.h"
 #include "polygonmesh.h"
 #include "pointmesh.h"
+#include "ROP_3Delight.h"
 #include "safe_interest.h"
 #include "scene.h"
 #include "time_sampler.h"
 #include "vdb.h"
 #include "vop.h"
 #include "shader_library.h"
+#include "standin.h"
 
 #include <GT/GT_GEODetail.h>
 #include <GT/GT_PrimInstance.h>
@@ -22,6 +28,11 @@
 #include <GT/GT_RefineParms.h>
 #include <GT/GT_PackedAlembic.h>
 
+#include <GA/GA_Iterator.h>
+#include <GA/GA_OffsetList.h>
+#include <GA/GA_PrimitiveTypes.h>
+#include <GA/GA_Range.h>
+#include <GEO/GEO_PrimPoly.h>
 #include <GU/GU_ConvertParms.h>
 #include <GU/GU_PrimVDB.h>
 #include <OBJ/OBJ_Node.h>
@@ -29,15 +40,81 @@
 #include <VOP/VOP_Node.h>
 #include <SOP/SOP_Node.h>
 #include <SYS/SYS_Version.h>
+#include <UT/UT_ParallelUtil.h>
 #include <UT/UT_TempFileManager.h>
 
 #include <iostream>
 #include <algorithm>
+#include <mutex>
+#include <unordered_map>
 
 
 namespace
 {
 
+/**
+	\brief What the refinements of all time samples of an object share, so
+	that the resulting primitives are consistent with each other.
+*/
+struct shared_refinement
+{
+	/// How each point mesh is split into chunks, by index
+	std::unordered_map<unsigned, pointmesh::chunking> m_point_chunks;
+
+	/// Fraction of curves kept by the hair LOD, negative until computed
+	double m_curve_fraction{-1.0};
+	/// True if the hair LOD also reduces the vertices of each curve
+	bool m_reduce_curve_vertices{false};
+
+	/**
+		Protects the members above when ranges of primitives are refined
+		concurrently. It's only held while they're accessed, so that the
+		simplification and splitting of primitives run in parallel.
+	*/
+	std::mutex m_mutex;
+};
+
+/// Number of primitives refined by each task in threaded refinement
+const GA_Size k_primitives_per_range = 1 << 18;
+
+/**
+	\brief Returns true if large curve details should be refined in parallel.
+
+	This is enabled by the ROP's "Refine Curves in Parallel" parameter.
+*/
+bool threaded_refinement(const context& i_context, double i_time)
+{
+	return
+		i_context.rop() &&
+		i_context.rop()->get_settings().get_threaded_curve_refinement(i_time);
+}
+
+/// Returns true if all primitives of a detail are curves
+bool only_curves(const GU_Detail& i_gdp)
+{
+	for(GA_Iterator it(i_gdp.getPrimitiveRange()); !it.atEnd(); ++it)
+	{
+		const GA_Primitive* prim = i_gdp.getPrimitive(*it);
+		switch(prim->getTypeId().get())
+		{
+		case GA_PRIMNURBCURVE:
+		case GA_PRIMBEZCURVE:
+			break;
+		case GA_PRIMPOLY:
+			// Open polygons are polylines
+			if(static_cast<const GEO_PrimPoly*>(prim)->isClosed())
+			{
+				return false;
+			}
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
 /**
 	\brief A GT refiner for an OBJ_Node.
 
@@ -65,6 +142,9 @@ struct OBJ_Node_Refiner : public GT_Refine
 	*/
 	std::vector<primitive*> &m_result;
 
+	/// Shared with the refinement of the object's other time samples
+	shared_refinement& m_shared;
+
 	/**
 		This has to be set at each addPrimitive run. It is necessary
 		for the easy implementation of instances. We need this variable
@@ -78,16 +158,26 @@ struct OBJ_Node_Refiner : public GT_Refine
 	int m_level;
 	bool m_stop;
 
+	/**
+		Index of the first primitive created by this refiner. Each range of
+		primitives refined in parallel has its own base index, so that indices
+		(and thus handles) only depend on the primitive's range and on its
+		position inside it.
+	*/
+	unsigned m_index_base{0};
+
 	OBJ_Node_Refiner(
 		OBJ_Node *i_node,
 		const GU_DetailHandle& i_gu_detail,
 		const context &i_context,
 		double i_time,
-		std::vector<primitive*> &io_result)
+		std::vector<primitive*> &io_result,
+		shared_refinement& io_shared)
 	:
 		m_node(i_node),
 		m_gu_detail(i_gu_detail),
 		m_result(io_result),
+		m_shared(io_shared),
 		m_context(i_context),
 		m_time(i_time),
 		m_level(0),
@@ -112,10 +202,30 @@ struct OBJ_Node_Refiner : public GT_Refine
 		m_node(i_parent->m_node),
 		m_gu_detail(i_parent->m_gu_detail),
 		m_result(i_parent->m_result),
+		m_shared(i_parent->m_shared),
 		m_context(i_parent->m_context),
 		m_time(i_parent->m_time),
 		m_level(i_parent->m_level+1),
-		m_stop(false)
+		m_stop(false),
+		m_index_base(i_parent->m_index_base)
+	{
+	}
+
+	// Constructor used to refine a range of primitives in parallel
+	OBJ_Node_Refiner(
+		const OBJ_Node_Refiner& i_prototype,
+		std::vector<primitive*> &io_result,
+		unsigned i_index_base)
+	:	m_params(i_prototype.m_params),
+		m_node(i_prototype.m_node),
+		m_gu_detail(i_prototype.m_gu_detail),
+		m_result(io_result),
+		m_shared(i_prototype.m_shared),
+		m_context(i_prototype.m_context),
+		m_time(i_prototype.m_time),
+		m_level(0),
+		m_stop(false),
+		m_index_base(i_index_base)
 	{
 	}
 
@@ -127,13 +237,47 @@ struct OBJ_Node_Refiner : public GT_Refine
 		is impossible to manage in the situation where we have motion
 		blur for example. Not only that, but we would have to disable it
 		when we have instances, as the order of primitives comes randomly.
-		Note sure how this can work really.
+		Large details are instead split into ranges of primitives, each
+		refined in order by its own refiner (see refine_detail()).
 	*/
 	virtual bool allowThreading( void ) const override
 	{
 		return false;
 	}
 
+	/// Returns the index of the next primitive
+	unsigned next_index()const
+	{
+		return m_index_base + m_result.size();
+	}
+
+	/**
+		Applies the hair LOD to a curve mesh. The fraction of curves to keep
+		is computed once for all time samples, at the frame's time.
+	*/
+	GT_PrimitiveHandle simplify_curves( const GT_PrimitiveHandle &i_curves )
+	{
+		double fraction;
+		bool reduce_vertices;
+		{
+			std::lock_guard<std::mutex> lock( m_shared.m_mutex );
+			if( m_shared.m_curve_fraction < 0.0 )
+			{
+				m_shared.m_curve_fraction =
+					curvemesh::lod_fraction( m_context, *m_node );
+				m_shared.m_reduce_curve_vertices =
+					m_context.rop() &&
+					m_context.rop()->get_settings().get_hair_lod_reduce_vertices(
+						m_context.current_time() );
+			}
+
+			fraction = m_shared.m_curve_fraction;
+			reduce_vertices = m_shared.m_reduce_curve_vertices;
+		}
+
+		return curvemesh::simplify( i_curves, fraction, reduce_vertices );
+	}
+
 	/**
 		One interesting thing here is how we deal with instances. We first
 		refine() recursively to resolve the instanced geometry since we
@@ -153,7 +297,20 @@ struct OBJ_Node_Refiner : public GT_Refine
 
 		// Create new primitive exporters for refined GT primitives
 
-		unsigned index = m_result.size();
+		unsigned index = next_index();
+
+		/*
+			Packed disk primitives with a stand-in are not refined, so their
+			geometry is never loaded.
+		*/
+		std::string standin_file = standin::get_file(m_context, *i_primitive);
+		if( !standin_file.empty() )
+		{
+			m_result.push_back( new standin(
+				m_context, m_node, m_time, i_primitive, index, standin_file) );
+			m_return.push_back( m_result.back() );
+			return;
+		}
 
 		switch( i_primitive->getPrimitiveType() )
 		{
@@ -184,25 +341,51 @@ struct OBJ_Node_Refiner : public GT_Refine
 			{
 				m_result.push_back(
 					new instance(m_context, m_node, m_time, i_primitive, index));
+				m_return.push_back( m_result.back() );
+				break;
 			}
-			else
+
+			/*
+				Large point meshes can be split into spatially coherent chunks,
+				each exported as a separate particles node.
+			*/
+			std::vector<GT_PrimitiveHandle> chunks;
+			unsigned chunk_size = pointmesh::chunk_size( m_context );
+			if( chunk_size > 0 )
 			{
-				m_result.push_back(
-					new pointmesh(m_context, m_node, m_time, i_primitive, index) );
+				// The map's elements stay in place when it grows
+				pointmesh::chunking* chunking;
+				{
+					std::lock_guard<std::mutex> lock( m_shared.m_mutex );
+					chunking = &m_shared.m_point_chunks[index];
+				}
+
+				pointmesh::split( i_primitive, chunk_size, *chunking, chunks );
+			}
+
+			if( chunks.empty() )
+			{
+				chunks.push_back( i_primitive );
+			}
+
+			for( const GT_PrimitiveHandle& chunk : chunks )
+			{
+				m_result.push_back( new pointmesh(
+					m_context, m_node, m_time, chunk, next_index()) );
+				m_return.push_back( m_result.back() );
 			}
-			m_return.push_back( m_result.back() );
 			break;
 		}
 
 		case GT_PRIM_SUBDIVISION_CURVES:
-			m_result.push_back(
-				new curvemesh(m_context, m_node, m_time, i_primitive, index) );
+			m_result.push_back( new curvemesh(
+				m_context, m_node, m_time, simplify_curves(i_primitive), index) );
 			m_return.push_back( m_result.back() );
 			break;
 
 		case GT_PRIM_CURVE_MESH:
-			m_result.push_back(
-				new curvemesh(m_context, m_node, m_time, i_primitive, index) );
+			m_result.push_back( new curvemesh(
+				m_context, m_node, m_time, simplify_curves(i_primitive), index) );
 			m_return.push_back( m_result.back() );
 			break;
 
@@ -251,7 +434,7 @@ struct OBJ_Node_Refiner : public GT_Refine
 				P->set_as_instanced();
 			}
 
-			index = m_result.size();
+			index = next_index();
 			m_result.push_back(
 				new instance(
 					m_context, m_node,m_time,i_primitive,index, source_models));
@@ -458,6 +641,94 @@ struct OBJ_Node_Refiner : public GT_Refine
 	}
 };
 
+/**
+	\brief Refines an object's cooked detail into primitive exporters.
+
+	When threaded refinement is enabled, large curve details are split into
+	contiguous ranges of primitives that are refined concurrently, each into
+	its own list. The lists are then concatenated in range order, so the
+	resulting primitives come in the same order at each time sample, which
+	merge_time_samples() relies on. The range's number is put in the high bits
+	of its primitives' indices, which keeps them unique and independent of
+	thread scheduling.
+
+	Only details made entirely of curves are split : each curve can be
+	refined and exported on its own. The faces of a polygon or subdivision
+	mesh can't, since splitting the mesh would crack subdivision surfaces and
+	break shared normals and welded UVs. Points are split spatially instead,
+	by pointmesh::split.
+*/
+void refine_detail(
+	OBJ_Node* i_object,
+	const GU_DetailHandle& i_detail_handle,
+	const context& i_context,
+	double i_time,
+	std::vector<primitive*>& o_result,
+	shared_refinement& io_shared)
+{
+	OBJ_Node_Refiner refiner(
+		i_object, i_detail_handle, i_context, i_time, o_result, io_shared);
+
+	const GU_Detail* gdp = i_detail_handle.peekDetail();
+	GA_Size nb_primitives = gdp ? gdp->getNumPrimitives() : 0;
+
+	if(!threaded_refinement(i_context, i_time) ||
+		nb_primitives < 2 * k_primitives_per_range ||
+		!only_curves(*gdp))
+	{
+		GT_PrimitiveHandle gt( GT_GEODetail::makeDetail(i_detail_handle) );
+		gt->refine( refiner, &refiner.m_params );
+		return;
+	}
+
+	// Leave 24 bits of each index to the primitives of a range
+	const GA_Size k_max_ranges = 256;
+	GA_Size range_size = std::max(
+		k_primitives_per_range,
+		(nb_primitives + k_max_ranges - 1) / k_max_ranges);
+	GA_Size nb_ranges = (nb_primitives + range_size - 1) / range_size;
+
+	std::vector<GT_PrimitiveHandle> ranges(nb_ranges);
+	for(GA_Size r = 0; r < nb_ranges; r++)
+	{
+		GA_Size end = std::min(nb_primitives, (r+1) * range_size);
+
+		GA_OffsetList offsets;
+		for(GA_Size p = r * range_size; p < end; p++)
+		{
+			offsets.append(gdp->primitiveOffset(p));
+		}
+
+		GA_Range range(gdp->getPrimitiveMap(), offsets);
+		ranges[r] = GT_GEODetail::makeDetail(i_detail_handle, &range);
+	}
+
+	std::vector<std::vector<primitive*>> results(nb_ranges);
+
+	UTparallelFor(
+		UT_BlockedRange<GA_Size>(0, nb_ranges, 1),
+		[&](const UT_BlockedRange<GA_Size>& i_range)
+		{
+			for(GA_Size r = i_range.begin(); r != i_range.end(); ++r)
+			{
+				if(!ranges[r])
+				{
+					continue;
+				}
+
+				OBJ_Node_Refiner range_refiner(
+					refiner, results[r], unsigned(r) << 24);
+				ranges[r]->refine(range_refiner, &range_refiner.m_params);
+			}
+		});
+
+	for(std::vector<primitive*>& range_result : results)
+	{
+		o_result.insert(
+			o_result.end(), range_result.begin(), range_result.end());
+	}
+}
+
 }
 
 geometry::geometry(const context& i_context, OBJ_Node* i_object)
@@ -467,10 +738,14 @@ geometry::geometry(const context& i_context, OBJ_Node* i_object)
 	fprintf( stderr, "* Refining %s\n", i_object->getFullPath().c_str() );
 #endif
 
+	export_trace::scope trace( "refine", i_object );
+
 	SOP_Node *sop = m_object->getRenderSopPtr();
 
 	assert( sop );
 
+	shared_refinement shared;
+
 	for(
 		time_sampler t(m_context, *m_object, time_sampler::e_deformation); t ; t++)
 	{
@@ -500,11 +775,7 @@ geometry::geometry(const context& i_context, OBJ_Node* i_object)
 
 		std::vector<primitive *> result;
 
-		GT_PrimitiveHandle gt( GT_GEODetail::makeDetail(detail_handle) );
-
-		OBJ_Node_Refiner refiner(
-			m_object, detail_handle, m_context, time, result);
-		gt->refine( refiner, &refiner.m_params );
+		refine_detail(m_object, detail_handle, m_context, time, result, shared);
 
 #ifdef VERBOSE
 		std::cerr << m_object->getFullPath() << " gave us " << result.size() << " primitives" << std::endl;
@@ -539,14 +810,36 @@ geometry::geometry(const context& i_context, OBJ_Node* i_object)
 		}
 	}
 
+	/*
+		Remember the hair LOD of the object, so it can be updated when the
+		camera moves.
+	*/
+	if( m_context.m_ipr && shared.m_curve_fraction >= 0.0 )
+	{
+		(*m_context.m_hair_lod_fractions)[m_object->getUniqueId()] =
+			shared.m_curve_fraction;
+	}
+
 #ifdef VERBOSE
 	std::cout << m_object->getFullPath() << " gave birth to " <<
 		m_primitives.size() << " primitives." << std::endl;
 #endif
+
+	if( export_memory::enabled() )
+	{
+		for( primitive* p : m_primitives )
+		{
+			m_retained_memory += p->retained_memory();
+		}
+		export_memory::get_instance().add_retained(
+			m_object, m_retained_memory );
+	}
 }
 
 geometry::~geometry()
 {
+	export_memory::get_instance().release_retained( m_retained_memory );
+
 	for( primitive* p : m_primitives )
 	{
 		delete p;
@@ -579,6 +872,93 @@ void geometry::set_attributes()const
 		p->set_attributes();
 		p->export_bind_attributes( vops );
 	}
+
+	update_signatures();
+}
+
+bool geometry::update_attributes()const
+{
+	auto previous = m_context.m_geometry_signatures.find(m_handle);
+	if(previous == m_context.m_geometry_signatures.end() ||
+		previous->second.size() != m_primitives.size())
+	{
+		return false;
+	}
+
+	/*
+		Check all primitives before exporting anything, so we don't end up with
+		a partially updated geometry that is then exported again anyway.
+	*/
+	/*
+		Only attributes written by a full export should be updated, which
+		includes those needed by the assigned materials.
+	*/
+	VOP_Node *vops[3] = { nullptr, nullptr, nullptr };
+	get_assigned_materials( vops );
+
+	std::vector<primitive_signature> signatures;
+	std::vector<std::vector<std::string>> changed(m_primitives.size());
+	for(unsigned i = 0; i < m_primitives.size(); i++)
+	{
+		m_primitives[i]->find_bind_attributes( vops );
+
+		signatures.push_back(m_primitives[i]->signature());
+		const primitive_signature& current = signatures.back();
+		const primitive_signature& last = previous->second[i];
+
+		if(current.m_type != last.m_type ||
+			current.m_topology != last.m_topology ||
+			current.m_attributes.size() != last.m_attributes.size())
+		{
+			return false;
+		}
+
+		for(const auto& attribute : current.m_attributes)
+		{
+			auto last_attribute = last.m_attributes.find(attribute.first);
+			if(last_attribute == last.m_attributes.end())
+			{
+				return false;
+			}
+
+			// Unknown data IDs can't be compared, so assume they have changed
+			if(attribute.second == -1 ||
+				attribute.second != last_attribute->second)
+			{
+				changed[i].push_back(attribute.first);
+			}
+		}
+
+		if(!m_primitives[i]->can_update_attributes(changed[i]))
+		{
+			return false;
+		}
+	}
+
+	for(unsigned i = 0; i < m_primitives.size(); i++)
+	{
+		m_primitives[i]->update_attributes(changed[i]);
+	}
+
+	previous->second = signatures;
+
+	return true;
+}
+
+void geometry::update_signatures()const
+{
+	if(!m_context.m_ipr)
+	{
+		return;
+	}
+
+	std::vector<primitive_signature>& signatures =
+		m_context.m_geometry_signatures[m_handle];
+	signatures.clear();
+	for(primitive* p : m_primitives)
+	{
+		signatures.push_back(p->signature());
+	}
 }
 
 void geometry::update_materials_mapping(
@@ -586,6 +966,8 @@ void geometry::update_materials_mapping(
 	const context& i_context,
 	OBJ_Node* i_object)
 {
+	i_context.m_object_materials[i_object->getUniqueId()].insert(i_shader);
+
 	if (i_context.m_ipr)
 	{
 		std::unordered_set<std::string> materials;
@@ -621,7 +1003,7 @@ void geometry::connect_texture(
 {
 	const shader_library& library = shader_library::get_instance();
 	std::string obj_handle = geometry(i_context, i_node).m_handle;
-	std::string mat_handle = vop::handle(*i_shader, i_context);
+	std::string mat_handle = vop::shader_handle(*i_shader, i_context);
 
 	const std::string passthrough_shader(obj_handle + "_passthrough");
 	std::string path = library.get_shader_path("passthrough");
@@ -676,6 +1058,9 @@ void geometry::connect()const
 	// Connect the geometry's hub transform to the null's transform
 	m_nsi.Connect(hub_handle(), "", m_handle, "objects");
 
+	// Materials are recorded again as primitives and the object connect them
+	m_context.m_object_materials.erase(m_object->getUniqueId());
+
 	// Connect all primitives to their ancestor
 	bool volume = false;
 	for(primitive* p : m_primitives)
@@ -764,7 +1149,7 @@ void geometry::connect()const
 			else
 			{
 				m_nsi.Connect(
-					vop::handle(*mats[i], m_context), "",
+					vop::shader_handle(*mats[i], m_context), "",
 					attributes_handle(), slots[i],
 					NSI::IntegerArg("strength", 1));
 			}
@@ -787,7 +1172,7 @@ void geometry::connect()const
 			else
 			{
 				m_nsi.Connect(
-					vop::handle(*mats[i], m_context), "",
+					vop::shader_handle(*mats[i], m_context), "",
 					attributes_handle(), slots[i],
 					NSI::IntegerArg("strength", 1));
 			}
@@ -1009,7 +1394,7 @@ void geometry::export_override_attributes() const
 					connect_texture(vop_node, m_object, m_context, override_nsi_handle);
 				}
 				m_nsi.Connect(
-					vop::handle(*vop_node, m_context), "",
+					vop::shader_handle(*vop_node, m_context), "",
 					override_nsi_handle, "surfaceshader",
 					(
 						NSI::IntegerArg("priority", 10),
@@ -1121,8 +1506,8 @@ void geometry::changed_cb(
 				trap SOP_level updates to this OBJ node. A connection to a
 				single node (the root of the network) seems to be sufficient to
 				catch updates from all its dependencies, through the
-				OP_INPUT_CHANGED event.
-				FIXME : avoid creating duplicate interests for the same SOP.
+				OP_INPUT_CHANGED event. The context ignores the registration if
+				the SOP is already watched.
 			*/
 			ctx->register_interest(render_sop, &geometry::sop_changed_cb);
 
@@ -1157,19 +1542,15 @@ void geometry::changed_cb(
 
 			SOP_Node* sop = obj->getRenderSopPtr();
 			/*
-				Creating a new geo will re_export the node, so we are using
-				an else statement in order to not export the same node twice
-				when updating lightcategories attribute.
-				Also, if there isn't a render SOP, we don't create a new geo node
-				as it will result in crash (assert in geo's ctor).
+				Light categories only affect the connections of the object's
+				NSI node, so there is no need to refine its geometry again.
+				Without a render SOP, the object has no NSI node.
 			*/
 			if (parm.getToken() == std::string("lightcategories") && sop)
 			{
-				geometry geo(*ctx, obj);
-				std::set<std::string> exported_lights_categories;
-				std::vector<OBJ_Node*> lights_to_render;
+				light_linking_index light_linking(*ctx);
 				scene::export_light_categories(
-					*ctx, &geo, exported_lights_categories, lights_to_render, true);
+					*ctx, *obj, handle(*obj, *ctx), light_linking, true);
 			}
 			else
 			{
@@ -1208,7 +1589,7 @@ void geometry::changed_cb(
 			return;
 	}
 
-	ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+	ctx->request_synchronize();
 }
 
 /**
@@ -1238,8 +1619,8 @@ void geometry::sop_changed_cb(
 	OBJ_Node* obj = parent->castToOBJNode();
 	assert(obj);
 
-	re_export(*ctx, *obj);
-	ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+	re_export(*ctx, *obj, false, true);
+	ctx->request_synchronize();
 
 }
 
@@ -1248,22 +1629,55 @@ void geometry::Delete(OBJ_Node& i_node, const context& i_context)
 	i_context.m_nsi.Delete(
 		hub_handle(i_node, i_context),
 		NSI::IntegerArg("recursive", 1));
+
+	i_context.m_geometry_signatures.erase(handle(i_node, i_context));
 }
 
 void geometry::re_export(
 	const context& i_ctx,
 	OBJ_Node& i_node,
-	bool i_new_material)
+	bool i_new_material,
+	bool i_sop_changed)
 {
-	Delete(i_node, i_ctx);
-
 	if(!i_node.getRenderSopPtr() || !i_ctx.object_displayed(i_node))
 	{
+		Delete(i_node, i_ctx);
 		return;
 	}
 
+	/*
+		The geometry holds its cooked details (with a preserve request) and the
+		primitives refined from them, so it's a consistent snapshot of the SOP
+		network from which everything below is exported.
+	*/
 	geometry geo(i_ctx, &i_node);
 
+	/*
+		Objects outside of the crop region are not exported, except for
+		instancers, whose instances could still be visible.
+	*/
+	if(ipr_crop_culling* culling = i_ctx.crop_culling())
+	{
+		std::vector<const instance*> instances;
+		geo.get_instances(instances);
+		if(!instances.empty())
+		{
+			culling->exempt(i_node);
+		}
+		else if(culling->cull(i_ctx, i_node))
+		{
+			Delete(i_node, i_ctx);
+			return;
+		}
+	}
+
+	if(i_sop_changed && !i_new_material && geo.update_attributes())
+	{
+		return;
+	}
+
+	Delete(i_node, i_ctx);
+
 	if(i_new_material)
 	{
 		/*
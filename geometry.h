@@ -70,15 +70,26 @@ public:
 		\param i_new_material
 			Indicates whether material assignment has changed, which requires
 			re-exporting their NSI shader networks to ensure they exist.
+		\param i_sop_changed
+			Indicates that only the node's SOP network has changed. In that
+			case, when the refined primitives keep the same topology, only the
+			modified attributes are exported again, in place.
 	*/
 	static void re_export(
 		const context& i_ctx,
 		OBJ_Node& i_node,
-		bool i_new_material = false);
+		bool i_new_material = false,
+		bool i_sop_changed = false);
 
 	/// Deletes the NSI nodes associated to Houdini node i_node.
 	static void Delete(OBJ_Node& i_node, const context& i_context);
 
+	/**
+		\brief Records that a material is assigned to an object.
+
+		In IPR, this also maps each VOP of the material's network to the
+		object and replaces i_shader by the VOP that's being debugged, if any.
+	*/
 	static void update_materials_mapping(
 		VOP_Node*& i_shader,
 		const context& i_context,
@@ -102,6 +113,19 @@ private:
 		\brief When this geometry is used as an NSI space override.
 	*/
 	void export_override_attributes( void ) const;
+
+	/**
+		\brief Exports again, in place, the attributes that have changed since
+		the last export of the geometry in IPR.
+
+		\returns false, without exporting anything, if the geometry must be
+		exported again from scratch because its primitives have changed in any
+		other way.
+	*/
+	bool update_attributes( void ) const;
+
+	/// Remembers the primitives' signatures as the last export, in IPR
+	void update_signatures( void ) const;
 	
 	/// Returns the handle of the object's main NSI transform node
 	std::string hub_handle()const
@@ -125,4 +149,7 @@ private:
 
 	/// List of refined primitives
 	std::vector<primitive*> m_primitives;
+
+	/// Memory retained by m_primitives, when it's accounted for
+	size_t m_retained_memory{0};
 };
@@ -10,32 +10,25 @@
 #include <UT/UT_String.h>
 #include <UT/UT_WorkArgs.h>
 #include <VOP/VOP_Node.h>
-#include <GA/GA_AIFSharedStringArray.h>
+#include <GA/GA_AIFSharedStringTuple.h>
 #include <GA/GA_Attribute.h>
 #include <GU/GU_Detail.h>
 
 #include <assert.h>
 #include <nsi.hpp>
 
-#include <algorithm>
 
 const char* k_incandescence_multiplier = "incandescence_multiplier";
 namespace
 {
 	/**
-		Returns true if param_name exists into the specified i_shader_info.
+		Returns true if param_name exists into the specified i_shader.
 	*/
-	bool ParameterExist(DlShaderInfo* i_shader_info, const char* param_name)
+	bool ParameterExist(
+		const shader_library::shader_parameters* i_shader,
+		const char* param_name)
 	{
-		for (int i = 0; i < i_shader_info->nparams(); i++)
-		{
-			const DlShaderInfo::Parameter* parameter = i_shader_info->getparam(i);
-			if (parameter->name == param_name)
-			{
-				return true;
-			}
-		}
-		return false;
+		return i_shader->find(param_name) != nullptr;
 	}
 }
 
@@ -91,84 +84,120 @@ void incandescence_light::connect() const
 			obj_node = m_object->findOBJNode(obj_paths(i));
 		}
 
-		if (!obj_node)
+		if (!obj_node || !m_context.object_displayed(*obj_node))
 			continue;
 
-		std::vector< std::string > material_paths;
-
-		OP_Context op_ctx( time );
-		GU_DetailHandle gdh = obj_node->getRenderGeometryHandle(op_ctx);
-		GU_DetailHandleAutoReadLock rlock(gdh);
-		const GU_Detail *gdp = rlock.getGdp();
-
-		if( gdp )
+		bool connected = false;
+		for(VOP_Node* surface : object_materials(*obj_node))
 		{
-			const GA_Attribute *sop[2] =
+			vop::osl_type type = vop::shader_type(surface);
+			if(type != vop::osl_type::e_surface &&
+				type != vop::osl_type::e_other)
 			{
-				gdp->findAttribute(GA_ATTRIB_PRIMITIVE, "shop_materialpath"),
-				gdp->findAttribute(GA_ATTRIB_DETAIL, "shop_materialpath")
-			};
+				continue;
+			}
 
-			int counts[2] = { (int)gdp->getNumPrimitives(), 1 };
+			const shader_library::shader_parameters *shader_info =
+				library.get_shader_parameters(surface);
+			if (!shader_info)
+				continue;
 
-			for (int i = 0; i < sizeof(sop) / sizeof(sop[0]); i++)
+			// Check if incandescence_multiplier exists in this shader
+			if (ParameterExist(shader_info, k_incandescence_multiplier))
 			{
-				if( !sop[i] )
-					continue;
-
-				const GA_AIFStringTuple *strings = sop[i]->getAIFStringTuple();
+				m_nsi.SetAttribute(
+					vop::shader_handle(*surface, m_context),
+					NSI::ColorArg(k_incandescence_multiplier,
+								  incandescenceColor));
 
-				if (!strings)
-					continue;
+				m_current_multipliers.push_back(vop::shader_handle(*surface, m_context));
 
-				for (int j = 0; j < counts[i]; j++)
+				if(!connected)
 				{
-					const char *mat = strings->getString(sop[i], j);
-					if (!mat)
-						continue;
-
-					material_paths.push_back(mat);
+					m_nsi.Connect(
+						geometry::handle(*obj_node, m_context), "",
+						category, "members");
+					connected = true;
 				}
 			}
 		}
+	}
+}
 
-		UT_String obj_mat_path;
-		obj_node->evalString(obj_mat_path, "shop_materialpath", 0, time);
-		material_paths.push_back( obj_mat_path.toStdString() );
+/**
+	The materials are normally recorded by the object's geometry exporter.
+	When the light is exported before the object, its render geometry is
+	scanned here instead, and the result is kept for the rest of the frame.
+*/
+const std::unordered_set<VOP_Node*>& incandescence_light::object_materials(
+	OBJ_Node& i_object)const
+{
+	int id = i_object.getUniqueId();
+	auto it = m_context.m_object_materials.find(id);
+	if(it != m_context.m_object_materials.end())
+	{
+		return it->second;
+	}
+
+	fpreal time = m_context.m_current_time;
+	std::unordered_set<std::string> material_paths;
 
-		auto end = std::unique( material_paths.begin(), material_paths.end() );
-		auto current = material_paths.begin();
+	OP_Context op_ctx( time );
+	GU_DetailHandle gdh = i_object.getRenderGeometryHandle(op_ctx);
+	GU_DetailHandleAutoReadLock rlock(gdh);
+	const GU_Detail *gdp = rlock.getGdp();
 
-		for( ; current != end; current ++ )
+	if( gdp )
+	{
+		const GA_Attribute *sop[2] =
 		{
-			auto mat_path = *current;
-			VOP_Node *mats[3] = {nullptr};
-			resolve_material_path(obj_node, mat_path.c_str(), mats);
+			gdp->findAttribute(GA_ATTRIB_PRIMITIVE, "shop_materialpath"),
+			gdp->findAttribute(GA_ATTRIB_DETAIL, "shop_materialpath")
+		};
 
-			VOP_Node *surface = mats[0];
-			if (!surface)
+		for (int i = 0; i < sizeof(sop) / sizeof(sop[0]); i++)
+		{
+			if( !sop[i] )
 				continue;
 
-			DlShaderInfo *shader_info = library.get_shader_info(surface);
-			if (!shader_info)
+			const GA_AIFSharedStringTuple *strings =
+				sop[i]->getAIFSharedStringTuple();
+
+			if (!strings)
 				continue;
 
-			// Check if incandescence_multiplier exists in this shader
-			if (ParameterExist(shader_info, k_incandescence_multiplier) && m_context.object_displayed(*obj_node))
+			// Each distinct string is only stored once in the string table
+			for(GA_AIFSharedStringTuple::iterator s = strings->begin(sop[i]);
+				!s.atEnd();
+				++s)
 			{
-				m_nsi.SetAttribute(
-					vop::handle(*surface, m_context),
-					NSI::ColorArg(k_incandescence_multiplier,
-								  incandescenceColor));
+				const char *mat = s.getString();
+				if (mat)
+					material_paths.insert(mat);
+			}
+		}
+	}
 
-				m_current_multipliers.push_back(vop::handle(*surface, m_context));
+	UT_String obj_mat_path;
+	i_object.evalString(obj_mat_path, "shop_materialpath", 0, time);
+	material_paths.insert( obj_mat_path.toStdString() );
 
-				m_nsi.Connect(
-					geometry::handle(*obj_node, m_context), "",
-					category, "members");
-			}
+	std::unordered_set<VOP_Node*>& materials =
+		m_context.m_object_materials[id];
+
+	for( const std::string& mat_path : material_paths )
+	{
+		VOP_Node *mats[3] = {nullptr};
+		resolve_material_path(&i_object, mat_path.c_str(), mats);
+
+		for( VOP_Node *mat : mats )
+		{
+			if( mat )
+				materials.insert( mat );
 		}
 	}
+
+	return materials;
 }
 
 /**
@@ -205,7 +234,7 @@ void incandescence_light::changed_cb(
 		return;
 	}
 
-	ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+	ctx->request_synchronize();
 }
 
 void incandescence_light::Delete(OBJ_Node& i_node, const context& i_context)
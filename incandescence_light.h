@@ -3,9 +3,11 @@
 #include "exporter.h"
 
 #include <OP/OP_Value.h>
+#include <unordered_set>
 #include <vector>
 
 class OP_Node;
+class VOP_Node;
 
 /**
 	\brief Incandescence light exporter.
@@ -34,6 +36,9 @@ private:
 	void disconnect()const;
 	/// Computes output color from incandescence parameters
 	void compute_output_color(float o_color[]) const;
+	/// Returns the materials assigned to an object in the current frame
+	const std::unordered_set<VOP_Node*>& object_materials(
+		OBJ_Node& i_object)const;
 
 	/**
 		We have to keep track of the currently "managed" materials as we have
@@ -1,9 +1,11 @@
 #include "instance.h"
 
 #include "context.h"
+#include "export_memory.h"
 #include "vdb.h"
 #include "vop.h"
 #include "dl_system.h"
+#include "standin.h"
 
 #include <nsi.hpp>
 
@@ -137,20 +139,38 @@ void instance::connect( void ) const
 					reported to crash on Windows (although this seems suspicious
 					since 3Delight should already handle that properly).
 				*/
-				if( path.find(".nsi") != std::string::npos &&
-					dl_system::file_exists(path.c_str()) )
+				bool is_nsi =
+					path.find(".nsi") != std::string::npos &&
+					dl_system::file_exists(path.c_str());
+				bool is_vdb =
+					path.size() > 4 && path.substr(path.size()-4) == ".vdb";
+
+				/*
+					Other geometry files, such as .bgeo.sc or .abc, can only be
+					rendered through a pre-converted NSI stand-in.
+				*/
+				std::string standin_file;
+				if( !is_nsi && !is_vdb )
 				{
-					m_nsi.Create(object, "procedural");
-					m_nsi.SetAttribute(
-						object,
-						(
-							NSI::CStringPArg("type", "apistream"),
-							NSI::StringArg("filename", path)
-						) );
-					m_nsi.Connect(object, "", merge_h, "objects");
+					standin_file = standin::find(m_context, path);
+				}
+
+				if( is_nsi || !standin_file.empty() )
+				{
+					/*
+						The procedural is shared by all merge points and
+						instancers that refer to the same file.
+					*/
+					std::string procedural = is_nsi
+						?	standin::export_procedural(m_context, path)
+						:	standin::export_procedural(
+								m_context, standin_file, path);
+					m_nsi.Connect(
+						procedural, "", merge_h, "objects",
+						NSI::IntegerArg("strength", 1));
 				}
 				// Detect VDB files
-				else if(path.size() > 4 && path.substr(path.size()-4) == ".vdb")
+				else if( is_vdb )
 				{
 					m_nsi.Create(object, "volume");
 					NSI::ArgumentList args;
@@ -197,7 +217,7 @@ void instance::connect( void ) const
 
 			// FIXME: use vop::is_texture
 			m_nsi.Connect(
-				vop::handle(*material, m_context), "",
+				vop::shader_handle(*material, m_context), "",
 				attribute_handle, names[i],
 				(
 					NSI::IntegerArg("priority", 2),
@@ -390,6 +410,10 @@ void instance::set_attributes_at_time(
 		time = m_context.ShutterOpen();
 	}
 
+	export_memory::transient matrices_memory( m_object );
+	matrices_memory.add( num_matrices * sizeof(UT_Matrix4D) );
+	matrices_memory.add( tmp );
+
 	NSI::ArgumentList args;
 	args.Add( NSI::Argument::New( "transformationmatrices" )
 		->SetType( NSITypeDoubleMatrix )
@@ -592,6 +616,13 @@ void instance::get_transforms(
 	const float *pivot = pivot_data ? pivot_data->getF32Array(da9) : nullptr;
 	const float *v = v_data ? v_data->getF32Array(da10) : nullptr;
 
+	export_memory::transient conversion_memory( m_object );
+	for( const GT_DataArrayHandle &buffer :
+		{ da1, da2, da3, da4, da5, da6, da7, da8, da9, da10 } )
+	{
+		conversion_memory.add( buffer );
+	}
+
 #if 0
 	printf( "P:%p N:%p up:%p q:%p tr:%p s:%p s3:%p orient:%p pivot:%p v:%p\n",
 		P, N, up, q, tr, s, s3, o, pivot, v );
@@ -0,0 +1,156 @@
+#include "ipr_crop_culling.h"
+
+#include "camera.h"
+#include "context.h"
+#include "geometry.h"
+#include "ROP_3Delight.h"
+
+#include <OBJ/OBJ_Camera.h>
+#include <OBJ/OBJ_Node.h>
+#include <OP/OP_BundlePattern.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <string.h>
+
+ipr_crop_culling::ipr_crop_culling(const context& i_context)
+	:	m_rop_path(i_context.rop()->getFullPath().toStdString())
+{
+	const settings& rop_settings = i_context.rop()->get_settings();
+	if(!rop_settings.get_ipr_crop_culling(i_context.current_time()))
+	{
+		return;
+	}
+
+	m_margin = std::max(
+		0.0, rop_settings.get_ipr_crop_culling_margin(i_context.current_time()));
+
+	UT_String keep = rop_settings.get_crop_culling_keep(
+		i_context.current_time());
+	if(keep.isstring())
+	{
+		m_keep_pattern = OP_BundlePattern::allocPattern(keep);
+	}
+}
+
+ipr_crop_culling::~ipr_crop_culling()
+{
+	if(m_keep_pattern)
+	{
+		OP_BundlePattern::freePattern(m_keep_pattern);
+	}
+}
+
+void ipr_crop_culling::set_crop(const float* i_crop)
+{
+	memcpy(m_crop, i_crop, sizeof(m_crop));
+}
+
+bool ipr_crop_culling::cull(const context& i_context, OBJ_Node& i_object)
+{
+	int id = i_object.getUniqueId();
+	if(m_exempt.count(id))
+	{
+		return false;
+	}
+
+	m_candidates.insert(id);
+
+	if(outside(i_context, i_object))
+	{
+		m_culled.insert(id);
+		return true;
+	}
+
+	m_culled.erase(id);
+	return false;
+}
+
+void ipr_crop_culling::exempt(OBJ_Node& i_object)
+{
+	int id = i_object.getUniqueId();
+	m_exempt.insert(id);
+	m_candidates.erase(id);
+	m_culled.erase(id);
+}
+
+bool ipr_crop_culling::update(const context& i_context)
+{
+	// Re-exporting an object might exempt it, so iterate on a copy
+	std::vector<int> candidates(m_candidates.begin(), m_candidates.end());
+
+	bool modified = false;
+	for(int id : candidates)
+	{
+		OP_Node* node = OP_Node::lookupNode(id);
+		OBJ_Node* obj = node ? node->castToOBJNode() : nullptr;
+		if(!obj)
+		{
+			// The object has been deleted
+			m_candidates.erase(id);
+			m_culled.erase(id);
+			continue;
+		}
+
+		modified = update(i_context, *obj) || modified;
+	}
+
+	return modified;
+}
+
+bool ipr_crop_culling::update(const context& i_context, OBJ_Node& i_object)
+{
+	int id = i_object.getUniqueId();
+	if(!m_candidates.count(id) ||
+		!i_object.getRenderSopPtr() ||
+		!i_context.object_displayed(i_object))
+	{
+		return false;
+	}
+
+	bool was_culled = m_culled.count(id) > 0;
+	if(outside(i_context, i_object) == was_culled)
+	{
+		return false;
+	}
+
+	if(was_culled)
+	{
+		m_culled.erase(id);
+		geometry::re_export(i_context, i_object);
+	}
+	else
+	{
+		m_culled.insert(id);
+		geometry::Delete(i_object, i_context);
+	}
+
+	return true;
+}
+
+/**
+	The object is tested at the current time only. Motion blur could make it
+	visible in the crop region during part of the shutter interval, which the
+	margin should account for.
+*/
+bool ipr_crop_culling::outside(
+	const context& i_context,
+	OBJ_Node& i_object)const
+{
+	if(m_keep_pattern &&
+		!m_keep_pattern->isNullPattern() &&
+		m_keep_pattern->match(&i_object, m_rop_path.c_str(), true))
+	{
+		return false;
+	}
+
+	double time = i_context.current_time();
+	OBJ_Camera* cam = i_context.rop()->GetCamera(time);
+	if(!cam || cam == &i_object)
+	{
+		return false;
+	}
+
+	return !camera::is_in_frustum(*cam, i_object, time, m_crop, m_margin);
+}
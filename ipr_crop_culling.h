@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+
+class context;
+class OBJ_Node;
+class OP_BundlePattern;
+
+/**
+	\brief Keeps geometry that can't be seen through the crop region of an
+	IPR render out of the NSI scene.
+
+	When rendering a small region of the image from 3Delight Display, the
+	objects whose bounding box falls entirely outside of the camera frustum
+	restricted to that region are not exported (or are deleted from the NSI
+	scene if they already were). They are exported again as soon as they
+	come back into the region, either because the crop region, the camera or
+	the object itself has moved.
+
+	Objects outside of the region can still be seen indirectly, through
+	reflections, refractions or shadows. Those that matter can be excluded
+	from culling with the ROP's "Objects Kept Outside of IPR Crop" parameter,
+	which holds an object pattern or bundle (eg : "@reflectors").
+
+	Culling is enabled by the ROP's "Cull Objects Outside of IPR Crop" toggle.
+	Its "IPR Crop Margin" is added around the crop region, as a fraction of the
+	image size. A margin of 0.1 would keep objects that are slightly outside of
+	the region, which are likely to appear if it's dragged a bit further.
+
+	Instancers and instanced objects are never culled, since the bounding box
+	of the former doesn't include its instances and the latter are referenced
+	by other objects.
+
+	Frames are not recorded (\ref ipr_frame_cache) while culling is enabled,
+	since their replay wouldn't take the current crop region into account.
+
+	The culling state is only accessed while holding Houdini's global lock,
+	so it isn't protected otherwise.
+*/
+class ipr_crop_culling
+{
+public:
+
+	/// Constructor. i_context is the IPR rendering context.
+	ipr_crop_culling(const context& i_context);
+	~ipr_crop_culling();
+
+	/// Returns false if culling has been disabled
+	bool enabled()const { return m_margin >= 0.0; }
+
+	/// Sets the crop window, in the format of the NSI screen's "crop" attribute
+	void set_crop(const float* i_crop);
+
+	/**
+		\brief Decides whether a geometry object about to be exported should
+		be culled.
+
+		The object is then watched by subsequent calls to update().
+
+		\returns
+			True if the object should not be exported.
+	*/
+	bool cull(const context& i_context, OBJ_Node& i_object);
+
+	/// Prevents an object from ever being culled
+	void exempt(OBJ_Node& i_object);
+
+	/**
+		\brief Culls the objects that have left the crop region and exports
+		those that have come back into it.
+
+		\returns
+			True if the NSI scene has been modified.
+	*/
+	bool update(const context& i_context);
+
+	/// Same as above, for a single object.
+	bool update(const context& i_context, OBJ_Node& i_object);
+
+	/// Returns the unique IDs of the currently culled objects
+	const std::unordered_set<int>& culled()const { return m_culled; }
+
+private:
+
+	/// Returns true if an object is entirely outside of the culling frustum
+	bool outside(const context& i_context, OBJ_Node& i_object)const;
+
+	/// Margin around the crop window, negative when culling is disabled
+	double m_margin{-1.0};
+	/// Crop window, top-left and bottom-right corners
+	float m_crop[4]{0.0f, 0.0f, 1.0f, 1.0f};
+
+	/// Objects that must be exported, even outside of the crop region
+	OP_BundlePattern* m_keep_pattern{nullptr};
+	std::string m_rop_path;
+
+	/// Unique IDs of the geometry objects that are subject to culling
+	std::unordered_set<int> m_candidates;
+	/// Unique IDs of the objects that are currently not exported
+	std::unordered_set<int> m_culled;
+	/// Unique IDs of the objects that must never be culled
+	std::unordered_set<int> m_exempt;
+};
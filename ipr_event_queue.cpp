@@ -0,0 +1,595 @@
+#include "ipr_event_queue.h"
+
+#include "context.h"
+#include "ipr_frame_cache.h"
+#include "ipr_latency.h"
+#include "ROP_3Delight.h"
+
+#include <HOM/HOM_Module.h>
+#include <OBJ/OBJ_Node.h>
+#include <UT/UT_TempFileManager.h>
+
+#include <nsi.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+struct ipr_event_queue::exported_state
+{
+	std::unordered_map<std::string, std::vector<primitive_signature>>
+		m_geometry_signatures;
+	std::unordered_map<std::string, size_t> m_vop_fingerprints;
+	std::unordered_map<std::string, std::string> m_shader_aliases;
+	std::unordered_map<std::string, bool> m_exported_standins;
+};
+
+ipr_event_queue::ipr_event_queue(const context& i_context)
+	:	m_context(i_context)
+{
+	m_tick = std::chrono::milliseconds(std::max(
+		0, m_context.m_settings.get_ipr_event_tick(m_context.current_time())));
+}
+
+ipr_event_queue::~ipr_event_queue()
+{
+	assert(m_stopped);
+}
+
+/**
+	The thread keeps a reference on the queue, so it can safely outlive the
+	context. It's never joined because it might be waiting for Houdini's global
+	lock, which could be held by whoever is stopping the render. Instead, it
+	simply exits on the next tick after stop() has been called.
+*/
+void ipr_event_queue::start()
+{
+	ipr_latency::get_instance().start();
+
+	if(m_tick.count() == 0)
+	{
+		return;
+	}
+
+	std::thread(&tick_loop, shared_from_this()).detach();
+}
+
+void ipr_event_queue::stop()
+{
+	std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		m_stopped = true;
+		m_pending.clear();
+		m_time_pending = false;
+		m_pending_time_cb = time_cb();
+		m_pending_camera_cb = std::function<void()>();
+	}
+
+	m_pending_cv.notify_all();
+
+	if(m_nb_processed < m_nb_received)
+	{
+		std::cout
+			<< "3Delight for Houdini: IPR processed " << m_nb_processed
+			<< " of " << m_nb_received << " scene events, in "
+			<< m_nb_batches << " updates" << std::endl;
+	}
+
+	ipr_latency::get_instance().stop();
+}
+
+void* ipr_event_queue::subscribe(OP_EventMethod i_cb)
+{
+	for(subscription& s : m_subscriptions)
+	{
+		if(s.m_cb == i_cb)
+		{
+			return &s;
+		}
+	}
+
+	m_subscriptions.push_back(subscription{this, i_cb});
+	return &m_subscriptions.back();
+}
+
+void ipr_event_queue::event_cb(
+	OP_Node* i_caller,
+	void* i_callee,
+	OP_EventType i_type,
+	void* i_data)
+{
+	subscription* sub = (subscription*)i_callee;
+
+	/*
+		The node passed along with these events could be deleted before the
+		event is processed, so keep a way to check that it still exists.
+	*/
+	int data_id = -1;
+	if(i_type == OP_CHILD_SWITCHED || i_type == OP_CHILD_CREATED)
+	{
+		data_id = i_data ? ((OP_Node*)i_data)->getUniqueId() : -1;
+	}
+
+	sub->m_queue->push(
+		event{
+			i_caller, i_caller->getUniqueId(), sub->m_cb, i_type, i_data,
+			data_id});
+}
+
+void ipr_event_queue::push(const event& i_event)
+{
+	bool deletion =
+		i_event.m_type == OP_NODE_PREDELETE ||
+		i_event.m_type == OP_NODE_DELETED;
+
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		m_nb_received++;
+
+		if(ipr_latency::enabled())
+		{
+			ipr_latency::get_instance().edit(
+				ipr_latency::get_kind(*i_event.m_node));
+		}
+
+		if(i_event.m_node_id == m_recorded_node_id)
+		{
+			// The node's export in progress is already out of date
+			m_recording_superseded = true;
+		}
+
+		if(deletion)
+		{
+			// The node's pending events won't be processable anymore
+			m_pending.erase(
+				std::remove_if(
+					m_pending.begin(),
+					m_pending.end(),
+					[&i_event](const event& e)
+					{
+						return e.m_node_id == i_event.m_node_id;
+					}),
+				m_pending.end());
+		}
+		else if(m_tick.count() > 0)
+		{
+			if(std::find(m_pending.begin(), m_pending.end(), i_event) ==
+				m_pending.end())
+			{
+				m_pending.push_back(i_event);
+			}
+		}
+	}
+
+	if(!deletion && m_tick.count() > 0)
+	{
+		m_pending_cv.notify_all();
+		return;
+	}
+
+	std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+	if(!m_stopped)
+	{
+		end_batch(process(i_event) ? 1 : 0);
+
+		if(i_event.m_type == OP_NODE_PREDELETE)
+		{
+			m_context.forget_interests(i_event.m_node);
+		}
+	}
+}
+
+void ipr_event_queue::push_time_change(double i_time, const time_cb& i_cb)
+{
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		m_nb_received++;
+
+		ipr_latency::get_instance().edit(ipr_latency::e_time);
+
+		if(m_tick.count() > 0)
+		{
+			m_time_pending = true;
+			m_pending_time = i_time;
+			m_pending_time_cb = i_cb;
+		}
+	}
+
+	if(m_tick.count() > 0)
+	{
+		m_pending_cv.notify_all();
+		return;
+	}
+
+	std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+	while(!m_stopped && process_time_change(i_time, i_cb))
+	{
+	}
+}
+
+void ipr_event_queue::push_camera_change(const std::function<void()>& i_cb)
+{
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		m_nb_received++;
+
+		if(m_tick.count() > 0)
+		{
+			m_pending_camera_cb = i_cb;
+		}
+	}
+
+	if(m_tick.count() > 0)
+	{
+		m_pending_cv.notify_all();
+		return;
+	}
+
+	std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+	if(!m_stopped)
+	{
+		i_cb();
+		end_batch(1);
+	}
+}
+
+bool ipr_event_queue::cancelled()const
+{
+	std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+	return m_processing_time && m_time_pending;
+}
+
+/**
+	Houdini's global lock is taken for each event, rather than for the whole
+	batch, so the UI thread isn't blocked until all events are processed.
+
+	Each event's NSI calls are recorded into a stream while the lock is held,
+	then sent to the renderer after it's released (\ref begin_recording). If a
+	more recent event is received for the same node in between, the recording
+	is discarded and the event is queued again, so that the node is exported
+	once more with its latest state.
+*/
+void ipr_event_queue::flush()
+{
+	std::vector<event> events;
+	bool time_pending = false;
+	double time = 0.0;
+	time_cb cb;
+	std::function<void()> camera_cb;
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		/*
+			Events generated by the callbacks themselves will be processed in
+			the next batch.
+		*/
+		events.swap(m_pending);
+
+		std::swap(time_pending, m_time_pending);
+		time = m_pending_time;
+		cb.swap(m_pending_time_cb);
+		camera_cb.swap(m_pending_camera_cb);
+	}
+
+	bool more_stages = time_pending;
+	while(more_stages)
+	{
+		// The callbacks access Houdini nodes, from outside of the UI thread
+		HOM_AutoLock hom_lock;
+		std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+		if(m_stopped)
+		{
+			cb = time_cb();
+			return;
+		}
+
+		more_stages = process_time_change(time, cb);
+	}
+
+	if(camera_cb)
+	{
+		HOM_AutoLock hom_lock;
+		std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+		if(m_stopped)
+		{
+			return;
+		}
+
+		camera_cb();
+		end_batch(1);
+	}
+
+	unsigned nb_processed = 0;
+	for(const event& e : events)
+	{
+		/*
+			Houdini's lock is only needed to record the event's export. It's
+			released before the recording is applied, but the process lock is
+			kept until then, so deletion events can't be processed in between.
+		*/
+		std::unique_ptr<HOM_AutoLock> hom_lock(new HOM_AutoLock);
+		std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+		{
+			std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+			if(m_stopped)
+			{
+				return;
+			}
+
+			/*
+				The same event might have been received again while the lock
+				was released. Its processing below will use the latest state
+				anyway.
+			*/
+			m_pending.erase(
+				std::remove(m_pending.begin(), m_pending.end(), e),
+				m_pending.end());
+		}
+
+		exported_state state;
+		save_exported_state(state);
+
+		std::string stream = begin_recording();
+		bool processed = process(e);
+		end_recording();
+
+		/*
+			Events caused by the callback itself were queued normally above.
+			Only those received from now on make the recording out of date.
+		*/
+		{
+			std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+			m_recorded_node_id = e.m_node_id;
+			m_recording_superseded = false;
+		}
+
+		hom_lock.reset();
+
+		bool superseded = false;
+		{
+			std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+			superseded = m_recording_superseded;
+			m_recorded_node_id = -1;
+
+			if(superseded && !m_stopped &&
+				std::find(m_pending.begin(), m_pending.end(), e) ==
+					m_pending.end())
+			{
+				// Export it again, from the node's latest state
+				m_pending.push_back(e);
+			}
+		}
+
+		if(superseded)
+		{
+			restore_exported_state(state);
+			m_pending_cv.notify_all();
+		}
+		else if(processed && !m_stopped)
+		{
+			m_context.m_nsi.Evaluate(
+			(
+				NSI::CStringPArg("type", "apistream"),
+				NSI::StringArg("filename", stream)
+			) );
+			nb_processed++;
+		}
+
+		UT_TempFileManager::removeTempFile(stream.c_str());
+	}
+
+	HOM_AutoLock hom_lock;
+	std::lock_guard<std::recursive_mutex> process_lock(m_process_mutex);
+	if(!m_stopped)
+	{
+		end_batch(nb_processed);
+	}
+}
+
+bool ipr_event_queue::process(const event& i_event)
+{
+	/*
+		Deletion events are processed immediately, while the node still
+		exists. Others might refer to a node deleted since they were queued.
+	*/
+	OP_Node* caller = i_event.m_node;
+	if(i_event.m_type != OP_NODE_PREDELETE &&
+		i_event.m_type != OP_NODE_DELETED)
+	{
+		caller = OP_Node::lookupNode(i_event.m_node_id);
+		if(!caller)
+		{
+			return false;
+		}
+	}
+
+	void* data = i_event.m_data;
+	if(i_event.m_data_id >= 0)
+	{
+		OP_Node* node = OP_Node::lookupNode(i_event.m_data_id);
+		if(!node)
+		{
+			return false;
+		}
+
+		data = node;
+	}
+
+	// The event might have changed the object's display flag or bundles
+	OBJ_Node* obj = caller->castToOBJNode();
+	if(obj &&
+		i_event.m_type != OP_NODE_PREDELETE &&
+		i_event.m_type != OP_NODE_DELETED)
+	{
+		m_context.update_visibility(*obj);
+	}
+
+	i_event.m_cb(caller, (void*)&m_context, i_event.m_type, data);
+
+	return true;
+}
+
+/**
+	The stream is recorded through the context's own NSI::Context, whose handle
+	is temporarily replaced, so the callbacks don't have to know about it.
+	Houdini's lock must be held, so the UI thread doesn't use the context
+	meanwhile.
+*/
+std::string ipr_event_queue::begin_recording()
+{
+	std::string file =
+		UT_TempFileManager::getTempFilename().toStdString() + ".nsi";
+	UT_TempFileManager::addTempFile(file.c_str());
+
+	m_rendering_handle = m_context.m_nsi.Handle();
+	m_context.m_nsi.Begin(
+	(
+		NSI::StringArg("streamfilename", file),
+		NSI::CStringPArg("streamformat", "binarynsi")
+	) );
+
+	if(m_context.m_static_nsi.Handle() == m_rendering_handle)
+	{
+		m_context.m_static_nsi.SetHandle(m_context.m_nsi.Handle());
+	}
+
+	return file;
+}
+
+void ipr_event_queue::end_recording()
+{
+	if(m_context.m_static_nsi.Handle() == m_context.m_nsi.Handle())
+	{
+		m_context.m_static_nsi.SetHandle(m_rendering_handle);
+	}
+
+	m_context.m_nsi.End();
+	m_context.m_nsi.SetHandle(m_rendering_handle);
+	m_rendering_handle = NSI_BAD_CONTEXT;
+}
+
+void ipr_event_queue::save_exported_state(exported_state& o_state)const
+{
+	o_state.m_geometry_signatures = m_context.m_geometry_signatures;
+	o_state.m_vop_fingerprints = m_context.m_vop_fingerprints;
+	o_state.m_shader_aliases = m_context.m_shader_aliases;
+	o_state.m_exported_standins = m_context.m_exported_standins;
+}
+
+void ipr_event_queue::restore_exported_state(exported_state& io_state)const
+{
+	m_context.m_geometry_signatures.swap(io_state.m_geometry_signatures);
+	m_context.m_vop_fingerprints.swap(io_state.m_vop_fingerprints);
+	m_context.m_shader_aliases.swap(io_state.m_shader_aliases);
+	m_context.m_exported_standins.swap(io_state.m_exported_standins);
+}
+
+void ipr_event_queue::end_batch(unsigned i_nb_events)
+{
+	if(i_nb_events == 0)
+	{
+		return;
+	}
+
+	m_nb_processed += i_nb_events;
+	m_nb_batches++;
+
+	if(m_context.m_synchronize_requested)
+	{
+		m_context.m_synchronize_requested = false;
+
+		// Frames recorded before this change can't be replayed anymore
+		if(m_context.m_frame_cache)
+		{
+			m_context.m_frame_cache->clear();
+		}
+
+		// Keep the number of interests up to date in the render notes
+		m_context.m_rop->export_render_notes(m_context);
+
+		ipr_latency::get_instance().synchronizing();
+		m_context.m_nsi.RenderControl(
+			NSI::CStringPArg("action", "synchronize"));
+		ipr_latency::get_instance().synchronized();
+	}
+}
+
+bool ipr_event_queue::process_time_change(double i_time, const time_cb& i_cb)
+{
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		m_processing_time = true;
+	}
+
+	bool more_stages = i_cb(i_time);
+	if(more_stages)
+	{
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+		m_processing_time = false;
+	}
+
+	m_nb_processed++;
+	m_nb_batches++;
+
+	return false;
+}
+
+void ipr_event_queue::tick_loop(std::shared_ptr<ipr_event_queue> i_queue)
+{
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> pending_lock(i_queue->m_pending_mutex);
+			i_queue->m_pending_cv.wait(
+				pending_lock,
+				[&i_queue]()
+				{
+					return
+						i_queue->m_stopped ||
+						!i_queue->m_pending.empty() ||
+						i_queue->m_time_pending ||
+						i_queue->m_pending_camera_cb;
+				});
+
+			if(i_queue->m_stopped)
+			{
+				return;
+			}
+		}
+
+		// Give the following events a chance to be coalesced with this one
+		std::this_thread::sleep_for(i_queue->m_tick);
+
+		i_queue->flush();
+	}
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <OP/OP_Value.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nsi.h>
+
+class context;
+class OP_Node;
+
+/**
+	\brief Coalesces the node events received during an IPR render.
+
+	Dragging a slider or a handle in Houdini generates dozens of events per
+	second, often many for the same node and parameter. Processing each of them
+	as soon as it's received would re-export the same nodes over and over and
+	restart the render each time.
+
+	Instead, the interests registered by the context call the exporters'
+	callbacks through this queue. Events are accumulated, ignoring duplicates
+	(same node, callback, event type and data), then processed together after
+	a short interval, from a separate thread that holds Houdini's global lock.
+	A single "synchronize" is sent to the renderer after each batch, if any of
+	the callbacks requested it (\ref context::request_synchronize).
+
+	Deletion events are processed immediately since the node won't be valid
+	when the next batch is processed.
+
+	Processing happens in a dedicated worker thread, which sleeps until an
+	event is received, then waits for the coalescing interval before
+	processing the batch. The exporters access Houdini nodes, so each event is
+	processed while holding Houdini's global lock, which blocks the UI thread
+	meanwhile. Only the cooking and the recording of the NSI calls into a
+	stream file happen under the lock, though : the renderer reads the stream
+	once it's released. The lock is also released between events, so the UI
+	can still respond during long batches. An event received again before its
+	turn in the current batch is processed only once, with the latest state,
+	and one received while its node's export is being sent to the renderer
+	cancels it and gets the node exported again.
+
+	Time changes are queued the same way, except that only the latest one is
+	kept : when scrubbing the timeline, there is no point in exporting frames
+	that have already been left. They're exported in stages, releasing the lock
+	in between, and a time change received meanwhile cancels the one in
+	progress. Time changes are processed before node events, which are then
+	exported at the new time. Changes of the viewport camera, which aren't
+	node events, are coalesced into a single one as well.
+
+	The interval is controlled by the ROP's "IPR Update Interval" parameter,
+	in milliseconds. Setting it to 0 processes events immediately,
+	from the UI thread.
+*/
+class ipr_event_queue : public std::enable_shared_from_this<ipr_event_queue>
+{
+public:
+
+	/// Constructor. start() must be called before events can be received.
+	ipr_event_queue(const context& i_context);
+	~ipr_event_queue();
+
+	/// Starts the worker thread that processes the events
+	void start();
+
+	/**
+		\brief Stops processing events.
+
+		This waits for the event being processed, if any, to finish. Pending
+		events, including the rest of the current batch, are discarded. Coalescing statistics are reported.
+	*/
+	void stop();
+
+	/**
+		\brief Returns the callee to use when registering an interest with
+		event_cb, so that i_cb gets called with the context as its callee.
+
+		The same callee is always returned for a given callback, so it also
+		identifies the callback.
+	*/
+	void* subscribe(OP_EventMethod i_cb);
+
+	/**
+		\brief Callback that exports the scene at a new time, one stage per
+		call. It returns true while stages remain to be exported.
+	*/
+	typedef std::function<bool(double)> time_cb;
+
+	/**
+		\brief Queues a change of the current time.
+
+		i_cb will be called with i_time, unless another time change is queued
+		before it's processed. It's then called again until it returns false.
+		Houdini's lock is released between the calls, so a more recent time
+		change can be received meanwhile (\ref cancelled). The callback should
+		then stop early, by returning false.
+	*/
+	void push_time_change(double i_time, const time_cb& i_cb);
+
+	/**
+		\brief Queues a change of the viewport camera.
+
+		i_cb will be called once for all the changes queued before it's
+		processed, after the pending time change and before node events.
+	*/
+	void push_camera_change(const std::function<void()>& i_cb);
+
+	/**
+		\brief Returns true if the time change being processed has been
+		superseded by another one.
+	*/
+	bool cancelled()const;
+
+	/// Interest callback that queues the event for the subscribed callback
+	static void event_cb(
+		OP_Node* i_caller,
+		void* i_callee,
+		OP_EventType i_type,
+		void* i_data);
+
+private:
+
+	/// A callback subscribed to the queue
+	struct subscription
+	{
+		ipr_event_queue* m_queue;
+		OP_EventMethod m_cb;
+	};
+
+	/// A pending event
+	struct event
+	{
+		bool operator==(const event& i_other)const
+		{
+			return
+				m_node_id == i_other.m_node_id && m_cb == i_other.m_cb &&
+				m_type == i_other.m_type && m_data == i_other.m_data &&
+				m_data_id == i_other.m_data_id;
+		}
+
+		/*
+			Houdini's lock is released between events, so the node could be
+			deleted before its event is processed. It's looked up again from
+			its unique ID then, and the pointer is only used when the event is
+			received or for deletion events, which are processed right away.
+		*/
+		OP_Node* m_node;
+		int m_node_id;
+		OP_EventMethod m_cb;
+		OP_EventType m_type;
+		void* m_data;
+		/// Unique ID of the node passed as m_data, -1 if it's not a node
+		int m_data_id;
+	};
+
+	/// Adds an event to the queue, unless it's already there.
+	void push(const event& i_event);
+
+	/// Processes all pending events, from the worker thread
+	void flush();
+
+	/**
+		\brief Calls the callback of an event.
+
+		\returns false if the event couldn't be processed because the node it
+		refers to has been deleted since.
+	*/
+	bool process(const event& i_event);
+
+	/**
+		\brief What the context knows of the exported scene.
+
+		It's restored when an event's recorded export is discarded, so that it
+		isn't skipped when it's processed again.
+	*/
+	struct exported_state;
+
+	/**
+		\brief Redirects the context's NSI calls into a new stream file.
+
+		\returns The name of the temporary file.
+	*/
+	std::string begin_recording();
+	/// Ends the stream started by begin_recording.
+	void end_recording();
+
+	void save_exported_state(exported_state& o_state)const;
+	void restore_exported_state(exported_state& io_state)const;
+
+	/// Synchronizes the render after a batch of events has been processed
+	void end_batch(unsigned i_nb_events);
+
+	/**
+		\brief Calls the callback of a time change, for one of its stages.
+
+		\returns true if stages remain.
+	*/
+	bool process_time_change(double i_time, const time_cb& i_cb);
+
+	/// Processing loop of the worker thread started by start()
+	static void tick_loop(std::shared_ptr<ipr_event_queue> i_queue);
+
+	const context& m_context;
+
+	/// Coalescing interval, 0 to process events immediately
+	std::chrono::milliseconds m_tick{40};
+
+	/// Callbacks subscribed to the queue (addresses must stay valid)
+	std::deque<subscription> m_subscriptions;
+
+	/// Pending events, in the order they were first received
+	std::vector<event> m_pending;
+	/// Latest time change, valid when m_time_pending is true
+	bool m_time_pending{false};
+	double m_pending_time{0.0};
+	time_cb m_pending_time_cb;
+	/// Callback of the latest camera change, empty if there is none
+	std::function<void()> m_pending_camera_cb;
+
+	/// Protects the pending events and changes, and the processing state
+	mutable std::mutex m_pending_mutex;
+	/// Wakes up the worker thread when events are pending or when stopping
+	std::condition_variable m_pending_cv;
+
+	/// True while a time change is being processed
+	bool m_processing_time{false};
+
+	/// Unique ID of the node whose export is being recorded, -1 if none
+	int m_recorded_node_id{-1};
+	/// Set when an event is received for m_recorded_node_id
+	bool m_recording_superseded{false};
+	/// Handle of the rendering context while a stream is recorded
+	NSIContext_t m_rendering_handle{NSI_BAD_CONTEXT};
+
+	/**
+		Held while an event is processed, so stop() can wait for it to finish.
+		It's recursive because callbacks can cause deletion events, which are
+		processed immediately.
+	*/
+	std::recursive_mutex m_process_mutex;
+
+	/// Set by stop(), after which events are ignored
+	bool m_stopped{false};
+
+	/// Coalescing statistics
+	unsigned m_nb_received{0};
+	unsigned m_nb_processed{0};
+	unsigned m_nb_batches{0};
+};
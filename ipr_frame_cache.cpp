@@ -0,0 +1,139 @@
+#include "ipr_frame_cache.h"
+
+#include <UT/UT_TempFileManager.h>
+
+#include <nsi.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+
+ipr_frame_cache::ipr_frame_cache(int i_max_frames)
+	:	m_max_frames(std::max(0, i_max_frames))
+{
+}
+
+ipr_frame_cache::~ipr_frame_cache()
+{
+	clear();
+	discard();
+}
+
+bool ipr_frame_cache::replay(double i_time, const context& i_context)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto f = std::find_if(
+		m_frames.begin(),
+		m_frames.end(),
+		[i_time](const frame& i_frame) { return i_frame.m_time == i_time; });
+	if(f == m_frames.end())
+	{
+		return false;
+	}
+
+	// Move the frame at the end of the list, since it's now the most recent
+	frame replayed = std::move(*f);
+	m_frames.erase(f);
+	m_frames.push_back(std::move(replayed));
+
+	const frame& last = m_frames.back();
+	for(const std::string& file : last.m_files)
+	{
+		i_context.m_nsi.Evaluate(
+		(
+			NSI::CStringPArg("type", "apistream"),
+			NSI::StringArg("filename", file)
+		) );
+	}
+
+	for(const auto& s : last.m_signatures)
+	{
+		i_context.m_geometry_signatures[s.first] = s.second;
+	}
+
+	return true;
+}
+
+void ipr_frame_cache::begin_stage(NSI::Context& io_stream)
+{
+	std::string file =
+		UT_TempFileManager::getTempFilename().toStdString() + ".nsi";
+	UT_TempFileManager::addTempFile(file.c_str());
+
+	io_stream.Begin(
+	(
+		NSI::StringArg("streamfilename", file),
+		NSI::CStringPArg("streamformat", "binarynsi")
+	) );
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_recording.push_back(file);
+}
+
+void ipr_frame_cache::end_stage(NSI::Context& io_stream, NSI::Context& i_nsi)
+{
+	io_stream.End();
+
+	std::string file;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(!m_recording.empty());
+		file = m_recording.back();
+	}
+
+	i_nsi.Evaluate(
+	(
+		NSI::CStringPArg("type", "apistream"),
+		NSI::StringArg("filename", file)
+	) );
+}
+
+void ipr_frame_cache::commit(double i_time, const signatures& i_signatures)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto f = std::find_if(
+		m_frames.begin(),
+		m_frames.end(),
+		[i_time](const frame& i_frame) { return i_frame.m_time == i_time; });
+	if(f != m_frames.end())
+	{
+		remove_files(f->m_files);
+		m_frames.erase(f);
+	}
+
+	m_frames.push_back(frame{i_time, std::move(m_recording), i_signatures});
+	m_recording.clear();
+
+	while(m_frames.size() > m_max_frames)
+	{
+		remove_files(m_frames.front().m_files);
+		m_frames.pop_front();
+	}
+}
+
+void ipr_frame_cache::discard()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	remove_files(m_recording);
+	m_recording.clear();
+}
+
+void ipr_frame_cache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(const frame& f : m_frames)
+	{
+		remove_files(f.m_files);
+	}
+	m_frames.clear();
+}
+
+void ipr_frame_cache::remove_files(const std::vector<std::string>& i_files)
+{
+	for(const std::string& file : i_files)
+	{
+		UT_TempFileManager::removeTempFile(file.c_str());
+	}
+}
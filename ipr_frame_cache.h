@@ -0,0 +1,111 @@
+#pragma once
+
+#include "context.h"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+	\brief Keeps the NSI updates exported for recently visited frames during
+	an IPR render, so they can be sent again to the renderer without
+	re-cooking the scene.
+
+	After a time change, the time-dependent parts of the scene are exported
+	into NSI stream files (one per export stage) instead of being sent directly
+	to the renderer, which then reads them. When returning to the same frame
+	later, those files are simply read again.
+
+	Recorded frames are only valid as long as nothing else changes in the
+	scene, so the whole cache has to be cleared on each IPR update.
+
+	The number of recorded frames is controlled by the ROP's "IPR Cached Frames"
+	parameter. Setting it to 0 disables the cache.
+*/
+class ipr_frame_cache
+{
+public:
+
+	typedef std::unordered_map<std::string, std::vector<primitive_signature>>
+		signatures;
+
+	/// Constructor. Keeps at most i_max_frames recorded frames.
+	ipr_frame_cache(int i_max_frames);
+	/// Destructor. Removes all recorded files.
+	~ipr_frame_cache();
+
+	/// Returns false if recording has been disabled
+	bool enabled()const { return m_max_frames > 0; }
+
+	/**
+		\brief Sends the updates recorded for a frame to the renderer.
+
+		\param i_time
+			Time of the frame to replay.
+		\param i_context
+			The IPR rendering context, whose geometry signatures are updated
+			to those of the replayed frame.
+		\returns
+			False if nothing has been recorded for i_time.
+	*/
+	bool replay(double i_time, const context& i_context);
+
+	/**
+		\brief Starts recording an export stage.
+
+		\param io_stream
+			Context to Begin on a new stream file. It should be the NSI context
+			of the recording context (\ref context::context).
+	*/
+	void begin_stage(NSI::Context& io_stream);
+
+	/**
+		\brief Ends the recording of an export stage and sends it to the
+		renderer.
+
+		\param io_stream
+			Context previously passed to begin_stage. It will be ended.
+		\param i_nsi
+			Rendering context that reads the recorded stream.
+	*/
+	void end_stage(NSI::Context& io_stream, NSI::Context& i_nsi);
+
+	/**
+		\brief Keeps the stages recorded since the last call to commit or
+		discard, as the updates of frame i_time.
+
+		\param i_signatures
+			Geometry signatures of the recorded primitives, to be restored when
+			the frame is replayed.
+	*/
+	void commit(double i_time, const signatures& i_signatures);
+
+	/// Removes the stages recorded since the last call to commit or discard.
+	void discard();
+
+	/// Removes all recorded frames
+	void clear();
+
+private:
+
+	/// The recorded updates of a frame
+	struct frame
+	{
+		double m_time;
+		std::vector<std::string> m_files;
+		signatures m_signatures;
+	};
+
+	/// Removes temporary files
+	static void remove_files(const std::vector<std::string>& i_files);
+
+	/// Recorded frames, least recently used first
+	std::deque<frame> m_frames;
+	/// Files of the stages being recorded
+	std::vector<std::string> m_recording;
+	std::mutex m_mutex;
+
+	/// Maximum number of recorded frames
+	unsigned m_max_frames;
+};
@@ -0,0 +1,368 @@
+#include "ipr_latency.h"
+
+#include "dl_system.h"
+
+#include <OBJ/OBJ_Node.h>
+#include <OP/OP_Node.h>
+#include <OP/OP_Operator.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	/// Number of measurements kept for each kind of change and stage
+	const size_t k_nb_samples = 256;
+
+	/// Number of synchronized updates between logs
+	const unsigned k_log_interval = 32;
+
+	/// Upper bounds of the histograms' bins, in milliseconds
+	const float k_bins[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+	const unsigned k_nb_bins = sizeof(k_bins) / sizeof(k_bins[0]);
+
+	const char* k_kind_names[] =
+	{
+		"camera", "light", "material", "geometry", "time", "other"
+	};
+
+	const char* k_stage_names[] =
+	{
+		"exported", "synchronized", "first pixel"
+	};
+
+	/// Keeps the earliest of two edits of the same kind
+	void merge(
+		const std::chrono::steady_clock::time_point& i_edit,
+		bool& io_valid,
+		std::chrono::steady_clock::time_point& io_edit)
+	{
+		if(!io_valid || i_edit < io_edit)
+		{
+			io_edit = i_edit;
+		}
+		io_valid = true;
+	}
+}
+
+ipr_latency& ipr_latency::get_instance()
+{
+	/* Our only instance */
+	static ipr_latency s_latency;
+	return s_latency;
+}
+
+bool ipr_latency::enabled()
+{
+	static const bool s_enabled =
+		dl_system::get_env("_3DELIGHT_IPR_LATENCY") != nullptr;
+	return s_enabled;
+}
+
+/**
+	Lights are tested before cameras, since an OBJ_Light is also an
+	OBJ_Camera. SOPs are part of their object's geometry.
+*/
+ipr_latency::change_kind ipr_latency::get_kind(OP_Node& i_node)
+{
+	if(i_node.castToVOPNode())
+	{
+		return e_material;
+	}
+
+	if(i_node.castToSOPNode())
+	{
+		return e_geometry;
+	}
+
+	OBJ_Node* obj = i_node.castToOBJNode();
+	if(!obj)
+	{
+		return e_other;
+	}
+
+	if(obj->castToOBJLight() ||
+		obj->getOperator()->getName() == "3Delight::IncandescenceLight")
+	{
+		return e_light;
+	}
+
+	if(obj->castToOBJCamera())
+	{
+		return e_camera;
+	}
+
+	if(obj->castToOBJGeometry())
+	{
+		return e_geometry;
+	}
+
+	return e_other;
+}
+
+void ipr_latency::start()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(int k = 0; k < e_nb_kinds; k++)
+	{
+		m_pending[k] = edit_times();
+		m_exporting[k] = edit_times();
+		m_rendering[k] = edit_times();
+		for(int s = 0; s < e_nb_stages; s++)
+		{
+			m_samples[k][s] = samples();
+		}
+	}
+	m_viewport_exporting = edit_times();
+	m_waiting_for_pixels = false;
+	m_nb_updates = 0;
+}
+
+void ipr_latency::stop()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	log();
+}
+
+void ipr_latency::edit(change_kind i_kind)
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	merge(now, m_pending[i_kind].m_valid, m_pending[i_kind].m_edit);
+}
+
+void ipr_latency::synchronizing()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(int k = 0; k < e_nb_kinds; k++)
+	{
+		edit_times& pending = m_pending[k];
+		if(!pending.m_valid)
+		{
+			continue;
+		}
+
+		add_sample(change_kind(k), e_exported, pending.m_edit, now);
+
+		merge(pending.m_edit, m_exporting[k].m_valid, m_exporting[k].m_edit);
+		m_exporting[k].m_exported = now;
+		pending = edit_times();
+	}
+}
+
+void ipr_latency::synchronized()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	bool updated = false;
+	for(int k = 0; k < e_nb_kinds; k++)
+	{
+		edit_times& exporting = m_exporting[k];
+		if(!exporting.m_valid)
+		{
+			continue;
+		}
+
+		updated = true;
+		add_sample(change_kind(k), e_synchronized, exporting.m_edit, now);
+
+		/*
+			Without a viewport, older edits could remain here indefinitely,
+			but they're never measured since no bucket is received.
+		*/
+		merge(exporting.m_edit, m_rendering[k].m_valid, m_rendering[k].m_edit);
+		exporting = edit_times();
+	}
+
+	if(!updated)
+	{
+		return;
+	}
+
+	m_waiting_for_pixels = true;
+	count_update();
+}
+
+void ipr_latency::viewport_synchronizing()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// The change is exported as soon as the redraw detects it
+	add_sample(e_camera, e_exported, now, now);
+	merge(now, m_viewport_exporting.m_valid, m_viewport_exporting.m_edit);
+	m_viewport_exporting.m_exported = now;
+}
+
+void ipr_latency::viewport_synchronized()
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_viewport_exporting.m_valid)
+	{
+		return;
+	}
+
+	add_sample(e_camera, e_synchronized, m_viewport_exporting.m_edit, now);
+	merge(
+		m_viewport_exporting.m_edit,
+		m_rendering[e_camera].m_valid,
+		m_rendering[e_camera].m_edit);
+	m_viewport_exporting = edit_times();
+
+	m_waiting_for_pixels = true;
+	count_update();
+}
+
+void ipr_latency::bucket_received()
+{
+	// Called for every bucket, so keep the common case lock-free
+	if(!m_waiting_for_pixels)
+	{
+		return;
+	}
+
+	clock::time_point now = clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(int k = 0; k < e_nb_kinds; k++)
+	{
+		if(m_rendering[k].m_valid)
+		{
+			add_sample(
+				change_kind(k), e_first_pixel, m_rendering[k].m_edit, now);
+			m_rendering[k] = edit_times();
+		}
+	}
+	m_waiting_for_pixels = false;
+}
+
+void ipr_latency::add_sample(
+	change_kind i_kind,
+	stage i_stage,
+	clock::time_point i_edit,
+	clock::time_point i_now)
+{
+	float ms =
+		std::chrono::duration<float, std::milli>(i_now - i_edit).count();
+
+	samples& s = m_samples[i_kind][i_stage];
+	if(s.m_values.size() < k_nb_samples)
+	{
+		s.m_values.push_back(ms);
+	}
+	else
+	{
+		s.m_values[s.m_next] = ms;
+	}
+	s.m_next = (s.m_next + 1) % k_nb_samples;
+	s.m_total++;
+}
+
+void ipr_latency::count_update()
+{
+	m_nb_updates++;
+	if(m_nb_updates % k_log_interval == 0)
+	{
+		log();
+	}
+}
+
+/**
+	Each line shows the median and 90th percentile of a stage's latest
+	measurements, followed by their distribution in bins of increasing size.
+*/
+void ipr_latency::log()const
+{
+	std::ostringstream out;
+
+	for(int k = 0; k < e_nb_kinds; k++)
+	{
+		if(m_samples[k][e_exported].m_values.empty())
+		{
+			continue;
+		}
+
+		out << "3Delight for Houdini: IPR latency of " << k_kind_names[k]
+			<< " changes (" << m_samples[k][e_exported].m_total
+			<< " updates)\n";
+
+		for(int s = 0; s < e_nb_stages; s++)
+		{
+			std::vector<float> values = m_samples[k][s].m_values;
+			if(values.empty())
+			{
+				continue;
+			}
+
+			std::sort(values.begin(), values.end());
+
+			unsigned histogram[k_nb_bins+1] = { 0 };
+			for(float v : values)
+			{
+				unsigned b = 0;
+				while(b < k_nb_bins && v >= k_bins[b])
+				{
+					b++;
+				}
+				histogram[b]++;
+			}
+
+			out << "  " << k_stage_names[s]
+				<< ": median " << unsigned(values[values.size()/2])
+				<< " ms, 90% " << unsigned(values[values.size()*9/10])
+				<< " ms [";
+			for(unsigned b = 0; b < k_nb_bins; b++)
+			{
+				out << "<" << k_bins[b] << ":" << histogram[b] << " ";
+			}
+			out << ">=" << k_bins[k_nb_bins-1] << ":" << histogram[k_nb_bins]
+				<< "]\n";
+		}
+	}
+
+	std::cout << out.str() << std::flush;
+}
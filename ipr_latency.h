@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class OP_Node;
+
+/**
+	\brief Measures the time from IPR edits to the updated render.
+
+	Each edit is timestamped when its node callback fires. The edits of a
+	batch are then followed through the end of their export (right before the
+	"synchronize" render control), the return of the "synchronize" and, for
+	viewport renders, the first bucket received by the viewport hook
+	afterwards. Renders displayed in 3Delight Display send their buckets
+	directly to it, so their latency ends at the "synchronize". Viewport
+	navigation is measured from the redraw that detects the camera change. It's
+	exported from the UI thread, so it's tracked separately from the edits
+	exported by the IPR event queue.
+
+	When several edits are exported together, the earliest one of each kind
+	is measured. The latest measurements of each kind of change are kept and
+	logged as histograms every few updates and when IPR stops.
+
+	Measurements are enabled by setting _3DELIGHT_IPR_LATENCY.
+*/
+class ipr_latency
+{
+public:
+
+	/// What was edited, based on the edited node
+	enum change_kind
+	{
+		e_camera,
+		e_light,
+		e_material,
+		e_geometry,
+		e_time,
+		e_other,
+		e_nb_kinds
+	};
+
+	static ipr_latency& get_instance();
+
+	/// Returns true if measurements were requested through the environment
+	static bool enabled();
+
+	/// Returns the kind of change made by editing a node
+	static change_kind get_kind(OP_Node& i_node);
+
+	/// Discards pending edits, at the start of an IPR render
+	void start();
+
+	/// Logs the measurements, at the end of an IPR render
+	void stop();
+
+	/// Timestamps an edit, when its callback fires
+	void edit(change_kind i_kind);
+
+	/// Marks the end of the pending edits' export, before a "synchronize"
+	void synchronizing();
+
+	/// Marks the return of the "synchronize" that follows synchronizing()
+	void synchronized();
+
+	/**
+		\brief Timestamps a viewport camera change, exported by the viewport
+		hook right before a "synchronize".
+
+		This doesn't affect the edits still pending in the IPR event queue.
+	*/
+	void viewport_synchronizing();
+
+	/// Marks the return of the "synchronize" that follows viewport_synchronizing()
+	void viewport_synchronized();
+
+	/// Marks the reception of a bucket by the viewport
+	void bucket_received();
+
+private:
+
+	typedef std::chrono::steady_clock clock;
+
+	/// Stages at which latency is measured
+	enum stage
+	{
+		e_exported,
+		e_synchronized,
+		e_first_pixel,
+		e_nb_stages
+	};
+
+	/// Timestamps of the earliest edit of a kind, still in progress
+	struct edit_times
+	{
+		bool m_valid{false};
+		clock::time_point m_edit;
+		clock::time_point m_exported;
+	};
+
+	/// Latest measurements of a stage, in milliseconds
+	struct samples
+	{
+		std::vector<float> m_values;
+		size_t m_next{0};
+		unsigned m_total{0};
+	};
+
+	ipr_latency() = default;
+
+	/// Records the latency of an edit at some stage
+	void add_sample(
+		change_kind i_kind,
+		stage i_stage,
+		clock::time_point i_edit,
+		clock::time_point i_now);
+
+	/**
+		\brief Counts a synchronized update and logs the measurements every
+		few of them. m_mutex must be locked.
+	*/
+	void count_update();
+
+	/// Logs the histograms of all measurements. m_mutex must be locked.
+	void log()const;
+
+	/// Edits not exported yet
+	edit_times m_pending[e_nb_kinds];
+	/// Edits exported but not synchronized yet
+	edit_times m_exporting[e_nb_kinds];
+	/// Edits synchronized, waiting for the first viewport bucket
+	edit_times m_rendering[e_nb_kinds];
+	/// Viewport camera change exported but not synchronized yet
+	edit_times m_viewport_exporting;
+	/// Set when m_rendering has valid entries, checked for each bucket
+	std::atomic<bool> m_waiting_for_pixels{false};
+
+	samples m_samples[e_nb_kinds][e_nb_stages];
+	/// Number of synchronized updates, to log every few of them
+	unsigned m_nb_updates{0};
+
+	mutable std::mutex m_mutex;
+};
@@ -0,0 +1,35 @@
+#include "json_utilities.h"
+
+#include <stdio.h>
+
+void json_utilities::write_string(
+	std::ostream& io_stream,
+	const std::string& i_string)
+{
+	io_stream << '"';
+	for(char c : i_string)
+	{
+		switch(c)
+		{
+			case '"': io_stream << "\\\""; break;
+			case '\\': io_stream << "\\\\"; break;
+			case '\n': io_stream << "\\n"; break;
+			case '\r': io_stream << "\\r"; break;
+			case '\t': io_stream << "\\t"; break;
+			case '\b': io_stream << "\\b"; break;
+			case '\f': io_stream << "\\f"; break;
+			default:
+				if((unsigned char)c < 0x20)
+				{
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+					io_stream << escaped;
+				}
+				else
+				{
+					io_stream << c;
+				}
+		}
+	}
+	io_stream << '"';
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+/**
+	Helpers for the JSON reports written by export_trace and export_memory.
+*/
+namespace json_utilities
+{
+	/**
+		\brief Writes a string as a JSON string literal.
+
+		Quotes, backslashes and control characters are escaped.
+	*/
+	void write_string(std::ostream& io_stream, const std::string& i_string);
+}
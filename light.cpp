@@ -463,7 +463,7 @@ void light::changed_cb(
 		}
 	}
 
-	ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+	ctx->request_synchronize();
 }
 
 void light::disconnect()const
@@ -0,0 +1,125 @@
+#include "light_linking_index.h"
+
+#include "context.h"
+#include "scene.h"
+#include "ROP_3Delight.h"
+
+#include <OBJ/OBJ_Node.h>
+#include <UT/UT_String.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+	/**
+		\brief Returns a light's categories in a canonical form, so that
+		lights with the same categories in a different order are grouped
+		together.
+	*/
+	std::string canonical_tags(const UT_String& i_tags)
+	{
+		std::string tags = i_tags.toStdString();
+		std::replace(tags.begin(), tags.end(), ',', ' ');
+
+		std::vector<std::string> names;
+		std::istringstream stream(tags);
+		std::string name;
+		while(stream >> name)
+		{
+			names.push_back(name);
+		}
+
+		std::sort(names.begin(), names.end());
+		names.erase(std::unique(names.begin(), names.end()), names.end());
+
+		std::string canonical;
+		for(const std::string& n : names)
+		{
+			canonical += canonical.empty() ? n : " " + n;
+		}
+
+		return canonical;
+	}
+}
+
+light_linking_index::light_linking_index(const context& i_context)
+	:	m_context(i_context)
+{
+}
+
+light_linking_index::category& light_linking_index::find(
+	const std::string& i_expression)
+{
+	auto it = m_categories.find(i_expression);
+	if(it != m_categories.end())
+	{
+		return it->second;
+	}
+
+	category& result = m_categories[i_expression];
+
+	UT_String errors;
+	UT_TagExpressionPtr expression =
+		m_tag_manager.createExpression(i_expression.c_str(), errors);
+
+	result.m_tautology = expression->isTautology();
+	if(result.m_tautology)
+	{
+		// No need to look for lights, they're all on
+		return result;
+	}
+
+	find_lights();
+
+	for(const light_group& group : m_groups)
+	{
+		if(!group.m_tags->match(*expression))
+		{
+			result.m_lights_off.insert(
+				result.m_lights_off.end(),
+				group.m_lights.begin(),
+				group.m_lights.end());
+		}
+	}
+
+	return result;
+}
+
+void light_linking_index::find_lights()
+{
+	if(m_lights_found)
+	{
+		return;
+	}
+
+	m_lights_found = true;
+
+	std::vector<OBJ_Node*> lights;
+	scene::find_lights(
+		m_context.lights_to_render(),
+		m_context.rop()->getFullPath().c_str(),
+		false,
+		lights);
+
+	std::unordered_map<std::string, size_t> group_indices;
+	for(OBJ_Node* light_source : lights)
+	{
+		UT_String tags_string;
+		light_source->evalString(tags_string, "categories", 0, 0.0);
+
+		std::string tags = canonical_tags(tags_string);
+		auto group = group_indices.find(tags);
+		if(group == group_indices.end())
+		{
+			UT_String errors;
+			light_group new_group;
+			new_group.m_tags = m_tag_manager.createList(tags.c_str(), errors);
+
+			group = group_indices.emplace(tags, m_groups.size()).first;
+			m_groups.push_back(new_group);
+		}
+
+		m_groups[group->second].m_lights.push_back(light_source);
+	}
+}
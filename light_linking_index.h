@@ -0,0 +1,70 @@
+#pragma once
+
+#include <UT/UT_TagManager.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class context;
+class OBJ_Node;
+
+/**
+	\brief Resolves the lights that are turned off by "lightcategories"
+	expressions.
+
+	Objects' light categories expressions tend to be shared by many objects,
+	and lights often have identical categories. So, rather than testing each
+	object's expression against each light, the index finds the lights to
+	render once, groups them by categories (parsed once per group) and
+	compiles each distinct expression once, testing it only once per group.
+
+	An index is valid for a single export of the scene at a given time, since
+	lights and their categories might change afterwards.
+*/
+class light_linking_index
+{
+public:
+
+	/// The result of a light categories expression
+	struct category
+	{
+		/// True if the expression matches all possible lights
+		bool m_tautology{false};
+		/// Lights that don't match the expression, and must be turned off
+		std::vector<OBJ_Node*> m_lights_off;
+		/// True once the category's NSI set has been exported
+		bool m_exported{false};
+	};
+
+	light_linking_index(const context& i_context);
+
+	/**
+		\brief Returns the lights turned off by a light categories expression.
+
+		The returned category remains valid as long as the index.
+	*/
+	category& find(const std::string& i_expression);
+
+private:
+
+	/// Lights sharing the same categories
+	struct light_group
+	{
+		UT_TagListPtr m_tags;
+		std::vector<OBJ_Node*> m_lights;
+	};
+
+	/// Finds the lights to render and groups them, on first use
+	void find_lights();
+
+	const context& m_context;
+
+	UT_TagManager m_tag_manager;
+
+	bool m_lights_found{false};
+	std::vector<light_group> m_groups;
+
+	/// Light categories expressions already resolved
+	std::unordered_map<std::string, category> m_categories;
+};
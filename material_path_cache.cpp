@@ -0,0 +1,170 @@
+#include "material_path_cache.h"
+
+#include "exporter.h"
+#include "scene_node_index.h"
+
+#include <GA/GA_AIFSharedStringTuple.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_DetailHandle.h>
+#include <OBJ/OBJ_Node.h>
+#include <OP/OP_Context.h>
+#include <SOP/SOP_Node.h>
+#include <UT/UT_String.h>
+#include <VOP/VOP_Node.h>
+
+#include <vector>
+
+namespace
+{
+	/// Adds the VOPs referred to by a material path to a set
+	void resolve(
+		OBJ_Node& i_object,
+		const std::string& i_path,
+		std::unordered_set<std::string>& o_materials)
+	{
+		VOP_Node* vops[3] = { nullptr };
+		exporter::resolve_material_path(&i_object, i_path.c_str(), vops);
+
+		for(VOP_Node* vop : vops)
+		{
+			if(vop)
+			{
+				o_materials.insert(vop->getFullPath().toStdString());
+			}
+		}
+	}
+}
+
+material_path_cache& material_path_cache::get_instance()
+{
+	/* Our only instance */
+	static material_path_cache s_cache;
+	return s_cache;
+}
+
+void material_path_cache::get_materials(
+	double i_time,
+	std::unordered_set<std::string>& o_materials)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	/*
+		Instancers assign materials to their instances through their points'
+		attributes, and lights can have geometry and materials of their own.
+	*/
+	std::vector<OBJ_Node*> objects;
+	scene_node_index::get_instance().get_nodes(
+		scene_node_index::e_geometry |
+		scene_node_index::e_instancer |
+		scene_node_index::e_light |
+		scene_node_index::e_incandescence,
+		objects);
+
+	// Entries of deleted objects are dropped along the way
+	std::unordered_map<int, entry> entries;
+
+	for(OBJ_Node* object : objects)
+	{
+		int id = object->getUniqueId();
+
+		entry& object_entry = entries[id];
+		auto previous = m_entries.find(id);
+		if(previous != m_entries.end())
+		{
+			object_entry = std::move(previous->second);
+		}
+
+		update(*object, i_time, object_entry);
+
+		resolve(*object, object_entry.m_object_material, o_materials);
+		for(const std::string& path : object_entry.m_sop_materials)
+		{
+			resolve(*object, path, o_materials);
+		}
+	}
+
+	m_entries.swap(entries);
+}
+
+/**
+	Point attributes are included because they're used by instancer SOPs to
+	assign materials to their instances.
+
+	The string table might still contain a few strings that are no longer
+	referenced by any element, which only means that we might find a material
+	that's not actually needed.
+*/
+void material_path_cache::update(
+	OBJ_Node& i_object,
+	double i_time,
+	entry& io_entry)
+{
+	UT_String object_material;
+	if(i_object.hasParm("shop_materialpath"))
+	{
+		i_object.evalString(object_material, "shop_materialpath", 0, i_time);
+	}
+	io_entry.m_object_material = object_material.toStdString();
+
+	SOP_Node* sop = i_object.getRenderSopPtr();
+	if(!sop)
+	{
+		io_entry.m_sop_materials.clear();
+		io_entry.m_detail_id = -1;
+		return;
+	}
+
+	OP_Context op_ctx(i_time);
+	GU_DetailHandle detail_handle(sop->getCookedGeoHandle(op_ctx));
+	GU_DetailHandleAutoReadLock detail(detail_handle);
+	const GU_Detail* gdp = detail.getGdp();
+	if(!gdp)
+	{
+		io_entry.m_sop_materials.clear();
+		io_entry.m_detail_id = -1;
+		return;
+	}
+
+	if(gdp->getUniqueId() == io_entry.m_detail_id &&
+		gdp->getMetaCacheCount() == io_entry.m_detail_version)
+	{
+		return;
+	}
+
+	io_entry.m_sop_materials.clear();
+	io_entry.m_detail_id = gdp->getUniqueId();
+	io_entry.m_detail_version = gdp->getMetaCacheCount();
+
+	const GA_AttributeOwner owners[] =
+	{
+		GA_ATTRIB_POINT, GA_ATTRIB_PRIMITIVE, GA_ATTRIB_DETAIL
+	};
+
+	for(GA_AttributeOwner owner : owners)
+	{
+		const GA_Attribute* attribute =
+			gdp->findAttribute(owner, "shop_materialpath");
+		if(!attribute)
+		{
+			continue;
+		}
+
+		const GA_AIFSharedStringTuple* strings =
+			attribute->getAIFSharedStringTuple();
+		if(!strings)
+		{
+			continue;
+		}
+
+		for(GA_AIFSharedStringTuple::iterator it = strings->begin(attribute);
+			!it.atEnd();
+			++it)
+		{
+			const char* path = it.getString();
+			if(path && path[0])
+			{
+				io_entry.m_sop_materials.insert(path);
+			}
+		}
+	}
+}
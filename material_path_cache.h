@@ -0,0 +1,70 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class OBJ_Node;
+
+/**
+	\brief Finds the materials assigned to the scene's objects, without
+	exporting them.
+
+	Materials can be assigned at the OBJ level, with the "shop_materialpath"
+	parameter, or at the SOP level, with a "shop_materialpath" attribute. The
+	latter only requires the cooked detail of the render SOP : the attribute's
+	string table is read directly, without refining the geometry into
+	primitives.
+
+	The material paths found in each object's detail are kept from one query
+	to the next and only read again when the detail has been modified.
+	Material paths are resolved to VOP nodes on each query, which is cheap and
+	follows changes in the material networks.
+*/
+class material_path_cache
+{
+public:
+
+	static material_path_cache& get_instance();
+
+	/**
+		\brief Retrieves the materials assigned to all geometry, instancer
+		and light objects.
+
+		This includes objects that are hidden, which might only be visible
+		through an instancer.
+
+		\param i_time
+			Time at which SOPs are cooked and parameters evaluated.
+		\param o_materials
+			The full paths of the material VOPs, added to the set.
+	*/
+	void get_materials(
+		double i_time,
+		std::unordered_set<std::string>& o_materials);
+
+private:
+
+	/// Material paths of a single object, as they appear in the scene
+	struct entry
+	{
+		/// The OBJ-level material assignment
+		std::string m_object_material;
+		/// Material paths found in the render SOP's attributes
+		std::unordered_set<std::string> m_sop_materials;
+		/// Identifies the detail from which m_sop_materials was read
+		int m_detail_id{-1};
+		/// Version of that detail when it was read
+		long long m_detail_version{-1};
+	};
+
+	material_path_cache() = default;
+
+	/// Updates the material paths of an object, if they've changed
+	static void update(OBJ_Node& i_object, double i_time, entry& io_entry);
+
+	/// Entries of the objects found during the last query, by unique ID
+	std::unordered_map<int, entry> m_entries;
+	std::mutex m_mutex;
+};
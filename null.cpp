@@ -1,8 +1,12 @@
 #include "null.h"
 
 #include "context.h"
+#include "curvemesh.h"
+#include "ipr_crop_culling.h"
+#include "ROP_3Delight.h"
 #include "time_sampler.h"
 
+#include <OBJ/OBJ_Camera.h>
 #include <OBJ/OBJ_Node.h>
 #include <OP/OP_Director.h>
 #include <GT/GT_Handles.h>
@@ -158,7 +162,28 @@ void null::changed_cb(
 		ctx->m_nsi.DeleteAttribute(null_node.m_handle, "transformationmatrix");
 		null_node.set_attributes_at_time(ctx->m_current_time);
 
-		ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+		/*
+			Moving an object (or the camera) can bring it into the crop region,
+			or out of it.
+		*/
+		OBJ_Node* obj = i_caller->castToOBJNode();
+		bool is_camera = obj == ctx->rop()->GetCamera(ctx->current_time());
+		if(ipr_crop_culling* culling = ctx->crop_culling())
+		{
+			if(is_camera)
+			{
+				culling->update(*ctx);
+			}
+			else
+			{
+				culling->update(*ctx, *obj);
+			}
+		}
+
+		// It can also change the hair LOD of the object, or of all of them
+		curvemesh::update_lod(*ctx, is_camera ? nullptr : obj);
+
+		ctx->request_synchronize();
 	}
 	else if(i_type == OP_NODE_PREDELETE)
 	{
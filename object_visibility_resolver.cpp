@@ -5,8 +5,34 @@
 #include <OP/OP_Director.h>
 
 #include "object_visibility_resolver.h"
+#include "scene_node_index.h"
 #include "ui/settings.h"
 
+#include <vector>
+
+namespace
+{
+	/**
+		\brief Returns the bundle named by the first argument of a pattern.
+
+		OP_BundleList::getBundle() function needs bundle name as an argument
+		but without the first character @.
+	*/
+	OP_Bundle* pattern_bundle( OP_BundlePattern *i_pattern )
+	{
+		if( !i_pattern ||
+			i_pattern->isNullPattern() ||
+			i_pattern->argv(0)[0] != '@' )
+		{
+			return nullptr;
+		}
+
+		OP_BundleList* blist = OPgetDirector()->getBundles();
+		assert(blist);
+		return blist->getBundle( i_pattern->argv(0) + 1 );
+	}
+}
+
 object_visibility_resolver::object_visibility_resolver(
 	const std::string &i_rop_path, const settings &i_settings,
 	double i_time )
@@ -31,101 +57,111 @@ object_visibility_resolver::object_visibility_resolver(
 
 	m_phantom_pattern =
 		OP_BundlePattern::allocPattern(i_settings.get_phantom_objects(i_time));
+
+	/* Resolve the visibility of all objects */
+	std::vector<OBJ_Node *> objects;
+	scene_node_index::get_instance().get_nodes(
+		scene_node_index::e_all, objects );
+
+	for( OBJ_Node *obj : objects )
+	{
+		m_flags[obj->getUniqueId()] = resolve( *obj );
+	}
 }
 
 object_visibility_resolver::~object_visibility_resolver()
 {
-	if(m_lights_to_render_pattern  && m_objects_to_render_pattern )
-	{
-		OP_BundlePattern::freePattern(m_lights_to_render_pattern);
+	if( m_lights_to_render_pattern )
+		OP_BundlePattern::freePattern( m_lights_to_render_pattern );
+	if( m_objects_to_render_pattern )
 		OP_BundlePattern::freePattern( m_objects_to_render_pattern );
-	}
 	OP_BundlePattern::freePattern( m_phantom_pattern );
 	OP_BundlePattern::freePattern( m_mattes_pattern );
 }
 
 bool object_visibility_resolver::object_displayed(const OBJ_Node& i_node)const
 {
+	return flags( i_node ) & e_displayed;
+}
+
+bool object_visibility_resolver::object_is_matte(const OBJ_Node& i_node)const
+{
+	return flags( i_node ) & e_matte;
+}
+
+bool object_visibility_resolver::object_is_phantom(const OBJ_Node& i_node)const
+{
+	return flags( i_node ) & e_phantom;
+}
+
+void object_visibility_resolver::update( const OBJ_Node& i_node )
+{
+	m_flags[i_node.getUniqueId()] = resolve( i_node );
+}
+
+/**
+	Objects that didn't exist when the resolver was created, and haven't been
+	updated since, are resolved on the fly. They're not cached in order to keep
+	queries free of side effects, since exporters might run in parallel.
+*/
+unsigned object_visibility_resolver::flags( const OBJ_Node& i_node ) const
+{
+	auto it = m_flags.find( i_node.getUniqueId() );
+	return it != m_flags.end() ? it->second : resolve( i_node );
+}
+
+unsigned object_visibility_resolver::resolve( const OBJ_Node& i_node ) const
+{
+	unsigned flags = 0;
+
+	bool is_light = const_cast<OBJ_Node&>(i_node).castToOBJLight() != nullptr;
 	OP_BundlePattern* pattern =
-		const_cast<OBJ_Node&>(i_node).castToOBJLight()
-		? m_lights_to_render_pattern
-		: m_objects_to_render_pattern;
+		is_light ? m_lights_to_render_pattern : m_objects_to_render_pattern;
 
-	if(pattern)
+	if( pattern )
+	{
+		if( match(pattern, i_node) )
+			flags |= e_displayed;
+	}
+	else if( is_light )
 	{
 		/*
-			Patterns can also contains bundles, so we check for bundles,
-			and if any bundle is used as a pattern, we check the node
-			included on bundle patterns if they match with nodes on the
-			scene. OP_BundleList::getBundle() function needs bundle name
-			as an argument but without the first character @.
+			Check only the display channel (light_enable parameter)
+			for light sources and ignore the display flag.
 		*/
-		if (!pattern->isNullPattern() && pattern->argv(0)[0] == '@')
-		{
-			OP_BundleList* blist = OPgetDirector()->getBundles();
-			assert(blist);
-			const char* pattern_str = pattern->argv(0) + 1;
-			OP_Bundle* bundle = blist->getBundle(pattern_str);
-
-			if (bundle && bundle->contains(i_node.castToOPNode(), false))
-			{
-				pattern = OP_BundlePattern::allocPattern(i_node.getFullPath());
-				return pattern->match(&i_node, m_rop_path.c_str(), true);
-			}
-		}
-		return pattern->match(&i_node, m_rop_path.c_str(), true);
+		if( i_node.evalInt("light_enable", 0, m_current_time) )
+			flags |= e_displayed;
+	}
+	else if( i_node.getObjectDisplay( m_current_time ) )
+	{
+		flags |= e_displayed;
 	}
 
-	/*
-		Check only the display channel (light_enable parameter)
-		for light sources and ignore the display flag.
-	*/
-	if (const_cast<OBJ_Node&>(i_node).castToOBJLight())
-		return i_node.evalInt("light_enable", 0, m_current_time);
-
-	return i_node.getObjectDisplay( m_current_time );
-}
-
-bool object_visibility_resolver::object_is_matte(const OBJ_Node& i_node)const
-{
-	if (!m_mattes_pattern || m_mattes_pattern->isNullPattern())
-		return false;
+	//mattes and phantom lists can also be a bundle.
+	if( m_mattes_pattern && !m_mattes_pattern->isNullPattern() &&
+		match(m_mattes_pattern, i_node) )
+	{
+		flags |= e_matte;
+	}
 
-	//mattes list can also be a bundle.
-	if(m_mattes_pattern->argv(0)[0] == '@')
+	if( m_phantom_pattern && !m_phantom_pattern->isNullPattern() &&
+		match(m_phantom_pattern, i_node) )
 	{
-		OP_BundleList* blist = OPgetDirector()->getBundles();
-		assert(blist);
-		const char* pattern_str = m_mattes_pattern->argv(0) + 1;
-		OP_Bundle* bundle = blist->getBundle(pattern_str);
-		if (bundle && bundle->contains(i_node.castToOPNode(), false))
-		{
-			OP_BundlePattern* pattern;
-			pattern = OP_BundlePattern::allocPattern(i_node.getFullPath());
-			return pattern->match(&i_node, m_rop_path.c_str(), true);
-		}
+		flags |= e_phantom;
 	}
-	return m_mattes_pattern->match(&i_node, m_rop_path.c_str(), true);
+
+	return flags;
 }
 
-bool object_visibility_resolver::object_is_phantom(const OBJ_Node& i_node)const
+bool object_visibility_resolver::match(
+	OP_BundlePattern *i_pattern,
+	const OBJ_Node &i_node ) const
 {
-	if (!m_phantom_pattern || m_phantom_pattern->isNullPattern())
-		return false;
-
-	//phantom list can also be a bundle.
-	if (m_phantom_pattern->argv(0)[0] == '@')
+	OP_Bundle *bundle = pattern_bundle( i_pattern );
+	if( bundle && bundle->contains(i_node.castToOPNode(), false) )
 	{
-		OP_BundleList* blist = OPgetDirector()->getBundles();
-		assert(blist);
-		const char* pattern_str = m_phantom_pattern->argv(0) + 1;
-		OP_Bundle* bundle = blist->getBundle(pattern_str);
-		if (bundle && bundle->contains(i_node.castToOPNode(), false))
-		{
-			OP_BundlePattern* pattern;
-			pattern = OP_BundlePattern::allocPattern(i_node.getFullPath());
-			return pattern->match(&i_node, m_rop_path.c_str(), true);
-		}
+		return true;
 	}
-	return m_phantom_pattern->match(&i_node, m_rop_path.c_str(), true);
+
+	return i_pattern->match( &i_node, m_rop_path.c_str(), true );
 }
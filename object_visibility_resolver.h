@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 
 class settings;
 class OP_BundlePattern;
@@ -9,6 +10,10 @@ class OBJ_Node;
 /**
 	\brief Encapsulates logic needed to decide if an object/light is
 	visible or not.
+
+	The visibility of all objects is resolved once, when the resolver is
+	created (ie : for each rendered frame), so that queries are simple lookups.
+	Objects that change during an IPR render must be updated explicitly.
 */
 struct object_visibility_resolver
 {
@@ -20,6 +25,9 @@ struct object_visibility_resolver
 	bool object_is_matte( const OBJ_Node& ) const;
 	bool object_is_phantom(const OBJ_Node&) const;
 
+	/// Resolves the visibility of an object again, after it has changed
+	void update( const OBJ_Node& );
+
 	OP_BundlePattern* m_objects_to_render_pattern{nullptr};
 	OP_BundlePattern* m_lights_to_render_pattern{nullptr};
 	OP_BundlePattern* m_mattes_pattern{nullptr};
@@ -28,4 +36,35 @@ struct object_visibility_resolver
 	std::string m_rop_path;
 
 	double m_current_time;
+
+private:
+
+	enum visibility_flags
+	{
+		e_displayed = 1,
+		e_matte = 2,
+		e_phantom = 4
+	};
+
+	/// Computes the visibility flags of an object
+	unsigned resolve( const OBJ_Node& ) const;
+
+	/// Returns the visibility flags of an object
+	unsigned flags( const OBJ_Node& ) const;
+
+	/**
+		\brief Returns true if i_node is matched by a pattern or by the bundle
+		named by its first argument.
+
+		Patterns can also contain bundles, so if the pattern's first argument
+		is a bundle, the nodes it includes also match. The bundle is looked up
+		by name each time, since it could be deleted, or created, during an
+		IPR render.
+	*/
+	bool match(
+		OP_BundlePattern *i_pattern,
+		const OBJ_Node &i_node ) const;
+
+	/// Visibility flags of each object, by unique ID
+	std::unordered_map<int, unsigned> m_flags;
 };
@@ -1,12 +1,176 @@
 #include "pointmesh.h"
 
 #include "context.h"
+#include "ROP_3Delight.h"
 #include "time_sampler.h"
 
+#include <GT/GT_DANumeric.h>
 #include <GT/GT_PrimPointMesh.h>
 #include <OBJ/OBJ_Node.h>
+#include <UT/UT_BoundingBox.h>
+#include <UT/UT_ParallelUtil.h>
 #include <nsi.hpp>
 
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	/// Number of points processed by each parallel task
+	const GT_Size k_grain_size = 1 << 16;
+
+	/// Resolution of the grid on which the Morton curve is drawn, per axis
+	const uint64 k_morton_cells = 1024;
+
+	/// Inserts two zeros between each of the 10 lowest bits of i_value
+	uint64 spread_bits(uint64 i_value)
+	{
+		uint64 v = i_value & 0x3ff;
+		v = (v | (v << 16)) & 0x30000ff;
+		v = (v | (v << 8)) & 0x300f00f;
+		v = (v | (v << 4)) & 0x30c30c3;
+		v = (v | (v << 2)) & 0x9249249;
+		return v;
+	}
+
+	/**
+		\brief Computes the point indices of each chunk.
+
+		Each point gets a key made of the Morton code of its cell (in the
+		high bits) followed by its index, so sorting the keys orders the
+		points along the curve and the indices can be read back from them.
+		The sorted points are then divided into i_nb_chunks equal parts.
+	*/
+	void compute_chunk_indices(
+		const fpreal32* i_P,
+		GT_Size i_nb_points,
+		size_t i_nb_chunks,
+		std::vector<GT_DataArrayHandle>& o_chunk_indices)
+	{
+		GT_Size nb_blocks = (i_nb_points + k_grain_size - 1) / k_grain_size;
+		std::vector<UT_BoundingBox> block_bounds(nb_blocks);
+
+		UTparallelFor(
+			UT_BlockedRange<GT_Size>(0, nb_blocks),
+			[&](const UT_BlockedRange<GT_Size>& i_range)
+			{
+				for(GT_Size b = i_range.begin(); b != i_range.end(); b++)
+				{
+					UT_BoundingBox& box = block_bounds[b];
+					box.initBounds();
+
+					GT_Size end = std::min(i_nb_points, (b+1) * k_grain_size);
+					for(GT_Size i = b * k_grain_size; i < end; i++)
+					{
+						box.enlargeBounds(i_P[3*i], i_P[3*i+1], i_P[3*i+2]);
+					}
+				}
+			});
+
+		UT_BoundingBox bounds;
+		bounds.initBounds();
+		for(const UT_BoundingBox& box : block_bounds)
+		{
+			bounds.enlargeBounds(box);
+		}
+
+		std::vector<uint64> keys(i_nb_points);
+
+		UTparallelFor(
+			UT_BlockedRange<GT_Size>(0, i_nb_points, k_grain_size),
+			[&](const UT_BlockedRange<GT_Size>& i_range)
+			{
+				for(GT_Size i = i_range.begin(); i != i_range.end(); i++)
+				{
+					uint64 code = 0;
+					for(int a = 0; a < 3; a++)
+					{
+						fpreal size = bounds.sizeAxis(a);
+						fpreal t =
+							size > 0.0
+							?	(i_P[3*i+a] - bounds.minvec()[a]) / size
+							:	0.0;
+
+						// Also catches NaNs
+						uint64 cell = 0;
+						if(t > 0.0)
+						{
+							cell = std::min(
+								uint64(t * k_morton_cells), k_morton_cells-1);
+						}
+
+						code |= spread_bits(cell) << a;
+					}
+
+					keys[i] = (code << 32) | uint64(i);
+				}
+			});
+
+		UTparallelSort(keys.begin(), keys.end());
+
+		o_chunk_indices.resize(i_nb_chunks);
+
+		UTparallelFor(
+			UT_BlockedRange<size_t>(0, i_nb_chunks),
+			[&](const UT_BlockedRange<size_t>& i_range)
+			{
+				for(size_t c = i_range.begin(); c != i_range.end(); c++)
+				{
+					GT_Size start = GT_Size(c) * i_nb_points / i_nb_chunks;
+					GT_Size count =
+						GT_Size(c+1) * i_nb_points / i_nb_chunks - start;
+
+					GT_Int32Array* indices = new GT_Int32Array(count, 1);
+					int32* data = indices->data();
+					for(GT_Size j = 0; j < count; j++)
+					{
+						data[j] = int32(keys[start + j] & 0xffffffff);
+					}
+
+					o_chunk_indices[c] = GT_DataArrayHandle(indices);
+				}
+			});
+	}
+
+	/**
+		\brief Puts each point into the chunk where its ID was found in the
+		first time sample.
+
+		Points with a new ID go into the last chunk.
+	*/
+	void distribute_by_id(
+		const GT_DataArrayHandle& i_ids,
+		const std::unordered_map<int64, unsigned>& i_id_chunks,
+		size_t i_nb_chunks,
+		std::vector<GT_DataArrayHandle>& o_chunk_indices)
+	{
+		GT_Size nb_points = i_ids->entries();
+		std::vector<unsigned> point_chunks(nb_points);
+		std::vector<GT_Size> counts(i_nb_chunks, 0);
+		for(GT_Size i = 0; i < nb_points; i++)
+		{
+			auto c = i_id_chunks.find(i_ids->getI64(i));
+			point_chunks[i] =
+				c != i_id_chunks.end() ? c->second : unsigned(i_nb_chunks-1);
+			counts[point_chunks[i]]++;
+		}
+
+		std::vector<int32*> data(i_nb_chunks);
+		o_chunk_indices.resize(i_nb_chunks);
+		for(size_t c = 0; c < i_nb_chunks; c++)
+		{
+			GT_Int32Array* indices = new GT_Int32Array(counts[c], 1);
+			data[c] = indices->data();
+			o_chunk_indices[c] = GT_DataArrayHandle(indices);
+		}
+
+		for(GT_Size i = 0; i < nb_points; i++)
+		{
+			*data[point_chunks[i]]++ = int32(i);
+		}
+	}
+}
+
 pointmesh::pointmesh(
 	const context& i_ctx,
 	OBJ_Node *i_object,
@@ -23,6 +187,124 @@ pointmesh::pointmesh(
 {
 }
 
+unsigned pointmesh::chunk_size(const context& i_context)
+{
+	if(!i_context.rop())
+	{
+		return 0u;
+	}
+
+	int size = i_context.rop()->get_settings().get_point_chunk_size(
+		i_context.current_time());
+	return size > 0 ? unsigned(size) : 0u;
+}
+
+/**
+	Point indices are stored on 32 bits, which limits the size of the meshes
+	that can be split. The velocity, widths, IDs and user attributes are all
+	point attributes, re-indexed along with "P". Detail attributes are shared
+	by all chunks.
+
+	Once the first sample has been split, the others are always split into
+	the same number of chunks, even if they're small enough not to need it,
+	since the time samples of an object are matched by primitive index.
+*/
+void pointmesh::split(
+	const GT_PrimitiveHandle& i_points,
+	unsigned i_chunk_size,
+	chunking& io_chunking,
+	std::vector<GT_PrimitiveHandle>& o_chunks)
+{
+	const GT_PrimPointMesh* points =
+		static_cast<const GT_PrimPointMesh*>(i_points.get());
+
+	GT_Owner owner;
+	GT_DataArrayHandle P = points->findAttribute("P", owner, 0);
+	if(!P || P->getTupleSize() != 3)
+	{
+		return;
+	}
+
+	GT_Size nb_points = P->entries();
+
+	GT_DataArrayHandle ids = points->findAttribute("id", owner, 0);
+	if(ids && (ids->getTupleSize() != 1 || ids->entries() != nb_points))
+	{
+		ids = GT_DataArrayHandle();
+	}
+
+	if(!io_chunking.m_decided)
+	{
+		// The first time sample decides whether the mesh is split
+		io_chunking.m_decided = true;
+		if(i_chunk_size == 0 || nb_points <= i_chunk_size ||
+			nb_points > std::numeric_limits<int32>::max())
+		{
+			return;
+		}
+
+		io_chunking.m_nb_chunks =
+			(nb_points + i_chunk_size - 1) / i_chunk_size;
+		io_chunking.m_nb_points = nb_points;
+
+		GT_DataArrayHandle buffer;
+		compute_chunk_indices(
+			P->getF32Array(buffer),
+			nb_points,
+			io_chunking.m_nb_chunks,
+			io_chunking.m_indices);
+
+		if(ids)
+		{
+			for(unsigned c = 0; c < io_chunking.m_indices.size(); c++)
+			{
+				const GT_DataArrayHandle& indices = io_chunking.m_indices[c];
+				for(GT_Size j = 0; j < indices->entries(); j++)
+				{
+					io_chunking.m_id_chunks[ids->getI64(indices->getI32(j))] =
+						c;
+				}
+			}
+		}
+	}
+	else if(io_chunking.m_nb_chunks == 0 ||
+		nb_points > std::numeric_limits<int32>::max())
+	{
+		return;
+	}
+	else if(ids && !io_chunking.m_id_chunks.empty())
+	{
+		distribute_by_id(
+			ids,
+			io_chunking.m_id_chunks,
+			io_chunking.m_nb_chunks,
+			io_chunking.m_indices);
+	}
+	else if(nb_points != io_chunking.m_nb_points)
+	{
+		/*
+			Without IDs, points can't be matched between samples anyway. At
+			least keep the same number of chunks, so the samples still line up.
+		*/
+		GT_DataArrayHandle buffer;
+		compute_chunk_indices(
+			P->getF32Array(buffer),
+			nb_points,
+			io_chunking.m_nb_chunks,
+			io_chunking.m_indices);
+	}
+
+	for(const GT_DataArrayHandle& indices : io_chunking.m_indices)
+	{
+		GT_PrimPointMesh* chunk = new GT_PrimPointMesh(
+			points->getPointAttributes()->createIndirect(indices),
+			points->getUniformAttributes());
+		chunk->setPrimitiveTransform(points->getPrimitiveTransform());
+
+		o_chunks.push_back(GT_PrimitiveHandle(chunk));
+	}
+}
+
 void pointmesh::create( void ) const
 {
 	m_nsi.Create( m_handle.c_str(), "particles" );
@@ -93,3 +375,28 @@ void pointmesh::export_basic_attributes(
 			m_handle, i_time, NSI::FloatArg("width", 0.1f) );
 	}
 }
+
+/**
+	Widths are exported along with the position, at each time sample. When
+	missing, a default width is used, but then removing the attribute changes
+	the primitive's signature and forces a rebuild anyway. Rest attributes are
+	not exported for points.
+*/
+primitive::attribute_update pointmesh::get_attribute_update(
+	const std::string& i_name)const
+{
+	if( i_name == "rest" || i_name == "rnml" )
+	{
+		return attribute_update::e_ignore;
+	}
+
+	if( i_name == "id" || i_name == "width" || i_name == "pscale" )
+	{
+		return
+			has_velocity_blur()
+			?	attribute_update::e_rebuild
+			:	attribute_update::e_time_samples;
+	}
+
+	return common_attribute_update(i_name);
+}
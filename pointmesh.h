@@ -2,6 +2,9 @@
 
 #include "primitive.h"
 
+#include <unordered_map>
+#include <vector>
+
 /**
 	\brief Exporter for a GT_PrimPointMesh.
 */
@@ -14,12 +17,70 @@ public:
 	void create( void ) const override;
 	void set_attributes( void ) const override;
 
+	/**
+		\brief Returns the maximum number of points per particles node, or 0
+		if point meshes are not split.
+
+		This is set with the ROP's "Max Points per Particles Node" parameter.
+	*/
+	static unsigned chunk_size(const context& i_context);
+
+	/**
+		\brief How a point mesh is split, shared by all its time samples so
+		that they're split identically.
+	*/
+	struct chunking
+	{
+		/// True once the first time sample has been split (or not)
+		bool m_decided{false};
+		/// Number of chunks, 0 if the point mesh isn't split
+		size_t m_nb_chunks{0};
+		/// Number of points of the first time sample
+		GT_Size m_nb_points{0};
+		/// Point indices of each chunk, for the last time sample split
+		std::vector<GT_DataArrayHandle> m_indices;
+		/// Chunk of each point ID of the first time sample
+		std::unordered_map<int64, unsigned> m_id_chunks;
+	};
+
+	/**
+		\brief Splits a large point mesh into chunks of nearby points.
+
+		Points are sorted along a Morton curve and split into chunks of
+		i_chunk_size points. Each chunk refers to the original attributes
+		through an index list, so all attributes remain consistent.
+
+		Other time samples of the same primitive are split into the same
+		number of chunks. When the points have an "id" attribute, each point
+		goes into the chunk where its ID was in the first sample, so that
+		motion blur still works when points are born or die in between.
+		Without IDs, the chunks are re-used as is if the number of points
+		matches, and computed again otherwise.
+
+		\param i_points
+			The GT_PrimPointMesh to split.
+		\param i_chunk_size
+			The maximum number of points in each chunk of the first sample.
+		\param io_chunking
+			How the previous time samples were split, if any.
+		\param o_chunks
+			The chunks, which stay empty if the mesh doesn't need to be split.
+	*/
+	static void split(
+		const GT_PrimitiveHandle& i_points,
+		unsigned i_chunk_size,
+		chunking& io_chunking,
+		std::vector<GT_PrimitiveHandle>& o_chunks);
+
 protected:
 	/// Exports time-dependent attributes to NSI
 	void set_attributes_at_time(
 		double i_time,
 		const GT_PrimitiveHandle i_gt_primitive)const override;
 
+	attribute_update get_attribute_update(
+		const std::string& i_name)const override;
+
 private:
 	/**
 		\brief Exports "width" and possibly also "P" and "id" attributes.
@@ -1,6 +1,7 @@
 #include "polygonmesh.h"
 
 #include "context.h"
+#include "export_memory.h"
 #include "time_sampler.h"
 
 #include <GA/GA_Names.h>
@@ -164,6 +165,34 @@ void polygonmesh::set_attributes_at_time(
 		to_export, *polygon_mesh, i_time, polygon_mesh->getVertexList() );
 }
 
+/**
+	Subdivision surfaces don't export normals and need uv connectivity, which
+	is generated from the whole mesh, along with the uvs.
+*/
+primitive::attribute_update polygonmesh::get_attribute_update(
+	const std::string& i_name)const
+{
+	if( i_name == "creaseweight" )
+	{
+		return attribute_update::e_rebuild;
+	}
+
+	if( m_is_subdiv )
+	{
+		if( i_name == "N" )
+			return attribute_update::e_ignore;
+		if( i_name == "uv" )
+			return attribute_update::e_rebuild;
+	}
+
+	if( i_name == "uv" )
+	{
+		return attribute_update::e_current_time;
+	}
+
+	return common_attribute_update(i_name);
+}
+
 void polygonmesh::connect( void ) const
 {
 	primitive::connect();
@@ -294,4 +323,14 @@ void polygonmesh::generate_uv_connectivity(
 			uv_t{uv_data[i*3+0], uv_data[i*3+1], uv_data[i*3+2]}, unsigned(i))
 			.first->second;
 	}
+
+	/*
+		The map's nodes are estimated as their value plus a typical red-black
+		tree node header.
+	*/
+	export_memory::transient welding_memory( m_object );
+	welding_memory.add( buffer );
+	welding_memory.add(
+		uv_map.size() *
+		(sizeof(std::map<uv_t, unsigned>::value_type) + 4*sizeof(void*)) );
 }
@@ -26,6 +26,9 @@ protected:
 		double i_time,
 		const GT_PrimitiveHandle i_gt_primitive)const override;
 
+	attribute_update get_attribute_update(
+		const std::string& i_name)const override;
+
 private:
 	void export_creases(
 		GT_DataArrayHandle i_indices, int *i_nvertices, size_t i_n ) const;
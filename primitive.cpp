@@ -1,14 +1,18 @@
 #include "primitive.h"
 
+#include "context.h"
+#include "export_memory.h"
 #include "geometry.h"
 #include "time_sampler.h"
 #include "vop.h"
 
+#include <algorithm>
 #include <unordered_map>
 
 #include <OBJ/OBJ_Node.h>
 #include <VOP/VOP_Node.h>
 #include <OP/OP_Node.h>
+#include <GT/GT_PrimCurveMesh.h>
 #include <GT/GT_PrimPolygonMesh.h>
 
 #include <nsi.hpp>
@@ -21,6 +25,49 @@ namespace
 	const char *k_shader_slot_names[3] =
 		{ "surfaceshader", "displacementshader", "volumeshader" };
 
+	/// Mixes i_value into io_hash
+	template<typename T>
+	void hash_combine( size_t &io_hash, const T &i_value )
+	{
+		io_hash ^=
+			std::hash<T>()(i_value) + 0x9e3779b9 + (io_hash<<6) + (io_hash>>2);
+	}
+
+	/// Returns the vertex list used with point attributes of polygon meshes
+	GT_DataArrayHandle vertices_list( const GT_Primitive &i_primitive )
+	{
+		int type = i_primitive.getPrimitiveType();
+		if( type != GT_PRIM_POLYGON_MESH && type != GT_PRIM_SUBDIVISION_MESH )
+		{
+			return GT_DataArrayHandle();
+		}
+
+		return static_cast<const GT_PrimPolygonMesh &>(i_primitive).getVertexList();
+	}
+
+	/// Mixes the content of an integer array into io_hash
+	void hash_array( size_t &io_hash, const GT_DataArrayHandle &i_array )
+	{
+		if( !i_array )
+			return;
+
+		GT_DataArrayHandle buffer;
+		const int *values = i_array->getI32Array( buffer );
+		for( GT_Size i = 0; i < i_array->entries(); i++ )
+		{
+			hash_combine( io_hash, values[i] );
+		}
+	}
+
+	/// Mixes the content of a count array into io_hash
+	void hash_counts( size_t &io_hash, const GT_CountArray &i_counts )
+	{
+		hash_combine( io_hash, (size_t)i_counts.entries() );
+		for( GT_Size i = 0; i < i_counts.entries(); i++ )
+		{
+			hash_combine( io_hash, (size_t)i_counts.getCount(i) );
+		}
+	}
 }
 
 primitive::primitive(
@@ -151,6 +198,195 @@ bool primitive::is_volume()const
 	return false;
 }
 
+size_t primitive::retained_memory()const
+{
+	size_t bytes = 0;
+	for(const TimedPrimitive& sample : m_gt_primitives)
+	{
+		bytes += sample.second->getMemoryUsage();
+	}
+
+	return bytes;
+}
+
+/**
+	The topology includes everything that would require re-creating the NSI
+	node (or re-connecting it) : face and curve counts, vertex lists, number of
+	elements in each class of attributes and the primitive's transform.
+*/
+primitive_signature primitive::signature()const
+{
+	primitive_signature result;
+
+	const GT_Primitive &gt = *default_gt_primitive();
+	result.m_type = gt.getPrimitiveType();
+
+	size_t &topology = result.m_topology;
+	hash_combine( topology, m_gt_primitives.size() );
+
+	if( result.m_type == GT_PRIM_POLYGON_MESH ||
+		result.m_type == GT_PRIM_SUBDIVISION_MESH )
+	{
+		const GT_PrimPolygonMesh &mesh =
+			static_cast<const GT_PrimPolygonMesh &>(gt);
+		hash_counts( topology, mesh.getFaceCountArray() );
+		hash_array( topology, mesh.getVertexList() );
+	}
+	else if( result.m_type == GT_PRIM_CURVE_MESH )
+	{
+		const GT_PrimCurveMesh &curves =
+			static_cast<const GT_PrimCurveMesh &>(gt);
+		hash_counts( topology, curves.getCurveCountArray() );
+		hash_combine( topology, (int)curves.getBasis() );
+		hash_combine( topology, curves.getWrap() );
+	}
+
+	UT_Matrix4D matrix;
+	gt.getPrimitiveTransform()->getMatrix( matrix );
+	for( int i = 0; i < 16; i++ )
+	{
+		hash_combine( topology, matrix.data()[i] );
+	}
+
+	for( const TimedPrimitive &prim : m_gt_primitives )
+	{
+		hash_combine( topology, prim.first );
+
+		const GT_AttributeListHandle lists[] =
+		{
+			prim.second->getPointAttributes(),
+			prim.second->getVertexAttributes(),
+			prim.second->getUniformAttributes(),
+			prim.second->getDetailAttributes()
+		};
+
+		for( const GT_AttributeListHandle &list : lists )
+		{
+			if( !list || list->entries() == 0 )
+			{
+				hash_combine( topology, (size_t)0 );
+				continue;
+			}
+
+			hash_combine( topology, (size_t)list->get(0)->entries() );
+
+			for( int a = 0; a < list->entries(); a++ )
+			{
+				const GT_DataArrayHandle &data = list->get(a);
+				int64_t data_id = data ? data->getDataId() : -1;
+
+				/* Combine the IDs of all time samples, -1 is sticky. */
+				int64_t &id = result.m_attributes.emplace(
+					list->getName(a).toStdString(), 0 ).first->second;
+				id = (id == -1 || data_id == -1) ? -1 : id * 31 + data_id;
+			}
+		}
+	}
+
+	return result;
+}
+
+bool primitive::can_update_attributes(
+	const std::vector<std::string>& i_names)const
+{
+	for( const std::string &name : i_names )
+	{
+		if( get_attribute_update(name) == attribute_update::e_rebuild )
+			return false;
+	}
+
+	return true;
+}
+
+/**
+	Each attribute is deleted before being exported again, so time samples
+	from the previous export don't remain.
+*/
+void primitive::update_attributes(const std::vector<std::string>& i_names)const
+{
+	NSI::Context& nsi = attributes_context();
+	if(nsi.Handle() == NSI_BAD_CONTEXT)
+	{
+		return;
+	}
+
+	for( const std::string &name : i_names )
+	{
+		attribute_update update = get_attribute_update(name);
+		if( update == attribute_update::e_ignore )
+			continue;
+
+		assert( update != attribute_update::e_rebuild );
+
+		nsi.DeleteAttribute( m_handle, nsi_attribute_name(name) );
+
+		if( update == attribute_update::e_time_samples )
+		{
+			for( const TimedPrimitive &prim : m_gt_primitives )
+			{
+				std::vector<std::string> to_export(1, name);
+				export_attributes(
+					to_export, *prim.second, prim.first,
+					vertices_list(*prim.second) );
+			}
+		}
+		else
+		{
+			std::vector<std::string> to_export(1, name);
+			export_attributes(
+				to_export, *default_gt_primitive(),
+				update == attribute_update::e_rest
+					?	m_context.ShutterOpen() : m_context.m_current_time,
+				vertices_list(*default_gt_primitive()) );
+		}
+	}
+}
+
+primitive::attribute_update primitive::get_attribute_update(
+	const std::string& i_name)const
+{
+	return attribute_update::e_rebuild;
+}
+
+/**
+	Position-related attributes can't be updated when they are extrapolated
+	from the velocity, and material assignments or 3Delight-specific attributes
+	affect more than a single NSI attribute. Other attributes are only exported
+	when bound by materials, at the current time, and ignored otherwise (this
+	includes GT's internal attributes). find_bind_attributes() must have been
+	called first.
+*/
+primitive::attribute_update primitive::common_attribute_update(
+	const std::string& i_name)const
+{
+	if( i_name == "shop_materialpath" || i_name.find("_3dl_") == 0 )
+	{
+		return attribute_update::e_rebuild;
+	}
+
+	if( i_name == "P" || i_name == "N" || i_name == k_velocity_attribute )
+	{
+		if( has_velocity_blur() )
+			return attribute_update::e_rebuild;
+
+		if( i_name != k_velocity_attribute )
+			return attribute_update::e_time_samples;
+	}
+
+	if( i_name == "rest" || i_name == "rnml" )
+	{
+		return attribute_update::e_rest;
+	}
+
+	if( std::find(m_bind_attributes.begin(), m_bind_attributes.end(), i_name) !=
+		m_bind_attributes.end() )
+	{
+		return attribute_update::e_current_time;
+	}
+
+	return attribute_update::e_ignore;
+}
+
 bool primitive::export_extrapolated_P(GT_DataArrayHandle i_vertices_list)const
 {
 	GT_Owner owner;
@@ -212,6 +448,10 @@ bool primitive::export_extrapolated_P(GT_DataArrayHandle i_vertices_list)const
 	GT_DataArrayHandle velocity_buffer;
 	const float* nsi_velocity_data = velocity_data->getF32Array(velocity_buffer);
 
+	export_memory::transient temporary(m_object);
+	temporary.add(nb_points*3*sizeof(float));
+	temporary.add(velocity_buffer);
+
 	/*
 		Compute pre-frame position from frame position (typically 1 half-shutter
 		earlier).
@@ -266,25 +506,26 @@ bool primitive::has_velocity_blur( void ) const
 		k_velocity_attribute, owner, 0);
 }
 
+void primitive::export_bind_attributes( VOP_Node *i_obj_level_material[3] ) const
+{
+	find_bind_attributes( i_obj_level_material );
+
+	/* export_attributes removes the names it exports from the list. */
+	std::vector<std::string> binds = m_bind_attributes;
+	export_attributes(
+		binds,
+		*default_gt_primitive().get(),
+		m_context.m_current_time,
+		vertices_list( *default_gt_primitive() ) );
+}
+
 /**
 	We scan for all assigned shaders on this primitive. We scan
 	both SOP-level and OBJ-level shaders as both could be used
 	at the same time.
 */
-void primitive::export_bind_attributes( VOP_Node *i_obj_level_material[3] ) const
+void primitive::find_bind_attributes( VOP_Node *i_obj_level_material[3] ) const
 {
-	GT_DataArrayHandle i_vertices_list;
-	GT_Primitive *primitive = default_gt_primitive().get();
-	int type = primitive->getPrimitiveType();
-	if( type == GT_PRIM_POLYGON_MESH ||
-		type == GT_PRIM_SUBDIVISION_MESH )
-	{
-		const GT_PrimPolygonMesh *polygon_mesh =
-			static_cast<const GT_PrimPolygonMesh *>(primitive);
-
-		i_vertices_list = polygon_mesh->getVertexList();
-	}
-
 	GT_Owner owner;
 	GT_DataArrayHandle materials = default_gt_primitive().get()->findAttribute(
 		"shop_materialpath", owner, 0);
@@ -341,10 +582,7 @@ void primitive::export_bind_attributes( VOP_Node *i_obj_level_material[3] ) cons
 			} ),
 		binds.end() );
 
-	export_attributes(
-		binds,
-		*default_gt_primitive().get(),
-		m_context.m_current_time, i_vertices_list );
+	m_bind_attributes.swap( binds );
 }
 
 void primitive::get_bind_attributes(
@@ -471,7 +709,7 @@ void primitive::assign_sop_materials( void ) const
 			else
 			{
 				m_nsi.Connect(
-					vop_handle, "",
+					vop::shader_handle(*vop, m_context), "",
 					attribute_handle, k_shader_slot_names[i],
 					(
 						NSI::IntegerArg("priority", 1),
@@ -530,7 +768,7 @@ void primitive::assign_sop_materials( void ) const
 			else
 			{
 				m_nsi.Connect(
-						vop_handle, "",
+						vop::shader_handle(*V, m_context), "",
 						attribute_handle, "surfaceshader",
 						NSI::IntegerArg("strength", 1));
 			}
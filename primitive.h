@@ -6,6 +6,8 @@
 #include <unordered_set>
 #include <string>
 
+struct primitive_signature;
+
 /// Base class for exporters of refined GT primitives.
 class primitive : public exporter
 {
@@ -71,8 +73,68 @@ public:
 	/// Returns true if the primitive should be rendered as a volume
 	virtual bool is_volume()const;
 
+	/**
+		\brief Returns the memory kept alive by this exporter until it's
+		deleted, mostly the GT primitives of its time samples.
+
+		\ref export_memory
+	*/
+	virtual size_t retained_memory()const;
+
+	/**
+		\brief Returns the type, topology and attribute data IDs of the
+		primitive, as exported by create(), connect() and set_attributes().
+	*/
+	primitive_signature signature()const;
+
+	/**
+		\brief Returns true if the listed attributes can be updated in place
+		by update_attributes().
+	*/
+	bool can_update_attributes(const std::vector<std::string>& i_names)const;
+
+	/**
+		\brief Exports again the listed attributes, in place.
+
+		This is used in IPR when a SOP modifies attribute values without
+		changing the topology, so the NSI node doesn't have to be re-created.
+		Attributes that a full export doesn't write are ignored.
+		find_bind_attributes() must have been called and
+		can_update_attributes() must have returned true for the same list.
+	*/
+	void update_attributes(const std::vector<std::string>& i_names)const;
+
 protected:
 
+	/// How an attribute modification can be applied to the NSI node
+	enum class attribute_update
+	{
+		/// The whole primitive must be exported again
+		e_rebuild,
+		/// The attribute is not exported at all
+		e_ignore,
+		/// The attribute is exported once, at the current time
+		e_current_time,
+		/// The attribute is exported at each time sample
+		e_time_samples,
+		/// The attribute is a rest attribute, exported at shutter open
+		e_rest
+	};
+
+	/**
+		\brief Returns how a modification of attribute i_name can be applied.
+
+		The default implementation requires a rebuild for all attributes.
+		Primitive types that support in-place updates override it and call
+		common_attribute_update() for the attributes they don't handle
+		specially.
+	*/
+	virtual attribute_update get_attribute_update(
+		const std::string& i_name)const;
+
+	/// Returns how attributes shared by most primitive types are updated
+	attribute_update common_attribute_update(const std::string& i_name)const;
+
 	/// Exports time-dependent attributes to NSI
 	virtual void set_attributes_at_time(
 		double i_time,
@@ -117,6 +179,14 @@ protected:
 	*/
 	void export_bind_attributes( VOP_Node *i_obj_level_materials[3] ) const;
 
+	/**
+		\brief Finds the attributes needed by the assigned materials, which
+		are then exported by export_bind_attributes().
+
+		Attributes that are exported anyway, such as "P", are not included.
+	*/
+	void find_bind_attributes( VOP_Node *i_obj_level_materials[3] ) const;
+
 	/**
 		Return all the materials needed by this geometry.
 	*/
@@ -139,4 +209,7 @@ private:
 
 	/// One GT primitive for each time sample
 	std::vector<TimedPrimitive> m_gt_primitives;
+
+	/// Attributes needed by materials, as found by find_bind_attributes()
+	mutable std::vector<std::string> m_bind_attributes;
 };
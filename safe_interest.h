@@ -57,6 +57,12 @@ public:
 		return m_node;
 	}
 
+	/// Returns the data passed to the callback
+	void* callee()const
+	{
+		return m_callee;
+	}
+
 	/// Returns true if both interests have the same callback/node pair.
 	bool operator==(const safe_interest& i_other)const
 	{
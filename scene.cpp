@@ -13,8 +13,16 @@
 /* } */
 
 #include "context.h"
+#include "export_memory.h"
+#include "export_trace.h"
+#include "ipr_crop_culling.h"
+#include "light_linking_index.h"
+#include "material_path_cache.h"
 #include "object_attributes.h"
 #include "safe_interest.h"
+#include "scene_node_index.h"
+#include "shader_library.h"
+#include "texture_cache.h"
 #include "ROP_3Delight.h"
 
 #include <GEO/GEO_Normal.h>
@@ -24,10 +32,12 @@
 #include <OP/OP_Director.h>
 #include <SOP/SOP_Node.h>
 #include <UT/UT_String.h>
-#include <UT/UT_TagManager.h>
 #include <VOP/VOP_Node.h>
 
+#include <memory>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace
 {
@@ -280,6 +290,8 @@ void scene::vop_scan(
 	const context &i_context,
 	std::vector<exporter *> &io_to_export )
 {
+	export_trace::scope trace( "vop_scan" );
+
 	std::unordered_set< std::string > materials;
 	for( auto E : io_to_export )
 	{
@@ -369,6 +381,24 @@ void scene::create_materials_exporters(
 	std::vector<VOP_Node *> vops;
 	get_material_vops( i_materials, vops );
 
+	/*
+		Convert the textures used by those VOPs before their exporters refer to
+		them, so that 3Delight doesn't have to do it one by one while rendering.
+	*/
+	texture_cache::get_instance().preconvert( i_context, vops );
+
+	/*
+		Each duplicated network would have to be compiled separately by
+		3Delight. In IPR, edits are done one VOP at a time, so all of them must
+		be kept.
+	*/
+	if( !i_context.m_ipr &&
+		i_context.rop()->get_settings().get_deduplicate_shaders(
+			i_context.current_time()) )
+	{
+		deduplicate_shaders( i_context, vops );
+	}
+
 	for( auto &V : vops )
 	{
 		if(i_context.m_ipr)
@@ -378,6 +408,71 @@ void scene::create_materials_exporters(
 		io_to_export.push_back( new vop(i_context,V) );
 	}
 }
+/**
+	\brief Keeps only one VOP for each structurally identical shader network.
+
+	The other VOPs are removed from io_vops and recorded as aliases of the
+	one that is kept, so that connections to them are redirected to it.
+	\ref vop::shader_handle
+
+	\param i_context
+		Current rendering context.
+	\param io_vops
+		VOPs to be exported, as returned by get_material_vops.
+*/
+void scene::deduplicate_shaders(
+	const context &i_context,
+	std::vector<VOP_Node*> &io_vops )
+{
+	const shader_library &library = shader_library::get_instance();
+
+	std::unordered_map<VOP_Node*, size_t> hashes;
+	std::unordered_map<size_t, std::vector<VOP_Node*>> canonical_vops;
+
+	std::vector<VOP_Node*> unique_vops;
+	for( VOP_Node *V : io_vops )
+	{
+		/*
+			Incandescence lights set incandescence_multiplier directly on the
+			material's shader node, so it can't be shared with other
+			materials.
+		*/
+		const shader_library::shader_parameters *parameters =
+			library.get_shader_parameters( V );
+		if( parameters && parameters->find("incandescence_multiplier") )
+		{
+			unique_vops.push_back( V );
+			continue;
+		}
+
+		size_t hash = vop::network_hash( i_context, V, hashes );
+		std::vector<VOP_Node*> &candidates = canonical_vops[hash];
+
+		VOP_Node *canonical = nullptr;
+		for( VOP_Node *candidate : candidates )
+		{
+			if( vop::same_network(i_context, candidate, V) )
+			{
+				canonical = candidate;
+				break;
+			}
+		}
+
+		if( canonical )
+		{
+			i_context.m_shader_aliases[exporter::handle(*V, i_context)] =
+				exporter::handle( *canonical, i_context );
+		}
+		else
+		{
+			candidates.push_back( V );
+			unique_vops.push_back( V );
+		}
+	}
+
+	io_vops.swap( unique_vops );
+}
+
 /**
 	\brief Creates the exporters required by the atmosphere shader.
 
@@ -389,35 +484,41 @@ void scene::create_materials_exporters(
 void scene::create_atmosphere_shader_exporter(
 	const context& i_context,
 	std::vector<exporter *>& io_to_export )
+{
+	VOP_Node *atmosphere = atmosphere_shader( i_context );
+	if( atmosphere )
+	{
+		std::unordered_set<std::string> mat;
+		mat.insert(atmosphere->getFullPath().toStdString());
+		create_materials_exporters(mat, i_context, io_to_export);
+	}
+}
+
+/// Returns the volume shader of the ROP's atmosphere material, if any
+VOP_Node* scene::atmosphere_shader( const context& i_context )
 {
 	ROP_Node *rop = (ROP_Node *)i_context.rop();
 
 	assert( rop );
 
 	if( !rop )
-		return;
+		return nullptr;
 
 	int index;
 	if( (index=rop->getParmIndex("atmosphere")) == -1 )
-		return;
+		return nullptr;
 
 	ROP_3Delight *r3 = (ROP_3Delight *) CAST_ROPNODE( rop );
 	UT_String atmosphere_path;
 	rop->evalString( atmosphere_path, "atmosphere", 0, r3->current_time() );
 
-	if( atmosphere_path.length() > 0 )
-	{
-		VOP_Node *mats[3] = { nullptr };
-		exporter::resolve_material_path( r3, atmosphere_path.c_str(), mats );
+	if( atmosphere_path.length() == 0 )
+		return nullptr;
 
-		VOP_Node *atmosphere_shader = mats[2]; // volume
-		if( atmosphere_shader )
-		{
-			std::unordered_set<std::string> mat;
-			mat.insert(atmosphere_shader->getFullPath().toStdString());
-			create_materials_exporters(mat, i_context, io_to_export);
-		}
-	}
+	VOP_Node *mats[3] = { nullptr };
+	exporter::resolve_material_path( r3, atmosphere_path.c_str(), mats );
+
+	return mats[2]; // volume
 }
 
 /**
@@ -432,34 +533,15 @@ void scene::obj_scan(
 	const context &i_context,
 	std::vector<exporter *> &o_to_export )
 {
-	std::vector<OP_Node *> traversal;
-	traversal.push_back( OPgetDirector()->findNode("/obj") );
+	export_trace::scope trace( "obj_scan" );
 
-	while( traversal.size() )
-	{
-		OP_Node *current = traversal.back();
-		traversal.pop_back();
-
-		int nkids = current->getNchildren();
-		for( int i=0; i< nkids; i++ )
-		{
-			OP_Node *node = current->getChild(i);
-
-			if( node->castToTOPNode() || node->castToSOPNode() ||
-				node->castToDOPNode()  )
-			{
-				continue;
-			}
-
-			OBJ_Node *obj = node->castToOBJNode();
+	std::vector<OBJ_Node *> objects;
+	scene_node_index::get_instance().get_nodes(
+		scene_node_index::e_all, objects );
 
-			if( obj )
-			{
-				process_obj_node( i_context, obj, false, o_to_export );
-			}
-
-			traversal.push_back( node );
-		}
+	for( OBJ_Node *obj : objects )
+	{
+		process_obj_node( i_context, obj, false, o_to_export );
 	}
 }
 
@@ -471,6 +553,8 @@ void scene::scan_for_instanced(
 	const context &i_context,
 	std::vector<exporter *> &io_to_export )
 {
+	export_trace::scope trace( "scan_for_instanced" );
+
 	std::unordered_set< std::string > instanced;
 
 	/*
@@ -584,6 +668,8 @@ void scene::create_exporters(
 {
 	assert( i_context.rop() );
 
+	export_memory::get_instance().begin_phase( "refine" );
+
 	/*
 		Start by getting the list of all OBJ exporters.
 	*/
@@ -600,6 +686,173 @@ void scene::create_exporters(
 		build a list of VOP exporters for these.
 	*/
 	vop_scan( i_context, o_to_export );
+
+	/*
+		Finally, leave out geometry that can't be seen through the crop region
+		of an IPR render. Their materials are still exported, ready for when
+		they come back into view.
+	*/
+	cull_to_crop( i_context, o_to_export );
+}
+
+/**
+	\brief Removes the geometry exporters of objects culled by the IPR crop
+	region.
+
+	\ref ipr_crop_culling
+*/
+void scene::cull_to_crop(
+	const context &i_context,
+	std::vector<exporter *> &io_to_export )
+{
+	ipr_crop_culling *culling = i_context.crop_culling();
+	if( !culling )
+		return;
+
+	/*
+		Instancers and the objects they instance can't be culled. See
+		scan_for_instanced.
+	*/
+	std::unordered_set<std::string> instanced;
+	for( exporter *E : io_to_export )
+	{
+		light *L = nullptr;
+		geometry *G = dynamic_cast<geometry *>( E );
+
+		if( G )
+		{
+			std::vector< const instance * > instances;
+			G->get_instances( instances );
+
+			for( auto I : instances )
+				I->get_instanced( instanced );
+
+			if( !instances.empty() )
+				culling->exempt( *CAST_OBJNODE(G->node()) );
+		}
+		else if( (L=dynamic_cast<light *>(E)) )
+		{
+			std::string geo = L->get_geometry_path();
+
+			if( !geo.empty() )
+				instanced.insert( geo );
+		}
+	}
+
+	std::vector<exporter *> kept;
+	kept.reserve( io_to_export.size() );
+	for( exporter *E : io_to_export )
+	{
+		OBJ_Node *obj = CAST_OBJNODE( E->node() );
+		if( !obj || !dynamic_cast<geometry *>(E) )
+		{
+			kept.push_back( E );
+			continue;
+		}
+
+		if( instanced.count(obj->getFullPath().toStdString()) )
+		{
+			culling->exempt( *obj );
+			kept.push_back( E );
+			continue;
+		}
+
+		bool was_culled = culling->culled().count( obj->getUniqueId() ) > 0;
+		if( !culling->cull(i_context, *obj) )
+		{
+			kept.push_back( E );
+			continue;
+		}
+
+		/*
+			After a time change, the object might still be in the NSI scene
+			from the previous frame.
+		*/
+		if( !was_culled && i_context.m_time_dependent )
+		{
+			geometry::Delete( *obj, i_context );
+		}
+
+		delete E;
+	}
+
+	io_to_export.swap( kept );
+}
+
+void scene::get_objects_by_priority(
+	const context &i_context,
+	OBJ_Camera* i_camera,
+	std::vector<OBJ_Node*>* o_objects )
+{
+	std::vector<OBJ_Node *> objects;
+	scene_node_index::get_instance().get_nodes(
+		scene_node_index::e_all, objects );
+
+	for( OBJ_Node *obj : objects )
+	{
+		export_priority priority = e_hidden_priority;
+		if( obj == i_camera )
+		{
+			priority = e_camera_priority;
+		}
+		else if( !i_camera || obj->castToOBJLight() ||
+			camera::is_in_frustum(*i_camera, *obj, i_context.current_time()) )
+		{
+			priority = e_visible_priority;
+		}
+
+		o_objects[priority].push_back( obj );
+	}
+}
+
+/**
+	Objects only depend on the transforms of other objects, which are never
+	deleted after a time change, so they can be exported separately. Objects
+	instanced by the exported ones are exported along with them.
+*/
+void scene::create_exporters(
+	const context &i_context,
+	const std::vector<OBJ_Node*>& i_objects,
+	std::unordered_set<std::string>& io_materials,
+	std::vector<exporter*>& o_to_export )
+{
+	assert( i_context.rop() );
+
+	export_memory::get_instance().begin_phase( "refine" );
+
+	{
+		export_trace::scope trace( "obj_scan" );
+		for( OBJ_Node *obj : i_objects )
+		{
+			process_obj_node( i_context, obj, false, o_to_export );
+		}
+	}
+
+	scan_for_instanced( i_context, o_to_export );
+
+	std::unordered_set< std::string > materials;
+	{
+		export_trace::scope trace( "vop_scan" );
+
+		for( auto E : o_to_export )
+		{
+			geometry *geo = dynamic_cast<geometry*>( E );
+			if( geo )
+				geo->get_all_material_paths( materials );
+		}
+
+		for( auto M = materials.begin(); M != materials.end(); )
+		{
+			if( io_materials.insert(*M).second )
+				++M;
+			else
+				M = materials.erase( M );
+		}
+
+		create_materials_exporters( materials, i_context, o_to_export );
+	}
+
+	cull_to_crop( i_context, o_to_export );
 }
 
 /**
@@ -608,6 +861,8 @@ void scene::create_exporters(
 */
 void scene::convert_to_nsi(const context& i_context, bool i_keep_exporter)
 {
+	export_trace::scope trace( "convert_to_nsi" );
+
 	/*
 		Start by getting the list of all OBJ exporters.
 	*/
@@ -628,8 +883,10 @@ void scene::export_nsi(
 		objects that we support, so that connections can later be made in any
 		particular order.
 	*/
+	export_memory::get_instance().begin_phase( "create" );
 	for( auto &exporter : i_to_export )
 	{
+		export_trace::scope trace( "create", exporter->node() );
 		exporter->create();
 	}
 
@@ -637,8 +894,10 @@ void scene::export_nsi(
 		Now connect nodes together. This has to be done after the create
 		so that all the nodes are present.
 	*/
+	export_memory::get_instance().begin_phase( "connect" );
 	for( auto &exporter : i_to_export )
 	{
+		export_trace::scope trace( "connect", exporter->node() );
 		exporter->connect();
 	}
 
@@ -647,8 +906,10 @@ void scene::export_nsi(
 		managed nodes in the process.
 		FIXME : parallel processing?
 	*/
+	export_memory::get_instance().begin_phase( "set_attributes" );
 	for( auto &exporter : i_to_export )
 	{
+		export_trace::scope trace( "set_attributes", exporter->node() );
 		exporter->set_attributes();
 	}
 
@@ -656,32 +917,20 @@ void scene::export_nsi(
 		Scene export is done, with the exception of light linking and matte
 		objects
 
-		Remember "lightcategories" expressions that already have a matching NSI
-		"set" node in the scene. All lights are on by default, so light linking
-		is used to turn them off. This requires that the NSI sets we have
-		exported contains the *complement* of their corresponding expression.
-		Without this set, we would have to test every object's light categories
-		expression against every light's categories list, which would be a
-		waste because those expressions tend be re-used on multiple objects.
+		All lights are on by default, so light linking is used to turn them
+		off. This requires that the NSI sets we export contain the *complement*
+		of their corresponding "lightcategories" expression. The index
+		remembers the expressions that already have a matching NSI "set" node
+		in the scene, and only looks for the lights to render if some object
+		doesn't see them all.
 	*/
-	std::set<std::string> exported_lights_categories;
-
-	/*
-		This stores the list of lights that are part of the rendered scene.
-		This is not always required, since some (hopefully, many) objects see
-		all lights and don't need to connect to light categories. This is
-		especially true in IPR where we usually re-export only one object. So,
-		it's filled lazily, at most once, by export_light_categories.
-	*/
-	std::vector<OBJ_Node*> lights_to_render;
+	light_linking_index light_linking( i_context );
 
 	for( auto &exporter : i_to_export )
 	{
-		export_light_categories(
-			i_context,
-			exporter,
-			exported_lights_categories,
-			lights_to_render );
+		export_trace::scope trace(
+			"export_light_categories", exporter->node() );
+		export_light_categories( i_context, exporter, light_linking );
 	}
 
 	if (i_keep_exporters)
@@ -721,73 +970,59 @@ void scene::find_lights(
 	bool i_want_incandescence_lights,
 	std::vector<OBJ_Node*>& o_lights )
 {
-	/* A traversal stack to avoid recursion */
-	std::vector< OP_Node * > traversal;
-
 	OP_Node *director = OPgetDirector();
-	traversal.push_back( director->findNode( "/obj") );
 
 	/* FIXME: not a nice way to access current time. */
 	double time = 0;
 	OP_Node *rop = director->findNode( i_rop_path );
-	context* ctx;
+	std::unique_ptr<context> ctx;
 	if( rop )
 	{
 		ROP_3Delight *r3 = (ROP_3Delight *) CAST_ROPNODE( rop );
 		time = r3 ? r3->current_time() : 0.0;
 		if (r3)
 		{
-			ctx = new context(r3, time);
+			ctx.reset( new context(r3, time) );
 		}
 	}
 
-	while( traversal.size() )
+	/*
+		Only geometry could load a VDB file that emits light, and only
+		incandescence lights need to be checked when they're wanted.
+	*/
+	unsigned categories =
+		scene_node_index::e_light | scene_node_index::e_geometry;
+	if( i_want_incandescence_lights )
 	{
-		OP_Node *network = traversal.back();
-		traversal.pop_back();
+		categories |= scene_node_index::e_incandescence;
+	}
 
-		assert( network->isNetwork() );
+	std::vector<OBJ_Node *> objects;
+	scene_node_index::get_instance().get_nodes( categories, objects );
 
-		int nkids = network->getNchildren();
-		for( int i=0; i< nkids; i++ )
+	for( OBJ_Node *obj : objects )
+	{
+		/*
+			has_vdb_light_layer() function checks if node is a vdb loader.
+			Also, don't render a phantom vdb as a separate layer.
+		*/
+		if( obj->castToOBJLight() ||
+			(vdb_file_loader::has_vdb_light_layer(obj, time) &&
+				!(ctx && ctx->object_is_phantom(*obj))) )
 		{
-			OP_Node *node = network->getChild(i);
-			OBJ_Node *obj = node->castToOBJNode();
-
-			/*
-				has_vdb_light_layer() function checks if node is a vdb loader.
-				Also, don't render a phantom vdb as a separate layer.
-			*/
-			if( obj &&
-				(obj->castToOBJLight() ||
-					(vdb_file_loader::has_vdb_light_layer(obj, time) &&
-					!ctx->object_is_phantom(*obj))
-					))
-			{
-				if(!i_light_pattern ||
-					i_light_pattern->match(obj, i_rop_path, true))
-				{
-					o_lights.push_back(obj);
-				}
-			}
-
-			if( obj &&
-				i_want_incandescence_lights &&
-				ctx && ctx->object_displayed(*obj) &&
-				obj->getOperator()->getName() ==
-					"3Delight::IncandescenceLight" )
+			if(!i_light_pattern ||
+				i_light_pattern->match(obj, i_rop_path, true))
 			{
 				o_lights.push_back(obj);
 			}
+		}
 
-			if( !node->isNetwork() )
-				continue;
-
-			OP_Network *kidnet = (OP_Network *)node;
-			if( kidnet->getNchildren() )
-			{
-				traversal.push_back( kidnet );
-			}
+		if( i_want_incandescence_lights &&
+			ctx && ctx->object_displayed(*obj) &&
+			obj->getOperator()->getName() ==
+				"3Delight::IncandescenceLight" )
+		{
+			o_lights.push_back(obj);
 		}
 	}
 }
@@ -795,8 +1030,10 @@ void scene::find_lights(
 /*
 	\brief find the "AOVGroup" in the scene.
 
-	This is relly heavy duty as it uses a scene export to find the vops.
-	But it is also robust as we use the same logic as scen export.
+	When exporters are supplied, their VOPs are used, since they come from an
+	actual scene export. Otherwise, only the materials are looked for, which
+	avoids refining all of the scene's geometry. This is what the UI does
+	each time the list of layers is displayed.
 */
 void scene::find_custom_aovs(
 	const context& i_context,
@@ -805,7 +1042,24 @@ void scene::find_custom_aovs(
 {
 	if (i_exporters.empty())
 	{
-		scene::create_exporters(i_context, i_exporters);
+		std::unordered_set<std::string> materials;
+		material_path_cache::get_instance().get_materials(
+			i_context.current_time(), materials);
+
+		VOP_Node *atmosphere = atmosphere_shader( i_context );
+		if( atmosphere )
+			materials.insert( atmosphere->getFullPath().toStdString() );
+
+		std::vector<VOP_Node*> vops;
+		get_material_vops( materials, vops );
+
+		for( VOP_Node *vop_node : vops )
+		{
+			if( vop::is_aov_definition(vop_node) )
+				o_custom_aovs.push_back( vop_node );
+		}
+
+		return;
 	}
 
 	for( auto exporter : i_exporters)
@@ -832,42 +1086,48 @@ static const std::string k_light_category_prefix = ".!@category:";
 void scene::export_light_categories(
 	const context &i_context,
 	exporter *i_exporter,
-	std::set<std::string> &io_exported_lights_categories,
-	std::vector<OBJ_Node*> &io_lights_to_render,
+	light_linking_index &io_index,
 	bool ipr)
 {
 	assert( i_exporter );
 
-	OP_Node *node = i_exporter->node();
-
-	OBJ_Node *i_object = CAST_OBJNODE( node );
-	if( !i_object )
+	OBJ_Node *object = CAST_OBJNODE( i_exporter->node() );
+	if( !object )
 	{
 		return;
 	}
 
+	export_light_categories(
+		i_context, *object, i_exporter->handle(), io_index, ipr );
+}
+
+void scene::export_light_categories(
+	const context &i_context,
+	OBJ_Node &i_object,
+	const std::string &i_handle,
+	light_linking_index &io_index,
+	bool ipr)
+{
 	UT_String categories;
-	int lightcategories_index = i_object->getParmIndex("lightcategories");
+	int lightcategories_index = i_object.getParmIndex("lightcategories");
 	if(lightcategories_index < 0)
 	{
 		// Light linking is not available for this object
 		return;
 	}
 
-	i_object->evalString(categories, lightcategories_index, 0, 0.0f);
+	i_object.evalString(categories, lightcategories_index, 0, 0.0f);
 	if(!categories.c_str())
 	{
 		// Light linking is not available for this object
 		return;
 	}
 
-	UT_TagManager tag_manager;
-	UT_String errors;
-	UT_TagExpressionPtr categories_expr =
-		tag_manager.createExpression(categories, errors);
+	light_linking_index::category &category =
+		io_index.find( categories.toStdString() );
 
 	// Trivial and (hopefully) most common case
-	if(categories_expr->isTautology() && !ipr)
+	if(category.m_tautology && !ipr)
 	{
 		/*
 			The object sees all lights, which is the default, so no connections
@@ -881,18 +1141,9 @@ void scene::export_light_categories(
 	std::string cat_handle = k_light_category_prefix + categories.toStdString();
 	std::string cat_attr_handle = cat_handle + "|attributes";
 
-	auto insertion = io_exported_lights_categories.insert(cat_handle);
-	if(insertion.second)
+	if(!category.m_exported)
 	{
-		// Fill io_lights_to_render lazily since it won't always be needed
-		if(io_lights_to_render.empty())
-		{
-			find_lights(
-				i_context.lights_to_render(),
-				i_context.rop()->getFullPath().c_str(),
-				false,
-				io_lights_to_render);
-		}
+		category.m_exported = true;
 
 		/*
 			This is the first time we use this NSI set, so we have to create it
@@ -903,32 +1154,20 @@ void scene::export_light_categories(
 		nsi.Connect(cat_attr_handle, "", cat_handle, "geometryattributes");
 		nsi.Disconnect(NSI_ALL_NODES, "", cat_handle, "members");
 
-		for(OBJ_Node* light_source : io_lights_to_render)
+		// Add the lights we have to turn off to the set
+		for(OBJ_Node* light_source : category.m_lights_off)
 		{
-			/*
-				Parse the list of categories for the light. This shouldn't be
-				expensive. If it is, we might want to store it in the light
-				exporter and work on a list of those, instead.
-			*/
-			UT_String tags_string;
-			light_source->evalString(tags_string, "categories", 0, 0.0);
-			UT_TagListPtr tags = tag_manager.createList(tags_string, errors);
-
-			// Add the lights we have to turn off to the set
-			if(!tags->match(*categories_expr))
-			{
-				nsi.Connect(
-					light::handle(*light_source, i_context), "",
-					cat_handle, "members");
-			}
+			nsi.Connect(
+				light::handle(*light_source, i_context), "",
+				cat_handle, "members");
 		}
 	}
 
-	std::string attributes_handle( i_exporter->handle() );
+	std::string attributes_handle( i_handle );
 	attributes_handle += "|attributes";
 	nsi.Create( attributes_handle, "attributes");
 	nsi.Connect(
-		attributes_handle, "", i_exporter->handle(), "geometryattributes" );
+		attributes_handle, "", i_handle, "geometryattributes" );
 
 	/*
 		This might be a little unsafe as, in theory, we might be disconnecting
@@ -2,7 +2,9 @@
 
 class context;
 class exporter;
+class light_linking_index;
 class ROP_3Delight;
+class OBJ_Camera;
 class safe_interest;
 class OBJ_Node;
 class OP_Node;
@@ -27,8 +29,59 @@ namespace NSI { class Context; }
 class scene
 {
 public:
+	/// Export priorities of the stages of a time change in IPR
+	enum export_priority
+	{
+		e_camera_priority,
+		e_visible_priority,
+		e_hidden_priority,
+		e_nb_priorities
+	};
+
 	static void convert_to_nsi( const context &, bool i_keep_exporter = false);
 
+	/**
+		\brief Sorts the scene's objects by export priority.
+
+		\param i_camera
+			The render camera, if any. It has the highest priority. Objects in
+			its frustum, and light sources, come next. Objects that can't be
+			seen from the camera come last.
+		\param o_objects
+			Array of e_nb_priorities lists of objects, to be filled.
+	*/
+	static void get_objects_by_priority(
+		const context &i_context,
+		OBJ_Camera* i_camera,
+		std::vector<OBJ_Node*>* o_objects );
+
+	/**
+		\brief Creates the exporters of some objects, and of the materials
+		they need.
+
+		This allows the stages of a time change to be refined and exported one
+		after the other. \ref get_objects_by_priority
+
+		\param i_objects
+			The objects to export.
+		\param io_materials
+			Materials whose exporters have already been created for previous
+			stages, which are skipped. New ones are added.
+		\param o_to_export
+			New exporters will be appended here.
+	*/
+	static void create_exporters(
+		const context &i_context,
+		const std::vector<OBJ_Node*>& i_objects,
+		std::unordered_set<std::string>& io_materials,
+		std::vector<exporter*>& o_to_export );
+
+	/// Runs exporters to export their NSI nodes and attributes
+	static void export_nsi(
+		const context &i_context,
+		const std::vector<exporter*>& i_to_export,
+		bool i_keep_exporter = false);
+
 	static void insert_obj_node(
 		OBJ_Node& i_node,
 		const context& i_context );
@@ -49,6 +102,9 @@ public:
 
 	/**
 		\brief Find the AOV Group nodes that can produce custom AOVs
+
+		When no exporters are supplied, the materials are found without
+		exporting the scene, through material_path_cache.
 	*/
 	static void find_custom_aovs(
 		const context& i_context,
@@ -62,18 +118,28 @@ public:
 
 		\param i_context
 			Current rendering context.
-		\param io_exported_lights_categories
-			A cache for already exporter categories. Could be expended after
-			this call if a new category has been found.
-		\param i_lights_to_render
-			The set of lights to render, to be lazily updated by the function
-			when it's needed and still empty.
+		\param io_index
+			Resolves the lights to turn off for each light categories
+			expression, and remembers which NSI sets have already been
+			exported.
 	*/
 	static void export_light_categories(
 		const context &i_context,
 		exporter *,
-		std::set<std::string> &io_exported_lights_categories,
-		std::vector<OBJ_Node*> &io_lights_to_render,
+		light_linking_index &io_index,
+		bool i_ipr = false);
+
+	/**
+		\brief Same as above, for the NSI node i_handle of object i_object.
+
+		This doesn't require an exporter, which is expensive to create for
+		geometry.
+	*/
+	static void export_light_categories(
+		const context &i_context,
+		OBJ_Node &i_object,
+		const std::string &i_handle,
+		light_linking_index &io_index,
 		bool i_ipr = false);
 
 private:
@@ -94,19 +160,24 @@ private:
 		const context &i_context,
 		std::vector<exporter *> &io_to_export );
 
+	static void deduplicate_shaders(
+		const context &i_context,
+		std::vector<VOP_Node*> &io_vops );
+
 	static void create_atmosphere_shader_exporter(
 		const context& i_context,
 		std::vector<exporter *>& io_to_export );
 
-	static void export_nsi(
-		const context &i_context,
-		const std::vector<exporter*>& i_to_export,
-		bool i_keep_exporter = false);
+	static VOP_Node* atmosphere_shader( const context& i_context );
 
 	static void scan_for_instanced(
 		const context &i_context,
 		std::vector<exporter *> &io_to_export );
 
+	static void cull_to_crop(
+		const context &i_context,
+		std::vector<exporter *> &io_to_export );
+
 	static void process_obj_node(
 		const context &i_context,
 		OBJ_Node *,
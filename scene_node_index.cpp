@@ -0,0 +1,200 @@
+#include "scene_node_index.h"
+
+#include <OBJ/OBJ_Node.h>
+#include <OP/OP_Director.h>
+#include <OP/OP_Operator.h>
+
+#include <algorithm>
+
+namespace
+{
+	const char* k_obj_manager_path = "/obj";
+}
+
+scene_node_index& scene_node_index::get_instance()
+{
+	/* Our only instance */
+	static scene_node_index s_index;
+	return s_index;
+}
+
+void scene_node_index::insert(OP_Node& i_node)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Nodes created before the index is built will be found then
+	if(m_built)
+	{
+		insert_locked(i_node);
+	}
+}
+
+void scene_node_index::remove(OP_Node& i_node)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	int id = i_node.getUniqueId();
+	for(std::set<int>& nodes : m_nodes)
+	{
+		nodes.erase(id);
+	}
+}
+
+void scene_node_index::get_nodes(
+	unsigned i_categories,
+	std::vector<OBJ_Node*>& o_nodes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	build();
+
+	std::vector<int> ids;
+	for(int c = 0; c < e_nb_categories; c++)
+	{
+		if(i_categories & (1 << c))
+		{
+			ids.insert(ids.end(), m_nodes[c].begin(), m_nodes[c].end());
+		}
+	}
+
+	std::sort(ids.begin(), ids.end());
+
+	for(int id : ids)
+	{
+		OP_Node* node = OP_Node::lookupNode(id);
+		OBJ_Node* obj = node ? node->castToOBJNode() : nullptr;
+		if(!obj)
+		{
+			for(std::set<int>& nodes : m_nodes)
+			{
+				nodes.erase(id);
+			}
+			continue;
+		}
+
+		o_nodes.push_back(obj);
+	}
+}
+
+/**
+	This is the traversal that scene scans used to do each time, without
+	recursion. The content of SOP, DOP and TOP networks is not part of the
+	scene.
+*/
+void scene_node_index::build()
+{
+	if(m_built)
+	{
+		return;
+	}
+
+	OP_Node* root = OPgetDirector()->findNode(k_obj_manager_path);
+	if(!root)
+	{
+		return;
+	}
+
+	m_built = true;
+
+	std::vector<OP_Node *> traversal;
+	traversal.push_back(root);
+
+	while( traversal.size() )
+	{
+		OP_Node *current = traversal.back();
+		traversal.pop_back();
+
+		int nkids = current->getNchildren();
+		for( int i=0; i< nkids; i++ )
+		{
+			OP_Node *node = current->getChild(i);
+
+			if( node->castToTOPNode() || node->castToSOPNode() ||
+				node->castToDOPNode()  )
+			{
+				continue;
+			}
+
+			insert_locked(*node);
+
+			traversal.push_back( node );
+		}
+	}
+}
+
+void scene_node_index::insert_locked(OP_Node& i_node)
+{
+	OBJ_Node* obj = i_node.castToOBJNode();
+	if(!obj)
+	{
+		return;
+	}
+
+	// Only keep nodes that build() would have found
+	bool in_scene = false;
+	for(OP_Node* parent = i_node.getParent(); parent; parent = parent->getParent())
+	{
+		if( parent->castToTOPNode() || parent->castToSOPNode() ||
+			parent->castToDOPNode()  )
+		{
+			return;
+		}
+
+		if(parent->getFullPath() == k_obj_manager_path)
+		{
+			in_scene = true;
+			break;
+		}
+	}
+
+	if(!in_scene)
+	{
+		return;
+	}
+
+	category c = get_category(*obj);
+	for(int i = 0; i < e_nb_categories; i++)
+	{
+		if(c == (1 << i))
+		{
+			m_nodes[i].insert(i_node.getUniqueId());
+			break;
+		}
+	}
+}
+
+/**
+	An incandescence light is not an OBJ_Light, and a light is also an
+	OBJ_Camera, so the order of the tests matters.
+*/
+scene_node_index::category scene_node_index::get_category(OBJ_Node& i_node)
+{
+	std::string type = i_node.getOperator()->getName().toStdString();
+
+	if(type == "3Delight::IncandescenceLight")
+	{
+		return e_incandescence;
+	}
+
+	if(i_node.castToOBJLight())
+	{
+		return e_light;
+	}
+
+	if(i_node.castToOBJCamera())
+	{
+		return e_camera;
+	}
+
+	if(type == "instance")
+	{
+		return e_instancer;
+	}
+
+	if(i_node.castToOBJGeometry() && !(i_node.getObjectType() & OBJ_NULL))
+	{
+		return e_geometry;
+	}
+
+	return e_other;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+class OBJ_Node;
+class OP_Node;
+
+/**
+	\brief An index of the OBJ nodes that can be rendered, by category.
+
+	Scanning the scene for objects or lights used to require a traversal of
+	the whole /obj hierarchy each time. Instead, this index is built once, on
+	first use, and then kept up to date by creation_callbacks, which watch the
+	creation and deletion of OBJ nodes.
+
+	Nodes are identified by their unique ID, which doesn't change when they
+	are renamed. Houdini never moves nodes to another network : they're
+	deleted and created again instead. Nodes whose deletion went unnoticed are
+	simply removed when the index is queried.
+*/
+class scene_node_index
+{
+public:
+
+	/// Categories of OBJ nodes, which can be combined into a mask
+	enum category
+	{
+		e_geometry = 1 << 0,
+		e_light = 1 << 1,
+		e_camera = 1 << 2,
+		e_incandescence = 1 << 3,
+		e_instancer = 1 << 4,
+		e_other = 1 << 5,
+		e_all = (1 << 6) - 1,
+		e_nb_categories = 6
+	};
+
+	static scene_node_index& get_instance();
+
+	/// Adds a newly created node to the index
+	void insert(OP_Node& i_node);
+
+	/// Removes a node that's being deleted
+	void remove(OP_Node& i_node);
+
+	/**
+		\brief Retrieves the nodes of some categories, in creation order.
+
+		\param i_categories
+			A combination of category flags.
+		\param o_nodes
+			The nodes, appended to the list.
+	*/
+	void get_nodes(unsigned i_categories, std::vector<OBJ_Node*>& o_nodes);
+
+private:
+
+	scene_node_index() = default;
+
+	/// Finds all nodes already in the scene, if not done yet
+	void build();
+
+	/// Adds a node, assuming m_mutex is locked
+	void insert_locked(OP_Node& i_node);
+
+	/// Returns the category of an OBJ node
+	static category get_category(OBJ_Node& i_node);
+
+	/**
+		Unique IDs of the nodes of each category, ordered by ID (ie : by
+		creation order).
+	*/
+	std::set<int> m_nodes[e_nb_categories];
+
+	bool m_built{false};
+	std::mutex m_mutex;
+};
@@ -1,19 +1,37 @@
 #include "shader_library.h"
 #include "dl_system.h"
 #include "osl_utilities.h"
+#include "texture_cache.h"
 #include "delight.h"
 
 
 #include "VOP_ExternalOSL.h"
 
+#include <FS/FS_Info.h>
 #include <UT/UT_UI.h>
 #include <VOP/VOP_Operator.h>
 
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <thread>
 #include <vector>
 #include <functional>
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#	include <process.h>
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#	define getpid _getpid
+#else
+#	include <unistd.h>
+#endif
 
 
 using namespace dl_system;
@@ -80,6 +98,30 @@ DlShaderInfo *shader_library::get_shader_info( VOP_Node *i_node ) const
 }
 
 DlShaderInfo *shader_library::get_shader_info( const char *path ) const
+{
+	const shader_parameters *shader = get_shader_parameters( path );
+	return shader ? shader->m_info : nullptr;
+}
+
+const shader_library::shader_parameters *
+shader_library::get_shader_parameters( VOP_Node *i_node ) const
+{
+	OP_Operator* op = i_node->getOperator();
+	std::string path = get_shader_path( op->getName().c_str() );
+	return get_shader_parameters( path.c_str() );
+}
+
+/**
+	DlGetShaderInfo parses the whole .oso file, so we keep its result around,
+	keyed on the shader path. The file's modification time is checked on each
+	call in order to pick up recompiled shaders.
+
+	Note that entries are never modified or removed once created, so returned
+	pointers remain valid for the whole session, even after the shader is
+	recompiled.
+*/
+const shader_library::shader_parameters *
+shader_library::get_shader_parameters( const char *i_path ) const
 {
 	if( !m_shader_info_ptr )
 	{
@@ -87,7 +129,73 @@ DlShaderInfo *shader_library::get_shader_info( const char *path ) const
 		return nullptr;
 	}
 
-	return m_shader_info_ptr( path );
+	if( !i_path || !i_path[0] )
+	{
+		return nullptr;
+	}
+
+	long long mtime = (long long)FS_Info(i_path).getModTime();
+
+	std::lock_guard<std::mutex> lock( m_cache_mutex );
+
+	cached_shader &cached = m_cache[i_path];
+	if( cached.m_parameters.empty() || cached.m_mtime != mtime )
+	{
+		std::unique_ptr<shader_parameters> parameters( new shader_parameters );
+		parameters->m_info = m_shader_info_ptr( i_path );
+		index_parameters( *parameters );
+
+		cached.m_mtime = mtime;
+		cached.m_parameters.push_back( std::move(parameters) );
+	}
+
+	const shader_parameters *current = cached.m_parameters.back().get();
+	return current->m_info ? current : nullptr;
+}
+
+void shader_library::index_parameters( shader_parameters &io_shader )
+{
+	io_shader.m_parameters.clear();
+	io_shader.m_slots.clear();
+
+	if( !io_shader.m_info )
+	{
+		return;
+	}
+
+	unsigned nparams = io_shader.m_info->nparams();
+	io_shader.m_parameters.resize( nparams );
+	for( unsigned p = 0; p < nparams; p++ )
+	{
+		const DlShaderInfo::Parameter *param = io_shader.m_info->getparam(p);
+		parameter_info &info = io_shader.m_parameters[p];
+
+		info.m_parameter = param;
+		info.m_slot = p;
+		info.m_type = param->type;
+		info.m_isoutput = param->isoutput;
+
+		const char* related_to_widget = nullptr;
+		osl_utilities::FindMetaData(
+			related_to_widget, param->metadata, "related_to_widget");
+		info.m_related_to_widget = related_to_widget != nullptr;
+
+		const char* widget = "";
+		osl_utilities::FindMetaData(widget, param->metadata, "widget");
+		info.m_ramp = osl_utilities::ramp::IsRampWidget(widget);
+
+		info.m_texture = texture_cache::is_texture_parameter(*param);
+
+		const char* default_connection = nullptr;
+		osl_utilities::FindMetaData(
+			default_connection, param->metadata, "default_connection");
+		info.m_uv_coordinates =
+			param->type.arraylen == 2 &&
+			default_connection &&
+			::strcmp("uvCoord", default_connection) == 0;
+
+		io_shader.m_slots[param->name.c_str()] = p;
+	}
 }
 
 /**
@@ -176,14 +284,33 @@ void tokenize_path( const char *osl_path, std::vector<std::string> &o_paths )
 
 void shader_library::find_all_shaders( const char *i_root)
 {
+	std::string root(i_root);
+	std::string plugin_osl = root + "/osl/";
+
+	std::vector<std::string> to_scan;
+	const char *user_osos = get_env("_3DELIGHT_USER_OSO_PATH");
+	tokenize_path(user_osos, to_scan);
+
+	std::string installation_path = m_plugin_path + "/../osl";
+
 	/*
-		Start by sorting out all the shaders in the installation into
-		categgorries.
+		Querying every shader of the installation is slow, so try to re-use the
+		results of a previous session first.
 	*/
+	std::vector<std::string> dirs(1, plugin_osl);
+	dirs.insert(dirs.end(), to_scan.begin(), to_scan.end());
+	dirs.push_back(installation_path);
+	std::string key = cache_key(dirs);
 
-	std::string root(i_root);
+	if( load_cache(key) )
+	{
+		return;
+	}
 
-	std::string plugin_osl = root + "/osl/";
+	/*
+		Start by sorting out all the shaders in the installation into
+		categgorries.
+	*/
 	std::unordered_map<std::string, std::string> all_shaders;
 	scan_dir( plugin_osl, all_shaders );
 
@@ -255,10 +382,6 @@ void shader_library::find_all_shaders( const char *i_root)
 	}
 
 	/* Add user specified shaders */
-	std::vector<std::string> to_scan;
-	const char *user_osos = get_env("_3DELIGHT_USER_OSO_PATH");
-	tokenize_path(user_osos, to_scan);
-
 	m_shaders.emplace_back("3Delight/Add-Ons");
 	for (auto &path : to_scan)
 	{
@@ -270,9 +393,11 @@ void shader_library::find_all_shaders( const char *i_root)
 		the menu.
 	*/
 	m_shaders.emplace_back("");
-	std::string installation_path = m_plugin_path + "/../osl";
 	scan_dir( installation_path, m_shaders.back().m_osos );
 
+	describe_shaders();
+	save_cache(key);
+
 #ifndef NDEBUG
 	if(UTisUIAvailable())
 	{
@@ -286,8 +411,11 @@ void shader_library::find_all_shaders( const char *i_root)
 #endif
 }
 
-/// Registers one VOP for each .oso file found in the shaders path
-void shader_library::Register(OP_OperatorTable* io_table)const
+/**
+	Retrieves what's needed to register an operator for each shader that goes
+	into a menu.
+*/
+void shader_library::describe_shaders()
 {
 	for(const ShadersGroup& g : m_shaders)
 	{
@@ -304,14 +432,266 @@ void shader_library::Register(OP_OperatorTable* io_table)const
 #ifdef NDEBUG
 				std::cerr
 					<< "3Delight for Houdini: unable to load " << g.m_menu
-					<< " shader " << oso.first;
+					<< " shader " << oso.first << std::endl;
 #endif
 				continue;
 			}
 
+			StructuredShaderInfo structured(info);
+
+			shader_description &description = m_descriptions[oso.second];
+			description.m_path = oso.second;
+			description.m_name = info->shadername().string();
+			description.m_num_inputs = structured.NumInputs();
+			description.m_num_outputs = structured.NumOutputs();
+			description.m_terminal = structured.IsTerminal();
+
+			const char* name = description.m_name.c_str();
+			osl_utilities::FindMetaData(name, info->metadata(), "niceName");
+			description.m_nice_name = name;
+		}
+	}
+}
+
+std::string shader_library::cache_key(
+	const std::vector<std::string> &i_dirs )
+{
+	const char* (*get_dl_version)() = nullptr;
+	m_api.LoadFunction(get_dl_version, "DlGetLibNameAndVersionString");
+
+	std::string key = get_dl_version ? get_dl_version() : "unknown";
+	for( const std::string &dir : i_dirs )
+	{
+		key += "\t" + dir + "\t" +
+			std::to_string( (long long)FS_Info(dir.c_str()).getModTime() );
+
+		/*
+			A shader recompiled in place doesn't change its directory's time,
+			so each file's time and size are part of the key as well. Files
+			are sorted so the key doesn't depend on the directory's order.
+		*/
+		std::unordered_map<std::string, std::string> files;
+		scan_dir( dir, files );
+		std::map<std::string, std::string> sorted( files.begin(), files.end() );
+		for( const auto &file : sorted )
+		{
+			FS_Info info( file.second.c_str() );
+			key += "\t" + file.first + "\t" +
+				std::to_string( (long long)info.getModTime() ) + "\t" +
+				std::to_string( (long long)info.getFileDataSize() );
+		}
+	}
+
+	return key;
+}
+
+namespace
+{
+	const char* k_cache_header = "3Delight for Houdini shaders cache 1";
+
+	/**
+		Returns the shaders cache file name, or an empty string if the cache is
+		disabled. It's per-user since it depends on _3DELIGHT_USER_OSO_PATH.
+	*/
+	std::string shaders_cache_file()
+	{
+		const char* file = get_env("_3DELIGHT_SHADER_CACHE");
+		if( file )
+		{
+			return std::string(file) == "0" ? std::string() : file;
+		}
+
+		const char* pref_dir = get_env("HOUDINI_USER_PREF_DIR");
+		if( !pref_dir || !pref_dir[0] )
+		{
+			return {};
+		}
+
+		return std::string(pref_dir) + "/3delight_shaders.cache";
+	}
+
+	/// Splits a line of the cache file into its tab-separated fields
+	std::vector<std::string> split_fields( const std::string &i_line )
+	{
+		std::vector<std::string> fields;
+		size_t start = 0;
+		size_t tab;
+		while( (tab = i_line.find('\t', start)) != std::string::npos )
+		{
+			fields.push_back( i_line.substr(start, tab-start) );
+			start = tab+1;
+		}
+		fields.push_back( i_line.substr(start) );
+		return fields;
+	}
+
+	/// Parses an unsigned number, returning false if it's not valid
+	bool parse_unsigned( const std::string &i_field, unsigned &o_value )
+	{
+		if( i_field.empty() || i_field[0] < '0' || i_field[0] > '9' )
+			return false;
+
+		char *end = nullptr;
+		unsigned long value = ::strtoul( i_field.c_str(), &end, 10 );
+		if( *end != '\0' || value > 0xffffffffu )
+			return false;
+
+		o_value = unsigned(value);
+		return true;
+	}
+
+	/// Renames a file, replacing the destination if it exists
+	bool replace_file( const std::string &i_from, const std::string &i_to )
+	{
+#ifdef _WIN32
+		return ::MoveFileExA(
+			i_from.c_str(), i_to.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+		return ::rename( i_from.c_str(), i_to.c_str() ) == 0;
+#endif
+	}
+}
+
+bool shader_library::load_cache( const std::string &i_key )
+{
+	std::string file_name = shaders_cache_file();
+	if( file_name.empty() )
+	{
+		return false;
+	}
+
+	std::ifstream file( file_name.c_str() );
+	std::string line;
+	if( !std::getline(file, line) || line != k_cache_header ||
+		!std::getline(file, line) || line != i_key )
+	{
+		return false;
+	}
+
+	std::vector<ShadersGroup> shaders;
+	std::unordered_map<std::string, shader_description> descriptions;
+
+	while( std::getline(file, line) )
+	{
+		std::vector<std::string> fields = split_fields( line );
+
+		if( fields[0] == "group" && fields.size() == 2 )
+		{
+			shaders.emplace_back( fields[1] );
+		}
+		else if( fields[0] == "shader" && fields.size() == 3 &&
+			!shaders.empty() )
+		{
+			shaders.back().m_osos[fields[1]] = fields[2];
+		}
+		else if( fields[0] == "description" && fields.size() == 7 )
+		{
+			shader_description &description = descriptions[fields[1]];
+			description.m_path = fields[1];
+			description.m_name = fields[2];
+			description.m_nice_name = fields[3];
+			description.m_terminal = fields[6] == "1";
+
+			if( !parse_unsigned(fields[4], description.m_num_inputs) ||
+				!parse_unsigned(fields[5], description.m_num_outputs) )
+			{
+				/* Corrupted file, rebuild it. */
+				return false;
+			}
+		}
+		else
+		{
+			/* Corrupted file, rebuild it. */
+			return false;
+		}
+	}
+
+	m_shaders.swap( shaders );
+	m_descriptions.swap( descriptions );
+
+	return true;
+}
+
+/**
+	The file is written under a name unique to this process and thread, then
+	renamed over the previous cache, so concurrent Houdini sessions never read
+	a partial cache and always find one.
+*/
+void shader_library::save_cache( const std::string &i_key ) const
+{
+	std::string file_name = shaders_cache_file();
+	if( file_name.empty() ||
+		!dl_system::create_directory_for_file(file_name) )
+	{
+		return;
+	}
+
+	std::string temp_name =
+		file_name + "." + std::to_string(getpid()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream file( temp_name.c_str() );
+		if( !file )
+		{
+			return;
+		}
+
+		file << k_cache_header << "\n" << i_key << "\n";
+
+		for( const ShadersGroup &g : m_shaders )
+		{
+			file << "group\t" << g.m_menu << "\n";
+			for( const auto &oso : g.m_osos )
+			{
+				file << "shader\t" << oso.first << "\t" << oso.second << "\n";
+			}
+		}
+
+		for( const auto &d : m_descriptions )
+		{
+			const shader_description &description = d.second;
+			file
+				<< "description\t" << description.m_path
+				<< "\t" << description.m_name
+				<< "\t" << description.m_nice_name
+				<< "\t" << description.m_num_inputs
+				<< "\t" << description.m_num_outputs
+				<< "\t" << (description.m_terminal ? 1 : 0) << "\n";
+		}
+	}
+
+	if( !replace_file(temp_name, file_name) )
+	{
+		::remove( temp_name.c_str() );
+	}
+}
+
+/**
+	Registers one VOP for each .oso file found in the shaders path.
+
+	Shaders are not loaded here : operators are registered using the shaders'
+	summaries and their parameter templates are built on first use.
+*/
+void shader_library::Register(OP_OperatorTable* io_table)const
+{
+	for(const ShadersGroup& g : m_shaders)
+	{
+		if(g.m_menu.empty())
+		{
+			continue;
+		}
+
+		for( auto &oso : g.m_osos )
+		{
+			auto description = m_descriptions.find( oso.second );
+			if( description == m_descriptions.end() )
+			{
+				continue;
+			}
+
 			io_table->addOperator(
 				new VOP_ExternalOSLOperator(
-						StructuredShaderInfo(info),
+						description->second,
 						g.m_menu));
 		}
 	}
@@ -3,8 +3,11 @@
 #include <nsi_dynamic.hpp>
 #include <3Delight/ShaderQuery.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class OP_OperatorTable;
 class VOP_Node;
@@ -20,11 +23,80 @@ public:
 	static const shader_library &get_instance( void );
 	shader_library();
 
+	/// Pre-computed information about a single shader parameter
+	struct parameter_info
+	{
+		/// The parameter's description, at index m_slot in its DlShaderInfo
+		const DlShaderInfo::Parameter *m_parameter{nullptr};
+		unsigned m_slot{0};
+		DlShaderInfo::TypeDesc m_type;
+		bool m_isoutput{false};
+		/// Auxiliary parameter, exported as part of another one
+		bool m_related_to_widget{false};
+		/// Main parameter of a ramp widget
+		bool m_ramp{false};
+		/// String parameter containing a texture file name
+		bool m_texture{false};
+		/// float[2] that defaults to a connection to the uv coordinates
+		bool m_uv_coordinates{false};
+	};
+
+	/**
+		\brief A shader's description along with an index of its parameters.
+
+		It's computed once per shader file (and file modification) so that
+		exporters don't have to re-parse the shader or linearly search its
+		parameters and their meta-data.
+	*/
+	struct shader_parameters
+	{
+		DlShaderInfo *m_info{nullptr};
+		/// Parameters in the same order as DlShaderInfo::getparam
+		std::vector<parameter_info> m_parameters;
+		/// Parameter name to index in m_parameters
+		std::unordered_map<std::string, unsigned> m_slots;
+
+		/// Returns the parameter named i_name, or nullptr
+		const parameter_info *find( const char *i_name ) const
+		{
+			auto it = m_slots.find( i_name );
+			return it == m_slots.end() ? nullptr : &m_parameters[it->second];
+		}
+	};
+
 public:
 	std::string get_shader_path( const char *i_vop_name ) const;
 	DlShaderInfo *get_shader_info( VOP_Node *i_node ) const;
 	DlShaderInfo *get_shader_info( const char *i_path ) const;
 
+	/**
+		\brief Returns the description and parameters index of a shader.
+
+		Results are cached, so this is cheap to call repeatedly, from any
+		thread. The shader is queried again if its file has been modified.
+
+		\returns nullptr if the shader could not be loaded.
+	*/
+	const shader_parameters *get_shader_parameters( VOP_Node *i_node ) const;
+	const shader_parameters *get_shader_parameters( const char *i_path ) const;
+
+	/**
+		\brief Summary of a shader, sufficient to register its operator.
+
+		The full shader description (and the operator's parameter templates)
+		are only retrieved once a node of this type is created.
+	*/
+	struct shader_description
+	{
+		std::string m_path;
+		std::string m_name;
+		/// "niceName" meta-data, or the shader's name if it has none
+		std::string m_nice_name;
+		unsigned m_num_inputs{0};
+		unsigned m_num_outputs{0};
+		bool m_terminal{false};
+	};
+
 	void Register( OP_OperatorTable* io_table) const;
 
 	/**
@@ -43,6 +115,27 @@ public:
 private:
 	void find_all_shaders( const char *installation_root );
 
+	/// Fills the parameters index of io_shader from its m_info
+	static void index_parameters( shader_parameters &io_shader );
+
+	/// Fills m_descriptions with the shaders of all groups that have a menu
+	void describe_shaders();
+
+	/**
+		\brief Returns a string identifying the state of the scanned shaders.
+
+		It's made of the 3Delight version and the modification time of each
+		scanned directory and of each file they contain, along with its size,
+		so any added, removed or recompiled shaders (or a different 3Delight
+		installation) invalidates the shaders cache.
+	*/
+	std::string cache_key( const std::vector<std::string> &i_dirs );
+
+	/// Reads m_shaders and m_descriptions from the cache file, if still valid.
+	bool load_cache( const std::string &i_key );
+	/// Writes m_shaders and m_descriptions to the cache file.
+	void save_cache( const std::string &i_key ) const;
+
 public:
 	std::string m_plugin_path;
 
@@ -65,4 +158,25 @@ public:
 	};
 
 	std::vector<ShadersGroup> m_shaders;
+
+	/// Shader path to shader summary lookup table (for registered shaders)
+	std::unordered_map<std::string, shader_description> m_descriptions;
+
+private:
+	/**
+		A cached shader description and the time of its file when queried.
+		Descriptions are never modified once cached, since other threads could
+		be using them. A new one is added when the file changes, but the
+		previous ones are kept so that the pointers returned remain valid.
+	*/
+	struct cached_shader
+	{
+		long long m_mtime{0};
+		/// All descriptions of the shader, the last one being current
+		std::vector<std::unique_ptr<shader_parameters>> m_parameters;
+	};
+
+	/// Shader path to shader description lookup table
+	mutable std::unordered_map<std::string, cached_shader> m_cache;
+	mutable std::mutex m_cache_mutex;
 };
@@ -0,0 +1,241 @@
+#include "standin.h"
+
+#include "context.h"
+#include "dl_system.h"
+
+#include <GA/GA_Stat.h>
+#include <GT/GT_GEOPrimPacked.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_PrimPacked.h>
+#include <UT/UT_BoundingBox.h>
+#include <UT/UT_String.h>
+
+#include <nsi.hpp>
+
+namespace
+{
+	const char* k_packed_disk = "PackedDisk";
+	const char* k_standin_extension = ".nsi";
+	/* Same prefix as the files referred to by instancers' "instancefile" */
+	const char* k_procedural_prefix = "__file:";
+
+	/// Returns the packed primitive refined into i_primitive, if any
+	const GU_PrimPacked* packed_primitive(const GT_Primitive& i_primitive)
+	{
+		if(i_primitive.getPrimitiveType() != GT_GEO_PACKED)
+		{
+			return nullptr;
+		}
+
+		return static_cast<const GT_GEOPrimPacked&>(i_primitive).getPrim();
+	}
+
+	/// Returns the file of a packed disk primitive, or an empty string
+	std::string geometry_file(const GU_PrimPacked* i_packed)
+	{
+		if(!i_packed || i_packed->getTypeName() != k_packed_disk)
+		{
+			return {};
+		}
+
+		UT_String file;
+		i_packed->getIntrinsic(i_packed->findIntrinsic("filename"), file);
+		return file.isstring() ? file.toStdString() : std::string();
+	}
+
+	/**
+		\brief Reads the bounds of a geometry file without loading it.
+
+		Houdini's geometry files store their bounds in their header, which is
+		all that's read by statFile. Other formats, such as Alembic, might have
+		to be loaded entirely to be stat'ed, so they're not.
+	*/
+	bool geometry_file_bounds(const std::string& i_file, UT_BoundingBox& o_bounds)
+	{
+		if(i_file.find(".bgeo") == std::string::npos &&
+			i_file.find(".geo") == std::string::npos)
+		{
+			return false;
+		}
+
+		GA_Stat stat;
+		if(!GU_Detail::statFile(i_file.c_str(), stat, GA_STAT_BRIEF))
+		{
+			return false;
+		}
+
+		o_bounds = stat.getBounds();
+		return o_bounds.isValid();
+	}
+}
+
+standin::standin(
+	const context& i_context,
+	OBJ_Node* i_object,
+	double i_time,
+	const GT_PrimitiveHandle& i_gt_primitive,
+	unsigned i_primitive_index,
+	const std::string& i_standin_file )
+	:	primitive(
+			i_context,
+			i_object,
+			i_time,
+			i_gt_primitive,
+			i_primitive_index ),
+		m_standin_file(i_standin_file)
+{
+}
+
+/**
+	The procedural itself is shared, so we create a transform for the packed
+	primitive, which is connected to its parent by primitive::connect.
+*/
+void standin::create()const
+{
+	m_nsi.Create(m_handle, "transform");
+
+	/*
+		The packed primitive's own bounds aren't used, since computing them
+		would load the whole geometry file, which is what stand-ins avoid.
+	*/
+	const GU_PrimPacked* packed = packed_primitive(*default_gt_primitive());
+	assert(packed);
+
+	export_procedural(m_context, m_standin_file, geometry_file(packed));
+}
+
+void standin::connect()const
+{
+	primitive::connect();
+
+	/*
+		The connection's strength keeps the shared procedural alive when the
+		geometry of one of the objects using it is deleted recursively.
+	*/
+	m_nsi.Connect(
+		k_procedural_prefix + m_standin_file, "",
+		m_handle, "objects",
+		NSI::IntegerArg("strength", 1));
+}
+
+void standin::set_attributes_at_time(
+	double i_time,
+	const GT_PrimitiveHandle i_gt_primitive)const
+{
+	const GU_PrimPacked* packed = packed_primitive(*i_gt_primitive);
+	if(!packed || m_instanced)
+	{
+		// Instances are placed by the instancer's own transforms
+		return;
+	}
+
+	/*
+		primitive::connect already applies the GT primitive's transform, which
+		might or might not include the packed primitive's own transform.
+	*/
+	UT_Matrix4D gt_transform;
+	i_gt_primitive->getPrimitiveTransform()->getMatrix(gt_transform);
+	gt_transform.invert();
+
+	UT_Matrix4D transform;
+	packed->getFullTransform4(transform);
+	transform = transform * gt_transform;
+
+	m_nsi.SetAttributeAtTime(
+		m_handle,
+		i_time,
+		NSI::DoubleMatrixArg("transformationmatrix", transform.data()));
+}
+
+std::string standin::get_file(
+	const context& i_context,
+	const GT_Primitive& i_primitive)
+{
+	std::string file = geometry_file(packed_primitive(i_primitive));
+	if(file.empty())
+	{
+		return {};
+	}
+
+	return find(i_context, file);
+}
+
+std::string standin::find(
+	const context& i_context,
+	const std::string& i_file)
+{
+	auto known = i_context.m_standin_files.find(i_file);
+	if(known != i_context.m_standin_files.end())
+	{
+		return known->second;
+	}
+
+	std::string standin_file = i_file + k_standin_extension;
+	if(!dl_system::file_exists(standin_file.c_str()))
+	{
+		standin_file.clear();
+	}
+
+	i_context.m_standin_files[i_file] = standin_file;
+	return standin_file;
+}
+
+/**
+	The procedural can be exported first for an NSI file that has no known
+	geometry file, so the bounds are added when it's used again with one. The
+	geometry file's bounds are only read once per NSI context.
+*/
+std::string standin::export_procedural(
+	const context& i_context,
+	const std::string& i_nsi_file,
+	const std::string& i_geometry_file)
+{
+	std::string handle = k_procedural_prefix + i_nsi_file;
+
+	auto exported = i_context.m_exported_standins.find(handle);
+	if(exported != i_context.m_exported_standins.end() &&
+		(exported->second || i_geometry_file.empty()))
+	{
+		return handle;
+	}
+
+	UT_BoundingBox bounds;
+	bool has_bounds =
+		!i_geometry_file.empty() &&
+		geometry_file_bounds(i_geometry_file, bounds);
+	if(exported != i_context.m_exported_standins.end() && !has_bounds)
+	{
+		return handle;
+	}
+
+	NSI::ArgumentList args;
+	if(exported == i_context.m_exported_standins.end())
+	{
+		args.Add(new NSI::CStringPArg("type", "apistream"));
+		args.Add(new NSI::StringArg("filename", i_nsi_file));
+		i_context.m_nsi.Create(handle, "procedural");
+	}
+
+	if(has_bounds)
+	{
+		float box[6] =
+		{
+			float(bounds.xmin()), float(bounds.ymin()), float(bounds.zmin()),
+			float(bounds.xmax()), float(bounds.ymax()), float(bounds.zmax())
+		};
+
+		args.Add(
+			NSI::Argument::New("boundingbox")
+				->SetArrayType(NSITypePoint, 2)
+				->CopyValue(box, sizeof(box)));
+	}
+
+	i_context.m_nsi.SetAttribute(handle, args);
+	/*
+		A file without readable bounds won't have them next time either, so
+		don't try again.
+	*/
+	i_context.m_exported_standins[handle] = !i_geometry_file.empty();
+
+	return handle;
+}
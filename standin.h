@@ -0,0 +1,86 @@
+#pragma once
+
+#include "primitive.h"
+
+#include <string>
+
+/**
+	\brief Exports a packed disk primitive as an NSI procedural that loads a
+	stand-in of its geometry file.
+
+	A stand-in is an NSI file with the same name as the geometry file, plus an
+	additional ".nsi" extension (eg : "tree.bgeo.sc.nsi" for "tree.bgeo.sc").
+	When one exists, the packed primitive is not refined, so Houdini never
+	loads its geometry during export. The procedural node is exported only
+	once per file and is shared by all primitives referring to it. Since it
+	has a bounding box, 3Delight only loads it when it's actually needed.
+
+	Packed disk primitives without a stand-in are refined as usual. Stand-ins
+	are not written during export : they have to be written beforehand, for
+	instance by loading the geometry file in a File SOP and rendering it with
+	a "3Delight Standin" ROP.
+
+	The bounding box comes from the geometry file's header (for .bgeo files),
+	which is read without loading the file. Other files, such as .abc, give no
+	bounding box, so 3Delight loads their stand-in when rendering starts.
+*/
+class standin : public primitive
+{
+public:
+	standin(
+		const context& i_context,
+		OBJ_Node* i_object,
+		double i_time,
+		const GT_PrimitiveHandle& i_gt_primitive,
+		unsigned i_primitive_index,
+		const std::string& i_standin_file );
+
+	void create()const override;
+	void connect()const override;
+
+	/**
+		\brief Returns the stand-in file of a GT primitive.
+
+		An empty string is returned if i_primitive is not a packed disk
+		primitive, or if its file has no stand-in.
+	*/
+	static std::string get_file(
+		const context& i_context,
+		const GT_Primitive& i_primitive);
+
+	/**
+		\brief Returns the stand-in of a geometry file, or an empty string if
+		there is none.
+
+		The file system is only checked once per file and per NSI context.
+	*/
+	static std::string find(
+		const context& i_context,
+		const std::string& i_file);
+
+	/**
+		\brief Exports the procedural node that loads an NSI file, if not
+		already done in the current NSI context, and returns its handle.
+
+		\param i_geometry_file
+			The geometry file of which i_nsi_file is a stand-in, if any. Its
+			bounds are set on the procedural, when they can be read cheaply,
+			even if it has already been exported without them.
+	*/
+	static std::string export_procedural(
+		const context& i_context,
+		const std::string& i_nsi_file,
+		const std::string& i_geometry_file = std::string());
+
+protected:
+
+	/// Exports the packed primitive's transform
+	void set_attributes_at_time(
+		double i_time,
+		const GT_PrimitiveHandle i_gt_primitive)const override;
+
+private:
+
+	/// The NSI file loaded by the procedural
+	std::string m_standin_file;
+};
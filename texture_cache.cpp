@@ -0,0 +1,646 @@
+#include "texture_cache.h"
+
+#include "context.h"
+#include "dl_system.h"
+#include "shader_library.h"
+#include "delight.h"
+
+#include <FS/FS_Info.h>
+#include <OP/OP_Node.h>
+#include <UT/UT_String.h>
+#include <VOP/VOP_Node.h>
+
+#include <nsi_dynamic.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#	include <process.h>
+#	define getpid _getpid
+#else
+#	include <errno.h>
+#	include <spawn.h>
+#	include <sys/stat.h>
+#	include <sys/wait.h>
+#	include <unistd.h>
+extern char **environ;
+#endif
+
+namespace
+{
+	const char* k_cache_env = "_3DELIGHT_TEXTURE_CACHE";
+	const char* k_threads_env = "_3DELIGHT_TEXTURE_CACHE_THREADS";
+	const char* k_default_directory = "3delight_texture_cache";
+	const char* k_index_file = "index.txt";
+	const char* k_index_header = "3Delight for Houdini texture cache index 1";
+
+	/// Initial value of a 64 bits FNV-1a hash
+	const uint64_t k_fnv_offset = 14695981039346656037ull;
+
+	/// Continues a 64 bits FNV-1a hash with some data
+	uint64_t fnv1a( uint64_t i_hash, const char *i_data, size_t i_size )
+	{
+		for( size_t i = 0; i < i_size; i++ )
+		{
+			i_hash ^= (unsigned char)i_data[i];
+			i_hash *= 1099511628211ull;
+		}
+		return i_hash;
+	}
+
+	/// Returns a hash as an hexadecimal string
+	std::string to_hex( uint64_t i_hash )
+	{
+		char hex[17];
+		snprintf( hex, sizeof(hex), "%016llx", (unsigned long long)i_hash );
+		return hex;
+	}
+
+	/**
+		\brief Lets the members of the file's group write to it as well.
+
+		New files in a directory also get its group. This silently fails when
+		the file belongs to another user, who is then the one to decide.
+	*/
+	void make_group_writable( const std::string &i_path, bool i_directory )
+	{
+#ifndef _WIN32
+		mode_t mode =
+			i_directory
+			?	S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH | S_ISGID
+			:	S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+		::chmod( i_path.c_str(), mode );
+#endif
+	}
+
+	/**
+		\brief Returns the color space of a VOP's textures, as exported by
+		vop::list_shader_parameters.
+	*/
+	std::string texture_colorspace( VOP_Node &i_vop, fpreal i_time )
+	{
+		const char* parameters[] = { "srccolorspace", "texcolorspace" };
+		for( const char* parameter : parameters )
+		{
+			if( i_vop.getParmIndex(parameter) >= 0 )
+			{
+				UT_String colorspace;
+				i_vop.evalString( colorspace, parameter, 0, i_time );
+				return colorspace.toStdString();
+			}
+		}
+
+		return {};
+	}
+
+	/// Splits a line of the index file into its tab-separated fields
+	std::vector<std::string> split_fields( const std::string &i_line )
+	{
+		std::vector<std::string> fields;
+		size_t start = 0;
+		while( true )
+		{
+			size_t tab = i_line.find( '\t', start );
+			fields.push_back( i_line.substr(start, tab - start) );
+			if( tab == std::string::npos )
+				return fields;
+			start = tab + 1;
+		}
+	}
+
+	/// Returns the system's temporary directory
+	std::string temp_directory()
+	{
+		const char* vars[] = { "TMPDIR", "TEMP", "TMP" };
+		for( const char* var : vars )
+		{
+			const char* dir = dl_system::get_env( var );
+			if( dir && dir[0] )
+				return dir;
+		}
+
+#ifdef _WIN32
+		return "C:/Temp";
+#else
+		return "/tmp";
+#endif
+	}
+
+	/**
+		\brief Runs a program and waits for it to finish.
+
+		No shell is involved, so file names are never interpreted, whatever
+		characters they contain.
+
+		\returns the program's exit status, or -1 if it couldn't be run.
+	*/
+	int run_program( const std::vector<std::string> &i_args )
+	{
+#ifdef _WIN32
+		/*
+			_spawnv joins the arguments into a single command line, so each one
+			is quoted to preserve spaces. Quotes can't appear in file names.
+		*/
+		std::vector<std::string> quoted;
+		for( const std::string &arg : i_args )
+			quoted.push_back( "\"" + arg + "\"" );
+
+		std::vector<const char*> argv;
+		for( const std::string &arg : quoted )
+			argv.push_back( arg.c_str() );
+		argv.push_back( nullptr );
+
+		return (int)_spawnv( _P_WAIT, i_args[0].c_str(), &argv[0] );
+#else
+		std::vector<char*> argv;
+		for( const std::string &arg : i_args )
+			argv.push_back( const_cast<char*>(arg.c_str()) );
+		argv.push_back( nullptr );
+
+		pid_t pid;
+		if( posix_spawn(&pid, argv[0], nullptr, nullptr, &argv[0], environ) != 0 )
+			return -1;
+
+		int status = 0;
+		while( waitpid(pid, &status, 0) < 0 )
+		{
+			if( errno != EINTR )
+				return -1;
+		}
+
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+	}
+}
+
+/**
+	Initializes the cache directory and locates tdlmake from the 3Delight
+	installation. Pre-conversion is disabled when either one is missing.
+*/
+texture_cache::texture_cache()
+{
+	const char* dir = dl_system::get_env( k_cache_env );
+	if( dir && std::string(dir) == "0" )
+	{
+		return;
+	}
+
+	m_directory =
+		dir && dir[0]
+		?	std::string(dir)
+		:	temp_directory() + "/" + k_default_directory;
+
+	/* Note that 'somefile' won't be created, its just a tag. */
+	bool existed = dl_system::file_exists( m_directory.c_str() );
+	if( !dl_system::create_directory_for_file(m_directory + "/somefile") )
+	{
+		std::cerr
+			<< "3Delight for Houdini: unable to create texture cache directory "
+			<< m_directory << std::endl;
+		m_directory.clear();
+		return;
+	}
+
+	if( !existed )
+	{
+		make_group_writable( m_directory, true );
+	}
+
+	NSI::DynamicAPI api;
+	decltype( &DlGetInstallRoot) get_install_root = nullptr;
+	api.LoadFunction(get_install_root, "DlGetInstallRoot" );
+	if( !get_install_root || !get_install_root() )
+	{
+		m_directory.clear();
+		return;
+	}
+
+	m_tdlmake = std::string(get_install_root()) + "/bin/tdlmake";
+#ifdef _WIN32
+	m_tdlmake += ".exe";
+#endif
+
+	if( !dl_system::file_exists(m_tdlmake.c_str()) )
+	{
+		m_directory.clear();
+		return;
+	}
+
+	const char* (*get_dl_version)() = nullptr;
+	api.LoadFunction( get_dl_version, "DlGetLibNameAndVersionString" );
+	m_version = get_dl_version ? get_dl_version() : "unknown";
+
+	m_max_threads = std::max( 1u, std::thread::hardware_concurrency() );
+	const char* threads = dl_system::get_env( k_threads_env );
+	if( threads && atoi(threads) > 0 )
+	{
+		m_max_threads = atoi(threads);
+	}
+
+	load_index();
+}
+
+texture_cache &texture_cache::get_instance( void )
+{
+	/* Our only instance */
+	static texture_cache s_texture_cache;
+	return s_texture_cache;
+}
+
+bool texture_cache::is_texture_parameter(
+	const DlShaderInfo::Parameter &i_param )
+{
+	if( i_param.type.elementtype != NSITypeString )
+		return false;
+
+	for( const DlShaderInfo::Parameter& meta : i_param.metadata )
+	{
+		if( meta.name == "texturefile" && !meta.idefault.empty() )
+		{
+			return meta.idefault[0] != 0;
+		}
+	}
+
+	return false;
+}
+
+/**
+	We skip COPs (which are converted to temporary files by cop_utilities),
+	UDIM sets (which expand to multiple files at render time) and files that are
+	already in 3Delight's format.
+*/
+bool texture_cache::is_convertible( const std::string &i_texture )
+{
+	if( i_texture.empty() ||
+		i_texture.find("op:") == 0 ||
+		i_texture.find("UDIM") != std::string::npos ||
+		i_texture.find("<") != std::string::npos )
+	{
+		return false;
+	}
+
+	size_t dot = i_texture.rfind( '.' );
+	if( dot == std::string::npos )
+		return false;
+
+	std::string extension = i_texture.substr( dot+1 );
+	for( auto &c : extension ) c = ::tolower( c );
+
+	return extension != "tdl" && extension != "tx" && extension != "sdf";
+}
+
+std::string texture_cache::entry_key(
+	const std::string &i_texture,
+	const std::string &i_colorspace )
+{
+	return i_texture + "\t" + i_colorspace;
+}
+
+/**
+	3Delight converts textures in their declared color space, so we do the
+	same. "auto" is tdlmake's own default.
+*/
+std::vector<std::string> texture_cache::tdlmake_options(
+	const std::string &i_colorspace )
+{
+	std::vector<std::string> options;
+	if( !i_colorspace.empty() && i_colorspace != "auto" )
+	{
+		options.push_back( "-colorspace" );
+		options.push_back( i_colorspace );
+	}
+
+	return options;
+}
+
+void texture_cache::preconvert(
+	const context &i_context,
+	const std::vector<VOP_Node*> &i_vops )
+{
+	/*
+		Converted files live on this machine only, so don't refer to them in
+		exported NSI files, which might be rendered elsewhere.
+	*/
+	if( m_directory.empty() ||
+		i_context.m_export_nsi ||
+		i_context.m_rop_type == rop_type::cloud )
+	{
+		return;
+	}
+
+	const shader_library &library = shader_library::get_instance();
+
+	/*
+		Gather the texture files that are not already up to date, along with
+		their color space, by entry key.
+	*/
+	std::unordered_map<std::string, std::pair<std::string, std::string>>
+		textures;
+	for( VOP_Node *vop : i_vops )
+	{
+		DlShaderInfo *info = library.get_shader_info( vop );
+		if( !info )
+			continue;
+
+		std::string colorspace =
+			texture_colorspace( *vop, i_context.current_time() );
+
+		for( int i = 0; i < info->nparams(); i++ )
+		{
+			const DlShaderInfo::Parameter *param = info->getparam(i);
+			if( !is_texture_parameter(*param) ||
+				vop->getParmIndex(param->name.c_str()) < 0 )
+			{
+				continue;
+			}
+
+			UT_String file;
+			vop->evalString(
+				file, param->name.c_str(), 0, i_context.current_time() );
+			if( is_convertible(file.toStdString()) )
+			{
+				textures[entry_key(file.toStdString(), colorspace)] =
+					std::make_pair( file.toStdString(), colorspace );
+			}
+		}
+	}
+
+	std::vector<std::pair<std::string, std::string>> to_convert;
+	{
+		std::lock_guard<std::mutex> lock(m_entries_mutex);
+		for( const auto &texture : textures )
+		{
+			const std::string &file = texture.second.first;
+			FS_Info source( file.c_str() );
+			if( !source.exists() )
+				continue;
+
+			auto it = m_entries.find( texture.first );
+			if( it != m_entries.end() &&
+				it->second.m_mtime == (long long)source.getModTime() &&
+				it->second.m_size == (long long)source.getFileDataSize() &&
+				dl_system::file_exists(it->second.m_tdl.c_str()) )
+			{
+				continue;
+			}
+
+			to_convert.push_back( texture.second );
+		}
+	}
+
+	if( to_convert.empty() )
+		return;
+
+	/*
+		Each worker picks the next unconverted file until none is left. tdlmake
+		runs in its own process, so the threads mostly wait on it.
+	*/
+	std::atomic<size_t> next(0);
+	auto worker =
+		[this, &next, &to_convert]()
+		{
+			size_t index;
+			while( (index = next++) < to_convert.size() )
+			{
+				const std::string &file = to_convert[index].first;
+				const std::string &colorspace = to_convert[index].second;
+				entry converted = convert( file, colorspace );
+
+				std::lock_guard<std::mutex> lock(m_entries_mutex);
+				m_entries[entry_key(file, colorspace)] = converted;
+			}
+		};
+
+	unsigned nb_threads =
+		std::min( m_max_threads, (unsigned)to_convert.size() );
+	std::vector<std::thread> workers;
+	for( unsigned t = 0; t < nb_threads; t++ )
+	{
+		workers.emplace_back( worker );
+	}
+
+	for( std::thread &w : workers )
+	{
+		w.join();
+	}
+
+	save_index();
+}
+
+std::string texture_cache::converted(
+	const std::string &i_texture,
+	const std::string &i_colorspace ) const
+{
+	std::lock_guard<std::mutex> lock(m_entries_mutex);
+
+	auto it = m_entries.find( entry_key(i_texture, i_colorspace) );
+	if( it == m_entries.end() || it->second.m_tdl.empty() )
+	{
+		return i_texture;
+	}
+
+	/* The source might have been edited since it was converted. */
+	FS_Info source( i_texture.c_str() );
+	if( !source.exists() ||
+		it->second.m_mtime != (long long)source.getModTime() ||
+		it->second.m_size != (long long)source.getFileDataSize() )
+	{
+		return i_texture;
+	}
+
+	return it->second.m_tdl;
+}
+
+/**
+	The converted file is first written under a name unique to this process and
+	thread, then renamed. This way, other sessions sharing the cache never see a
+	partially written texture.
+
+	Its name is made of the hash of the source's content and of the hash of
+	the conversion's settings, so the same texture can be cached in different
+	color spaces, and textures converted by another version of 3Delight are
+	not re-used.
+*/
+texture_cache::entry texture_cache::convert(
+	const std::string &i_source,
+	const std::string &i_colorspace ) const
+{
+	entry result;
+
+	FS_Info source( i_source.c_str() );
+	result.m_mtime = (long long)source.getModTime();
+	result.m_size = (long long)source.getFileDataSize();
+
+	std::string hash = content_hash( i_source );
+	if( hash.empty() )
+		return result;
+
+	std::vector<std::string> options = tdlmake_options( i_colorspace );
+
+	std::string settings = m_version;
+	for( const std::string &option : options )
+		settings += "\t" + option;
+	hash += "_" + to_hex( fnv1a(k_fnv_offset, settings.data(), settings.size()) );
+
+	std::string tdl = m_directory + "/" + hash + ".tdl";
+	if( dl_system::file_exists(tdl.c_str()) )
+	{
+		result.m_tdl = tdl;
+		return result;
+	}
+
+	std::string temp =
+		m_directory + "/" + hash + "." + std::to_string(getpid()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+		".tdl";
+
+	std::vector<std::string> args( 1, m_tdlmake );
+	args.insert( args.end(), options.begin(), options.end() );
+	args.push_back( i_source );
+	args.push_back( temp );
+
+	if( run_program(args) != 0 ||
+		!dl_system::file_exists(temp.c_str()) )
+	{
+		std::cerr
+			<< "3Delight for Houdini: unable to convert texture "
+			<< i_source << std::endl;
+		::remove( temp.c_str() );
+		return result;
+	}
+
+	make_group_writable( temp, false );
+
+	/* Another session might have converted the same texture in the meantime. */
+	if( ::rename(temp.c_str(), tdl.c_str()) != 0 )
+	{
+		::remove( temp.c_str() );
+	}
+
+	if( dl_system::file_exists(tdl.c_str()) )
+	{
+		result.m_tdl = tdl;
+	}
+
+	return result;
+}
+
+/**
+	64 bits FNV-1a hash of the whole file. It's not a cryptographic hash, but
+	it's more than enough to identify textures and it's fast.
+*/
+std::string texture_cache::content_hash( const std::string &i_file )
+{
+	std::ifstream file( i_file.c_str(), std::ios::binary );
+	if( !file )
+		return {};
+
+	uint64_t hash = k_fnv_offset;
+
+	std::vector<char> buffer( 1 << 20 );
+	while( file )
+	{
+		file.read( &buffer[0], buffer.size() );
+		hash = fnv1a( hash, &buffer[0], (size_t)file.gcount() );
+	}
+
+	return to_hex( hash );
+}
+
+/**
+	Each line of the index holds the source file, its color space, its
+	modification time and size, and the converted file, separated by tabs.
+	Lines that can't be parsed are ignored.
+*/
+void texture_cache::read_index(
+	const std::string &i_file,
+	std::unordered_map<std::string, entry> &io_entries )
+{
+	std::ifstream file( i_file.c_str() );
+	std::string line;
+	if( !std::getline(file, line) || line != k_index_header )
+		return;
+
+	while( std::getline(file, line) )
+	{
+		std::vector<std::string> fields = split_fields( line );
+		if( fields.size() != 5 )
+			continue;
+
+		entry &e = io_entries[entry_key(fields[0], fields[1])];
+		e.m_mtime = atoll( fields[2].c_str() );
+		e.m_size = atoll( fields[3].c_str() );
+		e.m_tdl = fields[4];
+	}
+}
+
+void texture_cache::load_index()
+{
+	std::lock_guard<std::mutex> lock(m_entries_mutex);
+	read_index( m_directory + "/" + k_index_file, m_entries );
+}
+
+/**
+	Other sessions might have indexed textures as well since this one read the
+	index, so it's read again and merged with our entries. It's written under
+	a temporary name, then renamed, so it's never seen partially written. If
+	two sessions save at the same time, one of them loses its additions, which
+	will simply be hashed again later.
+*/
+void texture_cache::save_index() const
+{
+	std::string index = m_directory + "/" + k_index_file;
+
+	std::unordered_map<std::string, entry> entries;
+	read_index( index, entries );
+	{
+		std::lock_guard<std::mutex> lock(m_entries_mutex);
+		for( const auto &e : m_entries )
+		{
+			if( !e.second.m_tdl.empty() )
+				entries[e.first] = e.second;
+		}
+	}
+
+	std::string temp =
+		index + "." + std::to_string(getpid()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream file( temp.c_str() );
+		file << k_index_header << "\n";
+		for( const auto &e : entries )
+		{
+			// The key already holds the file and color space
+			if( e.second.m_tdl.find_first_of("\t\n") != std::string::npos ||
+				std::count(e.first.begin(), e.first.end(), '\t') != 1 ||
+				e.first.find('\n') != std::string::npos )
+			{
+				continue;
+			}
+
+			file
+				<< e.first << "\t" << e.second.m_mtime << "\t"
+				<< e.second.m_size << "\t" << e.second.m_tdl << "\n";
+		}
+
+		if( !file )
+		{
+			file.close();
+			::remove( temp.c_str() );
+			return;
+		}
+	}
+
+	make_group_writable( temp, false );
+
+	if( ::rename(temp.c_str(), index.c_str()) != 0 )
+	{
+		::remove( temp.c_str() );
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <3Delight/ShaderQuery.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class context;
+class VOP_Node;
+
+/**
+	\brief This class (singleton) converts raw textures to 3Delight's .tdl
+	format ahead of rendering.
+
+	When 3Delight encounters a raw texture (.exr, .png, .jpg, ...), it converts
+	it to .tdl before the first bucket can be rendered. On large scenes this
+	happens one texture at a time and could delay the render by minutes. We
+	rather gather all texture files used by the materials of a scene and convert
+	them in parallel, using the tdlmake utility, before any NSI node is created.
+
+	Converted files are stored in a persistent cache directory, named after a
+	hash of their source's content and another of the conversion's settings
+	(the texture's color space, the resulting tdlmake options and the 3Delight
+	version). This allows the cache to be shared between sessions and users,
+	and an edited texture to be re-converted automatically. The directory is
+	made group-writable when it's created, so other members of the group can
+	add to it. An index of the files already hashed, by modification time and
+	size, is kept in the directory so that they don't have to be read again
+	by later sessions.
+
+	Pre-conversion is synchronous : the export of the scene (and thus the
+	start of the render) waits until all new textures have been converted.
+	This is only long the first time a texture is used, and it's still faster
+	than letting 3Delight convert them one at a time.
+
+	The cache is controlled by these environment variables :
+	- _3DELIGHT_TEXTURE_CACHE : directory of the cache. Defaults to a
+	  "3delight_texture_cache" directory in the system's temporary directory.
+	  Set it to "0" to disable pre-conversion.
+	- _3DELIGHT_TEXTURE_CACHE_THREADS : maximum number of simultaneous
+	  conversions. Defaults to the number of cores.
+*/
+class texture_cache
+{
+public:
+	static texture_cache &get_instance( void );
+
+	/**
+		\brief Converts all textures used by a list of VOPs.
+
+		Textures that are already in the cache are not converted again. This
+		blocks the calling thread until all conversions are done.
+
+		\param i_context
+			The current rendering context.
+		\param i_vops
+			VOPs from which to gather texture file parameters, as returned by
+			scene::get_material_vops.
+	*/
+	void preconvert(
+		const context &i_context,
+		const std::vector<VOP_Node*> &i_vops );
+
+	/**
+		\brief Returns the converted file for a texture.
+
+		\param i_texture
+			The texture file.
+		\param i_colorspace
+			The texture's color space, as set on its VOP, or an empty string.
+		\returns the path of the .tdl file in the cache if i_texture has been
+		converted by preconvert() with the same color space and has not
+		changed since then. Otherwise, i_texture is returned so that 3Delight
+		converts it on its own.
+	*/
+	std::string converted(
+		const std::string &i_texture,
+		const std::string &i_colorspace ) const;
+
+	/// Returns true if a string parameter of a shader is a texture file
+	static bool is_texture_parameter( const DlShaderInfo::Parameter &i_param );
+
+private:
+	texture_cache();
+
+	// Not implemented
+	texture_cache( const texture_cache & );
+	const texture_cache &operator=( const texture_cache & );
+
+	/// Cached conversion of a single texture file, in a given color space
+	struct entry
+	{
+		// Modification time and size of the source when it was hashed
+		long long m_mtime{0};
+		long long m_size{0};
+		// Converted file in the cache, empty if not converted (yet)
+		std::string m_tdl;
+	};
+
+	/// Returns the key of a texture and color space in m_entries
+	static std::string entry_key(
+		const std::string &i_texture,
+		const std::string &i_colorspace );
+
+	/// Returns true if i_texture should be converted by us.
+	static bool is_convertible( const std::string &i_texture );
+
+	/// Returns the tdlmake options used to convert a texture
+	static std::vector<std::string> tdlmake_options(
+		const std::string &i_colorspace );
+
+	/**
+		\brief Converts i_source (if needed) and returns its updated cache
+		entry.
+	*/
+	entry convert(
+		const std::string &i_source,
+		const std::string &i_colorspace ) const;
+
+	/// Returns a hash of the file's content, as an hexadecimal string.
+	static std::string content_hash( const std::string &i_file );
+
+	/// Reads the entries of an index file into io_entries
+	static void read_index(
+		const std::string &i_file,
+		std::unordered_map<std::string, entry> &io_entries );
+	/// Reads the entries indexed by previous sessions into m_entries
+	void load_index();
+	/// Merges m_entries into the index file of the cache directory
+	void save_index() const;
+
+private:
+	/// Directory where converted textures are stored (empty if disabled)
+	std::string m_directory;
+	/// Full path to the tdlmake utility
+	std::string m_tdlmake;
+	/// 3Delight's version, which is part of each conversion's settings
+	std::string m_version;
+	/// Maximum number of concurrent conversions
+	unsigned m_max_threads{1};
+
+	/// Source path and color space (\ref entry_key) to conversion table
+	std::unordered_map<std::string, entry> m_entries;
+	mutable std::mutex m_entries_mutex;
+};
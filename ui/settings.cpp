@@ -60,6 +60,17 @@ const char* settings::k_max_reflection_depth = "max_reflection_depth";
 const char* settings::k_max_refraction_depth = "max_refraction_depth";
 const char* settings::k_max_hair_depth = "max_hair_depth";
 const char* settings::k_max_distance = "max_distance";
+const char* settings::k_point_chunk_size = "point_chunk_size";
+const char* settings::k_hair_lod_size = "hair_lod_size";
+const char* settings::k_hair_lod_reduce_vertices = "hair_lod_reduce_vertices";
+const char* settings::k_threaded_curve_refinement = "threaded_curve_refinement";
+const char* settings::k_deduplicate_shaders = "deduplicate_shaders";
+const char* settings::k_ipr_event_tick = "ipr_event_tick";
+const char* settings::k_ipr_frame_cache = "ipr_frame_cache";
+const char* settings::k_ipr_crop_culling = "ipr_crop_culling";
+const char* settings::k_ipr_crop_culling_margin = "ipr_crop_culling_margin";
+const char* settings::k_viewport_settle_time = "viewport_settle_time";
+const char* settings::k_viewport_refresh_rate = "viewport_refresh_rate";
 const char* settings::k_camera = "camera";
 const char* settings::k_override_camera_resolution = "override_camera_resolution";
 const char* settings::k_atmosphere = "atmosphere";
@@ -68,6 +79,7 @@ const char* settings::k_objects_to_render = "objects_to_render";
 const char* settings::k_lights_to_render = "lights_to_render";
 const char* settings::k_phantom_objects = "phantom_objects";
 const char* settings::k_matte_objects = "matte_objects";
+const char* settings::k_crop_culling_keep = "crop_culling_keep";
 const char* settings::k_default_image_filename = "default_image_filename";
 const char* settings::k_default_image_format = "default_image_format";
 const char* settings::k_default_image_bits = "default_image_bits";
@@ -204,6 +216,7 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 	static PRM_Name separator6("separator6", "");
 	static PRM_Name separator8("separator8", "");
 	static PRM_Name separator9("separator9", "");
+	static PRM_Name separator10("separator10", "");
 	// separator7 is obsolete : don't use it
 
 	// Actions
@@ -429,6 +442,36 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 	static PRM_Default max_distance_d(1000.0f);
 	static PRM_Range max_distance_r(PRM_RANGE_RESTRICTED, 0.0f, PRM_RANGE_UI, 2000.0f);
 
+	static PRM_Name point_chunk_size(k_point_chunk_size, "Max Points per Particles Node");
+	static PRM_Default point_chunk_size_d(0);
+	static PRM_Range point_chunk_size_r(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 1000000);
+
+	static PRM_Name hair_lod_size(k_hair_lod_size, "Hair LOD Size (pixels)");
+	static PRM_Default hair_lod_size_d(0.0f);
+	static PRM_Range hair_lod_size_r(PRM_RANGE_RESTRICTED, 0.0f, PRM_RANGE_UI, 1000.0f);
+	static PRM_Name hair_lod_reduce_vertices(k_hair_lod_reduce_vertices, "Reduce Hair Vertices");
+	static PRM_Default hair_lod_reduce_vertices_d(false);
+	static PRM_Conditional hair_lod_reduce_vertices_disable(
+		("{ " + std::string(k_hair_lod_size) + " == 0 }").c_str(), PRM_CONDTYPE_DISABLE);
+	static PRM_Name threaded_curve_refinement(k_threaded_curve_refinement, "Refine Curves in Parallel");
+	static PRM_Default threaded_curve_refinement_d(false);
+	static PRM_Name deduplicate_shaders(k_deduplicate_shaders, "Deduplicate Shader Networks");
+	static PRM_Default deduplicate_shaders_d(false);
+
+	static PRM_Name ipr_event_tick(k_ipr_event_tick, "IPR Update Interval (ms)");
+	static PRM_Default ipr_event_tick_d(40);
+	static PRM_Range ipr_event_tick_r(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 500);
+	static PRM_Name ipr_frame_cache(k_ipr_frame_cache, "IPR Cached Frames");
+	static PRM_Default ipr_frame_cache_d(8);
+	static PRM_Range ipr_frame_cache_r(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 64);
+	static PRM_Name viewport_settle_time(k_viewport_settle_time, "Full Resolution Delay (ms)");
+	static PRM_Default viewport_settle_time_d(300);
+	static PRM_Range viewport_settle_time_r(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 2000);
+	static PRM_Name viewport_refresh_rate(k_viewport_refresh_rate, "Max Refreshes per Second");
+	static PRM_Default viewport_refresh_rate_d(20);
+	static PRM_Range viewport_refresh_rate_r(PRM_RANGE_RESTRICTED, 1, PRM_RANGE_UI, 60);
+	static PRM_Name separator11("separator11", "");
+
 	static std::vector<PRM_Template> quality_templates =
 	{
 		PRM_Template(PRM_INT, 1, &shading_samples, &shading_samples_d, nullptr, &shading_samples_r),
@@ -449,7 +492,16 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 		PRM_Template(PRM_INT, 1, &max_reflection_depth, &max_reflection_depth_d, nullptr, &max_reflection_depth_r),
 		PRM_Template(PRM_INT, 1, &max_refraction_depth, &max_refraction_depth_d, nullptr, &max_refraction_depth_r),
 		PRM_Template(PRM_INT, 1, &max_hair_depth, &max_hair_depth_d, nullptr, &max_hair_depth_r),
-		PRM_Template(PRM_FLT|PRM_TYPE_PLAIN, 1, &max_distance, &max_distance_d, nullptr, &max_distance_r)
+		PRM_Template(PRM_FLT|PRM_TYPE_PLAIN, 1, &max_distance, &max_distance_d, nullptr, &max_distance_r),
+		PRM_Template(PRM_SEPARATOR, 0, &separator10),
+		PRM_Template(PRM_INT, 1, &point_chunk_size, &point_chunk_size_d, nullptr, &point_chunk_size_r),
+		PRM_Template(PRM_FLT|PRM_TYPE_PLAIN, 1, &hair_lod_size, &hair_lod_size_d, nullptr, &hair_lod_size_r),
+		PRM_Template(PRM_TOGGLE, 1, &hair_lod_reduce_vertices, &hair_lod_reduce_vertices_d, nullptr, nullptr, 0, nullptr, 1, nullptr, &hair_lod_reduce_vertices_disable),
+		PRM_Template(PRM_TOGGLE, 1, &threaded_curve_refinement, &threaded_curve_refinement_d),
+		PRM_Template(PRM_TOGGLE, 1, &deduplicate_shaders, &deduplicate_shaders_d),
+		PRM_Template(PRM_SEPARATOR, 0, &separator11),
+		PRM_Template(PRM_INT, 1, &ipr_event_tick, &ipr_event_tick_d, nullptr, &ipr_event_tick_r),
+		PRM_Template(PRM_INT, 1, &ipr_frame_cache, &ipr_frame_cache_d, nullptr, &ipr_frame_cache_r)
 	};
 
 	static std::vector<PRM_Template> viewport_quality_templates =
@@ -466,7 +518,17 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 		PRM_Template(PRM_INT, 1, &max_reflection_depth, &max_reflection_depth_d, nullptr, &max_reflection_depth_r),
 		PRM_Template(PRM_INT, 1, &max_refraction_depth, &max_refraction_depth_d, nullptr, &max_refraction_depth_r),
 		PRM_Template(PRM_INT, 1, &max_hair_depth, &max_hair_depth_d, nullptr, &max_hair_depth_r),
-		PRM_Template(PRM_FLT | PRM_TYPE_PLAIN, 1, &max_distance, &max_distance_d, nullptr, &max_distance_r)
+		PRM_Template(PRM_FLT | PRM_TYPE_PLAIN, 1, &max_distance, &max_distance_d, nullptr, &max_distance_r),
+		PRM_Template(PRM_SEPARATOR, 0, &separator10),
+		PRM_Template(PRM_INT, 1, &point_chunk_size, &point_chunk_size_d, nullptr, &point_chunk_size_r),
+		PRM_Template(PRM_FLT|PRM_TYPE_PLAIN, 1, &hair_lod_size, &hair_lod_size_d, nullptr, &hair_lod_size_r),
+		PRM_Template(PRM_TOGGLE, 1, &hair_lod_reduce_vertices, &hair_lod_reduce_vertices_d, nullptr, nullptr, 0, nullptr, 1, nullptr, &hair_lod_reduce_vertices_disable),
+		PRM_Template(PRM_TOGGLE, 1, &threaded_curve_refinement, &threaded_curve_refinement_d),
+		PRM_Template(PRM_SEPARATOR, 0, &separator11),
+		PRM_Template(PRM_INT, 1, &ipr_event_tick, &ipr_event_tick_d, nullptr, &ipr_event_tick_r),
+		PRM_Template(PRM_INT, 1, &ipr_frame_cache, &ipr_frame_cache_d, nullptr, &ipr_frame_cache_r),
+		PRM_Template(PRM_INT, 1, &viewport_settle_time, &viewport_settle_time_d, nullptr, &viewport_settle_time_r),
+		PRM_Template(PRM_INT, 1, &viewport_refresh_rate, &viewport_refresh_rate_d, nullptr, &viewport_refresh_rate_r)
 	};
 	// Scene elements
 
@@ -524,6 +586,18 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 	static PRM_Name matte_objects(k_matte_objects, "Matte Objects");
 	static PRM_Default matte_objects_d(0.0f, ""); /* none */
 
+	static PRM_Name ipr_crop_culling(k_ipr_crop_culling, "Cull Objects Outside of IPR Crop");
+	static PRM_Default ipr_crop_culling_d(false);
+	static PRM_Conditional ipr_crop_culling_disable(
+		("{ " + std::string(k_ipr_crop_culling) + " == 0 }").c_str(), PRM_CONDTYPE_DISABLE);
+	static PRM_Name ipr_crop_culling_margin(k_ipr_crop_culling_margin, "IPR Crop Margin");
+	static PRM_Default ipr_crop_culling_margin_d(0.0f);
+	static PRM_Range ipr_crop_culling_margin_r(PRM_RANGE_RESTRICTED, 0.0f, PRM_RANGE_UI, 1.0f);
+
+	static PRM_Name crop_culling_keep(
+		k_crop_culling_keep, "Objects Kept Outside of IPR Crop");
+	static PRM_Default crop_culling_keep_d(0.0f, ""); /* none */
+
 	static std::vector<PRM_Template> scene_elements_templates =
 	{
 		PRM_Template(PRM_STRING, PRM_TYPE_DYNAMIC_PATH, 1, &atmosphere, &atmosphere_d, nullptr, nullptr, nullptr),
@@ -537,7 +611,17 @@ PRM_Template* settings::GetTemplates(rop_type i_rop_type)
 		PRM_Template(
 			PRM_STRING_OPLIST, PRM_TYPE_DYNAMIC_PATH_LIST, 1, &matte_objects,
 			&matte_objects_d, nullptr, nullptr, nullptr,
-			&PRM_SpareData::objGeometryPath, 1, nullptr, nullptr)
+			&PRM_SpareData::objGeometryPath, 1, nullptr, nullptr),
+		PRM_Template(PRM_TOGGLE, 1, &ipr_crop_culling, &ipr_crop_culling_d),
+		PRM_Template(
+			PRM_FLT, 1, &ipr_crop_culling_margin, &ipr_crop_culling_margin_d,
+			nullptr, &ipr_crop_culling_margin_r, nullptr, nullptr, 1, nullptr,
+			&ipr_crop_culling_disable),
+		PRM_Template(
+			PRM_STRING_OPLIST, PRM_TYPE_DYNAMIC_PATH_LIST, 1, &crop_culling_keep,
+			&crop_culling_keep_d, nullptr, nullptr, nullptr,
+			&PRM_SpareData::objGeometryPath, 1, nullptr,
+			&ipr_crop_culling_disable)
 	};
 
 	static std::vector<PRM_Template> viewport_scene_elements_templates =
@@ -1872,6 +1956,127 @@ UT_String settings::get_phantom_objects(fpreal t) const
 	return phantom_pattern;
 }
 
+UT_String settings::get_crop_culling_keep(fpreal t) const
+{
+	UT_String keep_pattern;
+	if (m_parameters.getParmIndex(settings::k_crop_culling_keep) != -1)
+	{
+		m_parameters.evalString(
+			keep_pattern, settings::k_crop_culling_keep, 0, t);
+	}
+	return keep_pattern;
+}
+
+int settings::get_point_chunk_size(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_point_chunk_size) == -1)
+	{
+		return 0;
+	}
+
+	return m_parameters.evalInt(settings::k_point_chunk_size, 0, t);
+}
+
+double settings::get_hair_lod_size(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_hair_lod_size) == -1)
+	{
+		return 0.0;
+	}
+
+	return m_parameters.evalFloat(settings::k_hair_lod_size, 0, t);
+}
+
+bool settings::get_hair_lod_reduce_vertices(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_hair_lod_reduce_vertices) == -1)
+	{
+		return false;
+	}
+
+	return m_parameters.evalInt(settings::k_hair_lod_reduce_vertices, 0, t) != 0;
+}
+
+bool settings::get_threaded_curve_refinement(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_threaded_curve_refinement) == -1)
+	{
+		return false;
+	}
+
+	return m_parameters.evalInt(settings::k_threaded_curve_refinement, 0, t) != 0;
+}
+
+bool settings::get_deduplicate_shaders(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_deduplicate_shaders) == -1)
+	{
+		return false;
+	}
+
+	return m_parameters.evalInt(settings::k_deduplicate_shaders, 0, t) != 0;
+}
+
+int settings::get_ipr_event_tick(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_ipr_event_tick) == -1)
+	{
+		return 40;
+	}
+
+	return m_parameters.evalInt(settings::k_ipr_event_tick, 0, t);
+}
+
+int settings::get_ipr_frame_cache(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_ipr_frame_cache) == -1)
+	{
+		return 8;
+	}
+
+	return m_parameters.evalInt(settings::k_ipr_frame_cache, 0, t);
+}
+
+bool settings::get_ipr_crop_culling(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_ipr_crop_culling) == -1)
+	{
+		return false;
+	}
+
+	return m_parameters.evalInt(settings::k_ipr_crop_culling, 0, t) != 0;
+}
+
+double settings::get_ipr_crop_culling_margin(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_ipr_crop_culling_margin) == -1)
+	{
+		return 0.0;
+	}
+
+	return m_parameters.evalFloat(settings::k_ipr_crop_culling_margin, 0, t);
+}
+
+int settings::get_viewport_settle_time(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_viewport_settle_time) == -1)
+	{
+		return 300;
+	}
+
+	return m_parameters.evalInt(settings::k_viewport_settle_time, 0, t);
+}
+
+int settings::get_viewport_refresh_rate(fpreal t) const
+{
+	if (m_parameters.getParmIndex(settings::k_viewport_refresh_rate) == -1)
+	{
+		return 20;
+	}
+
+	return m_parameters.evalInt(settings::k_viewport_refresh_rate, 0, t);
+}
+
 UT_String settings::get_render_mode( fpreal t )const
 {
 	UT_String render_mode("*");
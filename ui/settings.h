@@ -91,6 +91,18 @@ public:
 	UT_String GetLightsToRender(fpreal) const;
 	UT_String get_matte_objects( fpreal ) const;
 	UT_String get_phantom_objects(fpreal) const;
+	UT_String get_crop_culling_keep(fpreal) const;
+	int get_point_chunk_size(fpreal) const;
+	double get_hair_lod_size(fpreal) const;
+	bool get_hair_lod_reduce_vertices(fpreal) const;
+	bool get_threaded_curve_refinement(fpreal) const;
+	bool get_deduplicate_shaders(fpreal) const;
+	int get_ipr_event_tick(fpreal) const;
+	int get_ipr_frame_cache(fpreal) const;
+	bool get_ipr_crop_culling(fpreal) const;
+	double get_ipr_crop_culling_margin(fpreal) const;
+	int get_viewport_settle_time(fpreal) const;
+	int get_viewport_refresh_rate(fpreal) const;
 	bool OverrideDisplayFlags(fpreal)const;
 
 public:
@@ -128,6 +140,17 @@ public:
 	static const char* k_max_refraction_depth;
 	static const char* k_max_hair_depth;
 	static const char* k_max_distance;
+	static const char* k_point_chunk_size;
+	static const char* k_hair_lod_size;
+	static const char* k_hair_lod_reduce_vertices;
+	static const char* k_threaded_curve_refinement;
+	static const char* k_deduplicate_shaders;
+	static const char* k_ipr_event_tick;
+	static const char* k_ipr_frame_cache;
+	static const char* k_ipr_crop_culling;
+	static const char* k_ipr_crop_culling_margin;
+	static const char* k_viewport_settle_time;
+	static const char* k_viewport_refresh_rate;
 	static const char* k_camera;
 	static const char* k_override_camera_resolution;
 	static const char* k_atmosphere;
@@ -136,6 +159,7 @@ public:
 	static const char* k_lights_to_render;
 	static const char* k_phantom_objects;
 	static const char* k_matte_objects;
+	static const char* k_crop_culling_keep;
 	static const char* k_default_image_filename;
 	static const char* k_default_image_format;
 	static const char* k_default_image_bits;
@@ -3,6 +3,8 @@
 #include "context.h"
 #include "VOP_ExternalOSL.h"
 #include "dl_system.h"
+#include "export_memory.h"
+#include "export_trace.h"
 
 #include <nsi_dynamic.hpp>
 #include <nsi.hpp>
@@ -15,6 +17,7 @@
 #include <SOP/SOP_Node.h>
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 
 namespace
@@ -630,10 +633,29 @@ bool vdb_file_writer::add_grid(const GT_PrimitiveHandle& i_handle)
 	return true;
 }
 
+/**
+	GT_PrimVDB doesn't necessarily account for the voxels of its grid, which
+	are what matters until the grids are written.
+*/
+size_t vdb_file_writer::retained_memory()const
+{
+	size_t grids_memory = 0;
+	for(const GT_PrimitiveHandle& handle : m_grids)
+	{
+		GT_PrimVDB* gt_vdb = dynamic_cast<GT_PrimVDB*>(handle.get());
+		assert(gt_vdb);
+		grids_memory += gt_vdb->getGrid()->memUsage();
+	}
+
+	return std::max(grids_memory, vdb_file::retained_memory());
+}
+
 void vdb_file_writer::create()const
 {
 	if(!m_grids.empty())
 	{
+		export_trace::scope trace("write vdb", m_object);
+
 		// Retrieve the OpenVDB grids
 		openvdb::GridCPtrVec grids;
 		for(const GT_PrimitiveHandle& handle : m_grids)
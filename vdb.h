@@ -135,6 +135,9 @@ public:
 
 	void create()const override;
 
+	/// Includes the grids that have not been written yet
+	size_t retained_memory()const override;
+
 private:
 	// Holds VDB grids until they're exported to a temporary file
 	mutable std::vector<GT_PrimitiveHandle> m_grids;
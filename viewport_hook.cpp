@@ -1,5 +1,6 @@
 #include "viewport_hook.h"
 #include "camera.h"
+#include "ipr_latency.h"
 #include "shader_library.h"
 
 #include <DM/DM_VPortAgent.h>
@@ -12,8 +13,10 @@
 #include <ndspy.h>
 #include <nsi_dynamic.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <thread>
 
 
@@ -23,8 +26,50 @@ namespace
 	const char* k_driver_name = "3dfh_viewport";
 	// Parameter name containing the viewport hook's id
 	const char* k_viewport_hook_name = "viewport_hook_id";
-	// 20 FPS
-	const std::chrono::milliseconds k_refresh_interval(50);
+	/*
+		Maximum refresh rate, in FPS, and time (in milliseconds) during which
+		the camera must be still before rendering at full resolution again.
+		Both are set from the ROP's parameters when a render is connected
+		(\ref viewport_hook_builder::connect). They're read from the refresher
+		threads as well as the UI thread.
+	*/
+	std::atomic<int> g_refresh_rate{20};
+	std::atomic<int> g_settle_time{300};
+	// Minimum refresh rate, when buckets arrive slowly
+	const std::chrono::milliseconds k_max_refresh_interval(500);
+	/*
+		Time after which the refresher checks whether the buffer is still
+		referenced, even if no update has been received.
+	*/
+	const std::chrono::milliseconds k_idle_interval(250);
+
+	// Resolution divisor used while the camera moves
+	const int k_motion_resolution_divisor = 4;
+	// Oversampling at full and reduced resolution
+	const int k_oversampling = 16;
+	const int k_motion_oversampling = 4;
+
+	/**
+		\brief Returns the time during which the camera must be still before
+		rendering at full resolution again.
+
+		It's controlled by the ROP's "Full Resolution Delay" parameter. 0
+		disables reduced resolution rendering.
+	*/
+	std::chrono::milliseconds settle_time()
+	{
+		return std::chrono::milliseconds(g_settle_time.load());
+	}
+
+	/**
+		\brief Returns the minimum delay between 2 viewport refreshes.
+
+		It's controlled by the ROP's "Max Refreshes per Second" parameter.
+	*/
+	std::chrono::milliseconds min_refresh_interval()
+	{
+		return std::chrono::milliseconds(1000 / g_refresh_rate.load());
+	}
 }
 
 
@@ -49,6 +94,13 @@ namespace
 	refreshes of the render hook's viewport when the image has been updated, and
 	of deleting the image buffer once it stops being referenced from both the
 	display driver and the scene render hook.
+
+	The thread sleeps until a bucket is received. Refreshes are then spaced
+	according to the rate at which buckets arrive : there is no point in
+	refreshing the viewport more often than the image changes, and refreshing
+	much less often makes the render appear sluggish. The interval is bounded
+	by the maximum refresh rate (\ref min_refresh_interval) and
+	k_max_refresh_interval.
 */
 class hook_image_buffer
 {
@@ -91,13 +143,36 @@ public:
 		\brief Notifies the image buffer that the display driver is being closed.
 
 		It also clears the pixels so no image is displayed, but the render hook
-		can continue to access them without synchronization.
+		can continue to access them without synchronization. The pixels are
+		kept if keep_pixels_on_close() has been called.
 	*/
 	void close();
 
 	/// Returns true if the image buffer is still connected to a render hook.
 	bool connected()const { return m_hook != nullptr; }
 
+	/**
+		\brief Fills the image with a resampled copy of another one.
+
+		This avoids displaying an empty image until the first buckets are
+		received after a resolution change.
+	*/
+	void resample(const hook_image_buffer& i_source);
+
+	/**
+		\brief Prevents close() from clearing the pixels.
+
+		This is used when the image is about to be replaced by one with a
+		different resolution, so it can be resampled into the new one.
+	*/
+	void keep_pixels_on_close() { m_keep_pixels = true; }
+
+	/**
+		\brief Requests a refresh of the viewport at a given time, even if the
+		image doesn't change.
+	*/
+	void schedule_refresh(std::chrono::steady_clock::time_point i_time);
+
 	const unsigned m_width{0};
 	const unsigned m_height{0};
 
@@ -139,6 +214,20 @@ private:
 
 	// Update count, incremented each time data() is called
 	std::atomic<unsigned> m_timestamp{0};
+
+	// Set by keep_pixels_on_close()
+	std::atomic<bool> m_keep_pixels{false};
+
+	// Smoothed time between the arrival of 2 buckets
+	std::chrono::steady_clock::duration m_bucket_interval{0};
+	// Arrival time of the last bucket
+	std::chrono::steady_clock::time_point m_last_bucket;
+	// Time of a refresh requested by schedule_refresh, if any
+	std::chrono::steady_clock::time_point m_scheduled_refresh;
+	bool m_refresh_scheduled{false};
+	// Protects the members above and wakes up the refresher thread
+	std::mutex m_update_mutex;
+	std::condition_variable m_update_cv;
 };
 
 
@@ -222,15 +311,79 @@ hook_image_buffer::data(int i_x, int i_y, int i_w, int i_h, const void* i_data)
 		void* target = m_pixels + (m_height-(i_y+y)-1)*m_width + i_x;
 		memcpy(target, source, source_line_length);
 	}
-	
-	m_timestamp++;
+
+	{
+		std::lock_guard<std::mutex> lock(m_update_mutex);
+
+		/*
+			Exponential moving average, so the refresh rate follows changes in
+			the arrival rate without being too sensitive to isolated buckets.
+		*/
+		auto now = std::chrono::steady_clock::now();
+		if(m_last_bucket.time_since_epoch().count() != 0)
+		{
+			m_bucket_interval =
+				(m_bucket_interval * 3 + (now - m_last_bucket)) / 4;
+		}
+		m_last_bucket = now;
+
+		m_timestamp++;
+	}
+
+	m_update_cv.notify_all();
+
+	ipr_latency::get_instance().bucket_received();
+}
+
+
+void
+hook_image_buffer::resample(const hook_image_buffer& i_source)
+{
+	assert(m_pixels);
+	assert(i_source.m_pixels);
+
+	// Nearest neighbour is good enough for a temporary image
+	for(unsigned y = 0; y < m_height; y++)
+	{
+		const pixel_t* source_line =
+			i_source.m_pixels + (y * i_source.m_height / m_height) * i_source.m_width;
+		pixel_t* target_line = m_pixels + y*m_width;
+		for(unsigned x = 0; x < m_width; x++)
+		{
+			target_line[x] = source_line[x * i_source.m_width / m_width];
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_update_mutex);
+		m_timestamp++;
+	}
+
+	m_update_cv.notify_all();
+}
+
+
+void
+hook_image_buffer::schedule_refresh(
+	std::chrono::steady_clock::time_point i_time)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_update_mutex);
+		m_scheduled_refresh = i_time;
+		m_refresh_scheduled = true;
+	}
+
+	m_update_cv.notify_all();
 }
 
 
 void
 hook_image_buffer::close()
 {
-	clear_pixels();
+	if(!m_keep_pixels)
+	{
+		clear_pixels();
+	}
 }
 
 
@@ -246,7 +399,13 @@ hook_image_buffer::clear_pixels()
 {
 	assert(m_pixels);
 	memset(m_pixels, 0, m_width*m_height*sizeof(pixel_t));
-	m_timestamp++;
+
+	{
+		std::lock_guard<std::mutex> lock(m_update_mutex);
+		m_timestamp++;
+	}
+
+	m_update_cv.notify_all();
 }
 
 
@@ -254,28 +413,83 @@ void
 hook_image_buffer::update_viewport_loop(
 	std::shared_ptr<hook_image_buffer>& i_buffer)
 {
+	const std::chrono::milliseconds min_interval = min_refresh_interval();
+
 	unsigned refresh_timestamp = i_buffer->m_timestamp;
+	auto last_refresh = std::chrono::steady_clock::now();
 	while(i_buffer.use_count() > 1)
 	{
-		unsigned edit_timestamp = i_buffer->m_timestamp;
-		if(refresh_timestamp < edit_timestamp)
+		std::chrono::steady_clock::duration interval;
 		{
+			std::unique_lock<std::mutex> lock(i_buffer->m_update_mutex);
+
 			/*
-				FIXME : We should find a way to call requestDraw without
-				using a global lock.
+				Wake up when the image changes, or for a scheduled refresh. We
+				still have to check regularly whether the buffer is referenced,
+				since releasing a reference can't notify us.
 			*/
-			HOM_AutoLock hom_lock;
+			auto wake_up = std::chrono::steady_clock::now() + k_idle_interval;
+			if(i_buffer->m_refresh_scheduled)
+			{
+				wake_up = std::min(wake_up, i_buffer->m_scheduled_refresh);
+			}
+
+			i_buffer->m_update_cv.wait_until(
+				lock,
+				wake_up,
+				[&i_buffer, refresh_timestamp]()
+				{
+					return
+						i_buffer->m_timestamp != refresh_timestamp ||
+						(i_buffer->m_refresh_scheduled &&
+							std::chrono::steady_clock::now() >=
+								i_buffer->m_scheduled_refresh);
+				});
+
+			bool scheduled =
+				i_buffer->m_refresh_scheduled &&
+				std::chrono::steady_clock::now() >= i_buffer->m_scheduled_refresh;
+			if(i_buffer->m_timestamp == refresh_timestamp && !scheduled)
+			{
+				continue;
+			}
 
-			i_buffer->m_mutex.lock();
-			if(i_buffer->m_hook)
+			if(scheduled)
 			{
-				i_buffer->m_hook->viewport().requestDraw();
-				refresh_timestamp = edit_timestamp;
+				i_buffer->m_refresh_scheduled = false;
 			}
-			i_buffer->m_mutex.unlock();
+
+			interval =
+				std::max<std::chrono::steady_clock::duration>(
+					min_interval,
+					std::min<std::chrono::steady_clock::duration>(
+						i_buffer->m_bucket_interval,
+						k_max_refresh_interval));
+		}
+
+		/*
+			When buckets arrive slowly, the previous refresh is old enough for
+			this one to be immediate.
+		*/
+		std::this_thread::sleep_until(last_refresh + interval);
+
+		unsigned edit_timestamp = i_buffer->m_timestamp;
+
+		/*
+			FIXME : We should find a way to call requestDraw without
+			using a global lock.
+		*/
+		HOM_AutoLock hom_lock;
+
+		i_buffer->m_mutex.lock();
+		if(i_buffer->m_hook)
+		{
+			i_buffer->m_hook->viewport().requestDraw();
 		}
+		i_buffer->m_mutex.unlock();
 
-		std::this_thread::sleep_for(k_refresh_interval);
+		refresh_timestamp = edit_timestamp;
+		last_refresh = std::chrono::steady_clock::now();
 	}
 }
 
@@ -495,6 +709,8 @@ public:
 	/// Disconnects from the NSI context and from the image buffer.
 	void disconnect();
 	OBJ_Camera* get_camera();
+	/// Returns the camera and resolution copied during the last refresh
+	viewport_view get_view();
 
 	/// Returns a numerical ID for the viewport hook
 	int id()const { return viewport().getUniqueId(); }
@@ -523,8 +739,10 @@ private:
 		\param i_synchronize
 			True if the function is called once rendering has started, and any
 			edit requires sending a "synchronize" action to NSIRenderControl.
+		\returns
+			True if the camera has changed since the last export.
 	*/
-	void export_camera_attributes(
+	bool export_camera_attributes(
 		GUI_ViewParameter& i_view,
 		OBJ_Camera* active_camera,
 		bool i_synchronize)const;
@@ -544,6 +762,9 @@ private:
 		OBJ_Camera* i_active_camera,
 		bool i_synchronize);
 
+	/// Returns true if the camera has moved in the last settle_time()
+	bool in_motion()const;
+
 	// Used to synchronize open(), close(), connect() and disconnect().
 	std::mutex m_mutex;
 
@@ -554,11 +775,21 @@ private:
 
 	bool m_render_called_once{false};
 
+	// Camera and resolution of the viewport, copied at each refresh
+	viewport_view m_view;
+
 	// Cache for previously sent camera attributes. Avoids redundant updates.
 	mutable viewport_camera m_last_camera;
 	mutable UT_Matrix4D m_last_camera_transform{1.0};
 	mutable int m_last_resolution[2]{0, 0};
 	mutable double m_last_screen_window[4]{0.0, 0.0, 0.0, 0.0};
+	bool m_last_reduced{false};
+
+	/*
+		Last time the camera was seen moving. The image is rendered at a reduced
+		resolution while the camera moves, so it gets refreshed quickly.
+	*/
+	std::chrono::steady_clock::time_point m_last_motion;
 };
 
 
@@ -593,10 +824,22 @@ viewport_hook::render(
 	*/
 	m_mutex.lock();
 
+	// Copied for threads that can't access the viewport
+	VPortAgentCameraAccessor cam(vp);
+	m_view.m_camera_id =
+		cam.m_active_camera ? cam.m_active_camera->getUniqueId() : -1;
+	m_view.m_resolution[0] = view.getViewWidth();
+	m_view.m_resolution[1] = view.getViewHeight();
+	viewport_view current_view = m_view;
+
+	bool camera_changed = false;
 	if(m_nsi)
 	{
-		VPortAgentCameraAccessor cam(vp);
-		export_camera_attributes(view, cam.m_active_camera, true);
+		if(export_camera_attributes(view, cam.m_active_camera, true))
+		{
+			m_last_motion = std::chrono::steady_clock::now();
+			camera_changed = true;
+		}
 
 		export_screen_attributes(vs, cam.m_active_camera, true);
 	}
@@ -610,11 +853,29 @@ viewport_hook::render(
 
 	m_mutex.unlock();
 
+	/*
+		This is done after unlocking, since the builder's disconnect() locks
+		the hooks in the opposite order.
+	*/
+	if(camera_changed)
+	{
+		viewport_hook_builder::instance().camera_changed(current_view);
+	}
+
 	if(!buffer)
 	{
 		return false;
 	}
 
+	if(m_last_reduced)
+	{
+		/*
+			Make sure we're called again once the camera has settled, so the
+			full resolution can be restored even if the image doesn't change.
+		*/
+		buffer->schedule_refresh(m_last_motion + settle_time());
+	}
+
 	assert(buffer->pixels());
 
 	// Save some OpenGL state
@@ -681,6 +942,8 @@ viewport_hook::render(
 		manages its own OpenGL texture ID, it can only be destroyed when there
 		is an active OpenGL context. This forces us to manage the pixels buffer
 		separately and create a local PXL_Raster that is usd only once.
+		Because of this, the whole image is uploaded each time, even when only
+		a few buckets have changed.
 	*/
 	PXL_Raster raster(PACK_RGBA, PXL_FLOAT16, buffer->m_width, buffer->m_height, 0, 0);
 	// Second parameter : give_ownership = false
@@ -712,22 +975,41 @@ viewport_hook::get_camera()
 }
 
 
+viewport_view
+viewport_hook::get_view()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_view;
+}
+
+
 std::shared_ptr<hook_image_buffer>
 viewport_hook::buffer(int i_width, int i_height)
 {
 	m_mutex.lock();
 	
+	std::shared_ptr<hook_image_buffer> previous;
 	if(m_image_buffer &&
 		(m_image_buffer->m_width != i_width ||
 		m_image_buffer->m_height != i_height))
 	{
 		m_image_buffer->disconnect();
+		previous = m_image_buffer;
 		m_image_buffer.reset();
 	}
 	
 	if(!m_image_buffer)
 	{
 		m_image_buffer = hook_image_buffer::connect(this, i_width, i_height);
+
+		/*
+			Resolution changes happen when the camera starts or stops moving.
+			Keep displaying the previous image until the new one comes in.
+		*/
+		if(previous)
+		{
+			m_image_buffer->resample(*previous);
+		}
 	}
 
 	/*
@@ -764,6 +1046,42 @@ viewport_hook_builder::active_vport_camera_shutter()
 }
 
 
+viewport_view
+viewport_hook_builder::active_vport_view()
+{
+	std::lock_guard<std::mutex> lock(m_hooks_mutex);
+
+	for(auto hook : m_hooks)
+	{
+		viewport_view view = hook->get_view();
+		if(view.m_camera_id >= 0)
+		{
+			return view;
+		}
+	}
+
+	return viewport_view();
+}
+
+
+void
+viewport_hook_builder::camera_changed(const viewport_view& i_view)
+{
+	/*
+		The callback is called without holding the lock, since it might be
+		processed immediately and call active_vport_view().
+	*/
+	m_hooks_mutex.lock();
+	std::function<void(const viewport_view&)> cb = m_camera_changed_cb;
+	m_hooks_mutex.unlock();
+
+	if(cb)
+	{
+		cb(i_view);
+	}
+}
+
+
 void
 viewport_hook::connect(NSI::Context* io_nsi)
 {
@@ -929,7 +1247,7 @@ viewport_hook::screen_handle()const
 }
 
 
-void
+bool
 viewport_hook::export_camera_attributes(
 	GUI_ViewParameter& i_view,
 	OBJ_Camera* active_camera,
@@ -969,8 +1287,26 @@ viewport_hook::export_camera_attributes(
 
 	if(updated && i_synchronize)
 	{
+		/*
+			Viewport navigation doesn't go through the IPR event queue. The
+			edit is only known once the viewport is redrawn.
+		*/
+		ipr_latency& latency = ipr_latency::get_instance();
+		latency.viewport_synchronizing();
 		m_nsi->RenderControl(NSI::CStringPArg("action", "synchronize"));
+		latency.viewport_synchronized();
 	}
+
+	return updated;
+}
+
+
+bool
+viewport_hook::in_motion()const
+{
+	return
+		settle_time().count() > 0 &&
+		std::chrono::steady_clock::now() - m_last_motion < settle_time();
 }
 
 
@@ -984,9 +1320,20 @@ viewport_hook::export_screen_attributes(
 
 	bool updated = false;
 
-	int resolution[2] = { i_view.getViewWidth(), i_view.getViewHeight() };
+	/*
+		While the camera moves, render a smaller image with fewer samples, so
+		it can keep up. It's scaled up to fill the viewport when displayed.
+	*/
+	bool reduced = in_motion();
+	int divisor = reduced ? k_motion_resolution_divisor : 1;
+	int resolution[2] =
+	{
+		std::max(1, i_view.getViewWidth() / divisor),
+		std::max(1, i_view.getViewHeight() / divisor)
+	};
 	if(m_last_resolution[0] != resolution[0] ||
-		m_last_resolution[1] != resolution[1])
+		m_last_resolution[1] != resolution[1] ||
+		m_last_reduced != reduced)
 	{
 		m_nsi->SetAttribute(
 			screen_handle(),
@@ -994,10 +1341,19 @@ viewport_hook::export_screen_attributes(
 				*NSI::Argument("resolution").
 					SetArrayType(NSITypeInteger, 2)->
 					SetValuePointer(resolution),
-				NSI::IntegerArg("oversampling", 16)
+				NSI::IntegerArg(
+					"oversampling",
+					reduced ? k_motion_oversampling : k_oversampling)
 			) );
 		m_last_resolution[0] = resolution[0];
 		m_last_resolution[1] = resolution[1];
+		m_last_reduced = reduced;
+
+		if(i_synchronize && m_image_buffer)
+		{
+			// The driver will be re-opened, keep the image until then
+			m_image_buffer->keep_pixels_on_close();
+		}
 
 		updated = true;
 	}
@@ -1205,7 +1561,11 @@ viewport_hook_builder::retireSceneRender(
 
 
 void
-viewport_hook_builder::connect(NSI::Context* io_nsi)
+viewport_hook_builder::connect(
+	NSI::Context* io_nsi,
+	int i_settle_time,
+	int i_refresh_rate,
+	const std::function<void(const viewport_view&)>& i_camera_changed_cb)
 {
 	if(m_nsi)
 	{
@@ -1221,8 +1581,12 @@ viewport_hook_builder::connect(NSI::Context* io_nsi)
 
 	m_nsi = io_nsi;
 
+	g_settle_time = std::max(0, i_settle_time);
+	g_refresh_rate = std::max(1, i_refresh_rate);
+
 	// Export camera, screen and driver for each viewport hook
 	m_hooks_mutex.lock();
+	m_camera_changed_cb = i_camera_changed_cb;
 	for(auto hook : m_hooks)
 	{
 		hook->connect(m_nsi);
@@ -1241,6 +1605,7 @@ viewport_hook_builder::disconnect()
 	}
 	
 	m_hooks_mutex.lock();
+	m_camera_changed_cb = std::function<void(const viewport_view&)>();
 	for(auto hook : m_hooks)
 	{
 		hook->disconnect();
@@ -4,11 +4,27 @@
 
 #include <nsi.hpp>
 
+#include <functional>
 #include <mutex>
 
+class OBJ_Camera;
 class viewport_hook;
 class hook_image_buffer;
 
+/**
+	\brief Camera and resolution of a viewport.
+
+	It's copied from the UI thread, so it can be used from other threads
+	without accessing the viewport itself.
+*/
+struct viewport_view
+{
+	/// Unique ID of the camera node, or -1 for a free view
+	int m_camera_id{-1};
+	/// Full resolution of the viewport
+	int m_resolution[2]{0, 0};
+};
+
 /// Scene hook that allows 3Delight rendering directly into Houdini viewports
 class viewport_hook_builder : public DM_SceneHook
 {
@@ -39,8 +55,21 @@ public:
 		
 		Any previously connected context will be disconnected and its render,
 		terminated.
+
+		i_settle_time is the delay, in milliseconds, during which the camera
+		must be still before rendering at full resolution again (0 always
+		renders at full resolution). i_refresh_rate is the maximum number of
+		viewport refreshes per second.
+
+		i_camera_changed_cb is called, from the UI thread, each time the
+		camera of a viewport changes during the render. It receives a copy of
+		that viewport's camera and resolution.
 	*/
-	void connect(NSI::Context* io_nsi);
+	void connect(
+		NSI::Context* io_nsi,
+		int i_settle_time,
+		int i_refresh_rate,
+		const std::function<void(const viewport_view&)>& i_camera_changed_cb);
 
 	/**
 		\brief Disconnects from the currently connected NSI context. 
@@ -58,6 +87,19 @@ public:
 	*/
 	double active_vport_camera_shutter();
 
+	/**
+		\brief Returns the camera through which a viewport looks, along with
+		the resolution of that viewport.
+
+		The first such viewport is used. The returned camera ID is -1 when all
+		viewports have a free view. This only reads what was copied during the
+		last refresh of each viewport, so it can be called from any thread.
+	*/
+	viewport_view active_vport_view();
+
+	/// Notifies the connected render that a viewport's camera has changed
+	void camera_changed(const viewport_view& i_view);
+
 	/**
 		\brief Returns the image buffer held by a viewport.
 		
@@ -80,4 +122,6 @@ private:
 	std::mutex m_hooks_mutex;
 	// Current rendering context
 	NSI::Context* m_nsi{nullptr};
+	// Called when the camera of a viewport changes
+	std::function<void(const viewport_view&)> m_camera_changed_cb;
 };
@@ -5,19 +5,53 @@
 #include "3Delight/ShaderQuery.h"
 #include "scene.h"
 #include "shader_library.h"
+#include "texture_cache.h"
 #include "geometry.h"
 #include "VOP_AOVGroup.h"
 
 #include <VOP/VOP_Node.h>
 #include <OP/OP_Input.h>
+#include <PRM/PRM_Parm.h>
 
 #include <assert.h>
 #include <nsi.hpp>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 #include <unordered_set>
 #include <forward_list>
 
+namespace
+{
+	/// Mixes i_value into io_hash
+	template<typename T>
+	void hash_combine( size_t &io_hash, const T &i_value )
+	{
+		io_hash ^=
+			std::hash<T>()(i_value) + 0x9e3779b9 + (io_hash<<6) + (io_hash>>2);
+	}
+
+	/**
+		Returns true if a string parameter's value might change from one frame
+		to the next without the parameter being animated : COP references,
+		which are baked into one file per frame, and strings with variables or
+		backtick expressions (eg : "tex.$F4.exr").
+	*/
+	bool is_frame_dependent_string(
+		const OP_Parameters *i_parameters,
+		int i_index )
+	{
+		UT_String raw;
+		i_parameters->evalStringRaw( raw, i_index, 0, 0.0 );
+		std::string value = raw.toStdString();
+
+		return
+			value.find("op:") == 0 ||
+			value.find('$') != std::string::npos ||
+			value.find('`') != std::string::npos;
+	}
+}
+
 vop::vop(
 	const context& i_ctx,
 	VOP_Node *i_vop )
@@ -25,26 +59,53 @@ vop::vop(
 	exporter( i_ctx, i_vop )
 {
 	assert(is_renderable(i_vop));
+
+	m_time_dependent = has_animated_parameters( m_vop );
+	m_fingerprint = fingerprint();
+
+	auto exported = m_context.m_vop_fingerprints.find( m_handle );
+	m_up_to_date =
+		exported != m_context.m_vop_fingerprints.end() &&
+		exported->second == m_fingerprint;
 }
 
 void vop::create( void ) const
 {
+	if( m_up_to_date )
+		return;
+
 	std::string path = shader_path( m_vop );
 	assert( !path.empty() );
 
 	m_nsi.Create( m_handle, "shader" );
 	m_nsi.SetAttribute( m_handle,
 		NSI::CStringPArg( "shaderfilename", path.c_str()) );
+
+	update_fingerprint();
 }
 
+/**
+	If the node has already been exported unchanged, only its time-dependent
+	parameters need to be exported again.
+*/
 void vop::set_attributes( void ) const
 {
-	set_attributes_at_time(m_context.m_current_time);
+	if( m_up_to_date && !m_time_dependent )
+		return;
+
+	set_attributes_at_time(m_context.m_current_time, m_up_to_date);
 }
 
-void vop::set_attributes_at_time( double i_time ) const
+/**
+	Non-animated parameters go through the static attributes context. When
+	exporting a sequence to files, they are thus only written to the ".static"
+	file, with the first frame. Strings that can change with the frame, such
+	as COP references, are considered animated. \ref has_animated_parameters
+*/
+void vop::set_attributes_at_time( double i_time, bool i_animated_only ) const
 {
 	NSI::ArgumentList list;
+	NSI::ArgumentList animated_list;
 	std::string uv_coord_connection;
 
 	list_shader_parameters(
@@ -53,11 +114,21 @@ void vop::set_attributes_at_time( double i_time ) const
 		nullptr,
 		i_time,
 		-1,
-		list, uv_coord_connection );
+		list, uv_coord_connection,
+		&animated_list );
 
-	if( !list.empty() )
+	if( !animated_list.empty() )
 	{
-		m_nsi.SetAttributeAtTime( m_handle, i_time, list );
+		m_nsi.SetAttributeAtTime( m_handle, i_time, animated_list );
+	}
+
+	if( i_animated_only )
+		return;
+
+	NSI::Context &static_nsi = m_context.m_static_nsi;
+	if( !list.empty() && static_nsi.Handle() != NSI_BAD_CONTEXT )
+	{
+		static_nsi.SetAttribute( m_handle, list );
 	}
 
 	if( !uv_coord_connection.empty() )
@@ -88,6 +159,14 @@ void vop::set_attributes_at_time( double i_time ) const
 		\ref osl/texture__2_0.osl
 */
 void vop::connect( void ) const
+{
+	if( m_up_to_date )
+		return;
+
+	connect_network();
+}
+
+void vop::connect_network( void ) const
 {
 	if( ignore_subnetworks() )
 		return;
@@ -147,7 +226,7 @@ void vop::connect_input(int i_input_index)const
 		source->getOutputName(source_name, source_index);
 
 		m_nsi.Connect(
-			vop::handle(*source, m_context), source_name.toStdString(),
+			shader_handle(*source, m_context), source_name.toStdString(),
 			m_handle, input_name.toStdString() );
 	}
 }
@@ -167,10 +246,11 @@ void vop::changed_cb(
 	{
 		intptr_t parm_index = reinterpret_cast<intptr_t>(i_data);
 
-		NSI::ArgumentList list;
-		if(vop(*ctx, i_caller->castToVOPNode()).set_single_attribute(parm_index))
+		vop v(*ctx, i_caller->castToVOPNode());
+		if(v.set_single_attribute(parm_index))
 		{
-			ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+			v.update_fingerprint();
+			ctx->request_synchronize();
 		}
 	}
 	else if(i_type == OP_INPUT_REWIRED)
@@ -215,7 +295,9 @@ void vop::changed_cb(
 			}
 		}
 
-		ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+		v.update_fingerprint();
+
+		ctx->request_synchronize();
 	}
 	else if (i_type == OP_FLAG_CHANGED)
 	{
@@ -245,7 +327,7 @@ void vop::changed_cb(
 				if (!ctx->material_to_objects[outputs[i]->castToVOPNode()].empty())
 				{
 					vop k(*ctx, outputs[i]->castToVOPNode());
-					k.connect();
+					k.connect_network();
 				}
 			}
 		}
@@ -260,7 +342,7 @@ void vop::changed_cb(
 			}
 		}
 
-		ctx->m_nsi.RenderControl(NSI::CStringPArg("action", "synchronize"));
+		ctx->request_synchronize();
 	}
 }
 
@@ -278,7 +360,8 @@ void vop::list_shader_parameters(
 	float i_time,
 	int i_parm_index,
 	NSI::ArgumentList &o_list,
-	std::string &o_uv_connection )
+	std::string &o_uv_connection,
+	NSI::ArgumentList *o_animated_list )
 {
 	assert( i_parameters );
 
@@ -314,7 +397,12 @@ void vop::list_shader_parameters(
 		return;
 	}
 
-	DlShaderInfo *shader_info = library.get_shader_info( path.c_str() );
+	const shader_library::shader_parameters *shader =
+		library.get_shader_parameters( path.c_str() );
+	if( !shader )
+	{
+		return;
+	}
 
 	const char *k_srccolorspace = "srccolorspace";
 	const char *k_texcolorspace = "texcolorspace";
@@ -333,46 +421,57 @@ void vop::list_shader_parameters(
 		}
 	}
 
-	for( int i=0; i<shader_info->nparams(); i++ )
+	/*
+		When a single parameter is requested, only its slot is evaluated,
+		instead of looking up all of the shader's parameters on the node.
+		Ramps are made of multiple node parameters that don't match the
+		shader's ones, so they're still all exported, and so is the uv
+		coordinates connection.
+	*/
+	const shader_library::parameter_info *single = nullptr;
+	if( i_parm_index >= 0 )
+	{
+		single = shader->find( i_parameters->getParm(i_parm_index).getToken() );
+	}
+
+	for( const shader_library::parameter_info &info : shader->m_parameters )
 	{
-		const DlShaderInfo::Parameter *parameter = shader_info->getparam(i);
+		const DlShaderInfo::Parameter *parameter = info.m_parameter;
 
 		// Skip auxiliary shader parameters
-		const char* related_to_widget = nullptr;
-		osl_utilities::FindMetaData(
-			related_to_widget,
-			parameter->metadata,
-			"related_to_widget");
-		if(related_to_widget)
+		if(info.m_related_to_widget)
 		{
 			// This parameter will be exported as part of a group
 			continue;
 		}
 
 		// Process ramp parameters differently
-		const char* widget = "";
-		osl_utilities::FindMetaData(widget, parameter->metadata, "widget");
-		if(osl_utilities::ramp::IsRampWidget(widget))
+		if(info.m_ramp)
 		{
+			/*
+				A ramp is made of many node parameters, so consider it animated
+				as soon as anything on the node is.
+			*/
+			bool animated_ramp =
+				o_animated_list && has_animated_parameters(i_parameters);
+
 			list_ramp_parameters(
 				i_parameters,
-				*shader_info,
+				*shader->m_info,
 				*parameter,
 				i_time,
-				o_list,
+				animated_ramp ? *o_animated_list : o_list,
 				is_shader_loaded);
 			continue;
 		}
 
-		int index = i_parameters->getParmIndex( parameter->name.c_str() );
-
 		/*
 			Special check for uv coordinates.
 
 			We are looking for something like float uv[2] that
-			is not connected to anything.
+			is not connected to anything and defaults to the uv coordinates.
 		*/
-		if( parameter->type.arraylen == 2)
+		if( info.m_uv_coordinates )
 		{
 			/*
 				We don't define uvCoord as a parameter, so instead we
@@ -383,25 +482,26 @@ void vop::list_shader_parameters(
 			if (input_index != -1 && i_parameters->castToVOPNode()
 				->findSimpleInput(input_index) == nullptr)
 			{
-				/* Check for default uv coordintes */
-				const char* default_connection = nullptr;
-				osl_utilities::FindMetaData(
-					default_connection,
-					parameter->metadata,
-					"default_connection");
-
-				if (default_connection &&
-					::strcmp("uvCoord", default_connection) == 0)
-				{
-					o_uv_connection = parameter->name.c_str();
-				}
+				o_uv_connection = parameter->name.c_str();
 			}
 		}
 
+		if( single && &info != single )
+			continue;
 
+		int index = i_parameters->getParmIndex( parameter->name.c_str() );
 		if( index < 0 || (i_parm_index >= 0 && index != i_parm_index))
 			continue;
 
+		const PRM_Parm &parm = i_parameters->getParm(index);
+		bool animated =
+			parm.isTimeDependent() ||
+			(parm.isStringType() &&
+				is_frame_dependent_string(i_parameters, index));
+
+		NSI::ArgumentList &list =
+			o_animated_list && animated ? *o_animated_list : o_list;
+
 		switch( parameter->type.elementtype )
 		{
 		case NSITypeFloat:
@@ -415,12 +515,12 @@ void vop::list_shader_parameters(
 				std::vector<float> values;
 				for (int j = 0; j < parameter->type.arraylen; j++)
 					values.push_back(i_parameters->evalFloat(index, j, i_time));
-				o_list.Add(NSI::Argument::New(parameter->name.c_str())
+				list.Add(NSI::Argument::New(parameter->name.c_str())
 					->SetArrayType(NSITypeFloat, parameter->type.arraylen)
 					->CopyValue(&values[0], values.size() * sizeof(values[0])));
 			}
 			else
-			o_list.Add(
+			list.Add(
 				new NSI::FloatArg(
 					parameter->name.c_str(),
 					i_parameters->evalFloat(index, 0, i_time)) );
@@ -439,7 +539,7 @@ void vop::list_shader_parameters(
 				(float)i_parameters->evalFloat(index, 2, i_time)
 			};
 
-			o_list.Add( new NSI::ColorArg( parameter->name.c_str(), c ) );
+			list.Add( new NSI::ColorArg( parameter->name.c_str(), c ) );
 			break;
 		}
 
@@ -454,12 +554,12 @@ void vop::list_shader_parameters(
 				std::vector<int> values;
 				for (int j = 0; j < parameter->type.arraylen; j++)
 					values.push_back(i_parameters->evalInt(index, j, i_time));
-				o_list.Add(NSI::Argument::New(parameter->name.c_str())
+				list.Add(NSI::Argument::New(parameter->name.c_str())
 					->SetArrayType(NSITypeInteger, parameter->type.arraylen)
 					->CopyValue(&values[0], values.size() * sizeof(values[0])));
 			}
 			else
-			o_list.Add(
+			list.Add(
 				new NSI::IntegerArg(
 					parameter->name.c_str(),
 					i_parameters->evalInt(index, 0, i_time)) );
@@ -498,7 +598,14 @@ void vop::list_shader_parameters(
 			if( start_pos != std::string::npos )
 				stdstr.replace( start_pos, 6, "UDIM" );
 
-			o_list.Add( new NSI::StringArg(parameter->name.c_str(), stdstr) );
+			/* Use the pre-converted texture, if any. */
+			if( info.m_texture )
+			{
+				stdstr = texture_cache::get_instance().converted(
+					stdstr, color_space.toStdString() );
+			}
+
+			list.Add( new NSI::StringArg(parameter->name.c_str(), stdstr) );
 
 			if( color_space.length() != 0 )
 			{
@@ -508,7 +615,7 @@ void vop::list_shader_parameters(
 				*/
 				std::string param( parameter->name.c_str() );
 				param += ".meta.colorspace";
-				o_list.Add( new NSI::StringArg(param, color_space.buffer()) );
+				list.Add( new NSI::StringArg(param, color_space.buffer()) );
 			}
 
 			break;
@@ -561,17 +668,9 @@ void vop::add_and_connect_aov_group() const
 	std::string path = shader_path( m_vop );
 	assert( !path.empty() );
 
-	DlShaderInfo *shader_info = library.get_shader_info( path.c_str() );
-	bool ourMaterial = false;
-	for( int i=0; i<shader_info->nparams(); i++ )
-	{
-		const DlShaderInfo::Parameter *parameter = shader_info->getparam(i);
-		if ( strcmp( parameter->name.c_str(), "aovGroup" ) == 0 )
-		{
-			ourMaterial = true;
-			break;
-		}
-	}
+	const shader_library::shader_parameters *shader =
+		library.get_shader_parameters( path.c_str() );
+	bool ourMaterial = shader && shader->find( "aovGroup" );
 
 	if ( !ourMaterial )
 		return;
@@ -672,12 +771,220 @@ void vop::add_and_connect_aov_group() const
 			UT_String aov_value;
 			aov_value.sprintf("colorAOVValues[%u]", j);
 			m_nsi.Connect(
-				vop::handle(*source, m_context), source_output_name.toStdString(),
+				shader_handle(*source, m_context), source_output_name.toStdString(),
 				handle, aov_value.toStdString());
 		}
 	}
 }
 
+size_t vop::fingerprint( void ) const
+{
+	size_t hash = 0;
+
+	hash_combine( hash, shader_path(m_vop) );
+	hash_combine( hash, m_vop->getVersionParms() );
+	hash_combine( hash, m_time_dependent );
+	hash_combine( hash, m_vop->getBypass() );
+
+	for( int i = 0, n = m_vop->nInputs(); i<n; ++i )
+	{
+		OP_Input *input_ref = m_vop->getInputReferenceConst(i);
+		OP_Node *source = m_vop->getInput(i);
+		if( !input_ref || !source )
+			continue;
+
+		hash_combine( hash, i );
+		hash_combine( hash, source->getUniqueId() );
+		hash_combine( hash, input_ref->getNodeOutputIndex() );
+		hash_combine( hash, source->getBypass() );
+	}
+
+	return hash;
+}
+
+void vop::update_fingerprint( void ) const
+{
+	m_context.m_vop_fingerprints[m_handle] = fingerprint();
+}
+
+std::string vop::shader_handle(
+	const VOP_Node &i_vop, const context &i_context )
+{
+	std::string vop_handle = handle( i_vop, i_context );
+
+	auto alias = i_context.m_shader_aliases.find( vop_handle );
+	if( alias == i_context.m_shader_aliases.end() )
+		return vop_handle;
+
+	return alias->second;
+}
+
+size_t vop::network_hash(
+	const context &i_context,
+	VOP_Node *i_vop,
+	std::unordered_map<VOP_Node*, size_t> &io_hashes )
+{
+	auto known = io_hashes.find( i_vop );
+	if( known != io_hashes.end() )
+		return known->second;
+
+	size_t hash = 0;
+	hash_combine( hash, shader_path(i_vop) );
+
+	if( i_vop->getBypass() ||
+		is_aov_definition(i_vop) ||
+		has_animated_parameters(i_vop) )
+	{
+		hash_combine( hash, i_vop->getUniqueId() );
+		io_hashes[i_vop] = hash;
+		return hash;
+	}
+
+	fpreal time = i_context.current_time();
+	for( int p = 0, n = i_vop->getNumParms(); p < n; p++ )
+	{
+		const PRM_Parm &parm = i_vop->getParm(p);
+
+		/* The value of a folder is only the tab that's currently open. */
+		if( parm.getType().isSwitcher() )
+			continue;
+
+		hash_combine( hash, std::string(parm.getToken()) );
+		for( int v = 0, nv = parm.getVectorSize(); v < nv; v++ )
+		{
+			if( parm.getType().isStringType() )
+			{
+				UT_String value;
+				i_vop->evalString( value, p, v, time );
+				hash_combine( hash, value.toStdString() );
+			}
+			else
+			{
+				hash_combine( hash, (double)i_vop->evalFloat(p, v, time) );
+			}
+		}
+	}
+
+	for( int i = 0, n = i_vop->nInputs(); i<n; ++i )
+	{
+		OP_Input *input_ref = i_vop->getInputReferenceConst(i);
+		VOP_Node *source = CAST_VOPNODE( i_vop->getInput(i) );
+		if( !input_ref || !source )
+			continue;
+
+		hash_combine( hash, i );
+		hash_combine( hash, input_ref->getNodeOutputIndex() );
+		hash_combine( hash, network_hash(i_context, source, io_hashes) );
+	}
+
+	io_hashes[i_vop] = hash;
+	return hash;
+}
+
+bool vop::same_network(
+	const context &i_context,
+	VOP_Node *i_a,
+	VOP_Node *i_b )
+{
+	if( i_a == i_b )
+		return true;
+
+	if( shader_path(i_a) != shader_path(i_b) )
+		return false;
+
+	/* Same exceptions as in network_hash. */
+	if( i_a->getBypass() || i_b->getBypass() ||
+		is_aov_definition(i_a) || is_aov_definition(i_b) ||
+		has_animated_parameters(i_a) || has_animated_parameters(i_b) )
+	{
+		return false;
+	}
+
+	if( i_a->getNumParms() != i_b->getNumParms() ||
+		i_a->nInputs() != i_b->nInputs() )
+	{
+		return false;
+	}
+
+	fpreal time = i_context.current_time();
+	for( int p = 0, n = i_a->getNumParms(); p < n; p++ )
+	{
+		const PRM_Parm &parm = i_a->getParm(p);
+		const PRM_Parm &other_parm = i_b->getParm(p);
+
+		if( parm.getType().isSwitcher() != other_parm.getType().isSwitcher() )
+			return false;
+
+		if( parm.getType().isSwitcher() )
+			continue;
+
+		if( std::string(parm.getToken()) != other_parm.getToken() ||
+			parm.getVectorSize() != other_parm.getVectorSize() ||
+			parm.getType().isStringType() !=
+				other_parm.getType().isStringType() )
+		{
+			return false;
+		}
+
+		for( int v = 0, nv = parm.getVectorSize(); v < nv; v++ )
+		{
+			if( parm.getType().isStringType() )
+			{
+				UT_String value, other_value;
+				i_a->evalString( value, p, v, time );
+				i_b->evalString( other_value, p, v, time );
+				if( value != other_value )
+					return false;
+			}
+			else if( i_a->evalFloat(p, v, time) != i_b->evalFloat(p, v, time) )
+			{
+				return false;
+			}
+		}
+	}
+
+	for( int i = 0, n = i_a->nInputs(); i<n; ++i )
+	{
+		OP_Input *input_ref = i_a->getInputReferenceConst(i);
+		VOP_Node *source = CAST_VOPNODE( i_a->getInput(i) );
+		bool connected = input_ref && source;
+
+		OP_Input *other_input_ref = i_b->getInputReferenceConst(i);
+		VOP_Node *other_source = CAST_VOPNODE( i_b->getInput(i) );
+		bool other_connected = other_input_ref && other_source;
+
+		if( connected != other_connected )
+			return false;
+
+		if( !connected )
+			continue;
+
+		if( input_ref->getNodeOutputIndex() !=
+				other_input_ref->getNodeOutputIndex() ||
+			!same_network(i_context, source, other_source) )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool vop::has_animated_parameters( const OP_Parameters *i_parameters )
+{
+	for( int p = 0, n = i_parameters->getNumParms(); p < n; p++ )
+	{
+		const PRM_Parm &parm = i_parameters->getParm(p);
+		if( parm.isTimeDependent() ||
+			(parm.isStringType() && is_frame_dependent_string(i_parameters, p)) )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool vop::set_single_attribute(int i_parm_index)const
 {
 	NSI::ArgumentList list;
@@ -7,6 +7,8 @@
 
 #include <OP/OP_Value.h>
 
+#include <unordered_map>
+
 class OP_Node;
 class OP_Parameters;
 
@@ -46,6 +48,12 @@ private:
 	friend class scene;
 
 public:
+	/**
+		\brief Constructor.
+
+		Also computes the node's fingerprint, which is used to skip its export
+		if it has already been exported, unchanged, to the same NSI context.
+	*/
 	vop( const context&, VOP_Node *);
 
 	void create( void ) const override;
@@ -82,6 +90,53 @@ public:
 	*/
 	static bool is_texture( VOP_Node *shader );
 
+	/**
+		\brief Returns the handle of the NSI shader node to connect to in order
+		to use i_vop.
+
+		This is usually the VOP's own handle, unless an identical shader
+		network is exported in its place.
+		\ref scene::deduplicate_shaders
+	*/
+	static std::string shader_handle(
+		const VOP_Node &i_vop, const context &i_context );
+
+	/**
+		\brief Returns a hash of the shader network rooted at i_vop.
+
+		It includes the shader path, the values of the node's parameters and
+		the hashes of its upstream nodes, along with the inputs and outputs
+		through which they are connected. Networks with different hashes
+		always produce different NSI shader graphs, but networks with the same
+		hash should still be compared with same_network.
+
+		Nodes that could still produce different results (time-dependent nodes,
+		bypassed inputs, AOV definitions) get a hash that is unique to them.
+
+		\param i_context
+			The current rendering context.
+		\param i_vop
+			The root of the network.
+		\param io_hashes
+			Hashes already computed, by node. It's updated with the hashes of
+			i_vop and its upstream nodes.
+	*/
+	static size_t network_hash(
+		const context &i_context,
+		VOP_Node *i_vop,
+		std::unordered_map<VOP_Node*, size_t> &io_hashes );
+
+	/**
+		\brief Returns true if the shader networks rooted at i_a and i_b will
+		produce identical NSI shader graphs.
+
+		This compares the same things as network_hash, exactly.
+	*/
+	static bool same_network(
+		const context &i_context,
+		VOP_Node *i_a,
+		VOP_Node *i_b );
+
 protected:
 
 	/**
@@ -108,6 +163,9 @@ protected:
 		\parama o_uv_connection
 			If this is a texture node, will return the name of the parameter
 			to which a uv attribute reader must be connected
+		\param o_animated_list
+			Optional list that receives the time-dependent parameters, in which
+			case o_list only receives the others.
 
 		Note that some more involved work is required if texture parameter
 		link to an OP. In this case we will generate images.
@@ -119,16 +177,47 @@ protected:
 		float i_time,
 		int i_parm_index,
 		NSI::ArgumentList &o_list,
-		std::string &o_uv_connection );
+		std::string &o_uv_connection,
+		NSI::ArgumentList *o_animated_list = nullptr );
 
 
 private:
 
+	/// Connects m_vop to all its input nodes
+	void connect_network()const;
+
 	/// Exports the NSI connection of input number i_input_index
 	void connect_input(int i_input_index)const;
 
-	/// Exports time-dependent attributes to NSI
-	void set_attributes_at_time( double i_time ) const;
+	/**
+		\brief Exports attributes to NSI.
+
+		\param i_time
+			Time at which the attributes are evaluated.
+		\param i_animated_only
+			When true, only time-dependent parameters are exported.
+	*/
+	void set_attributes_at_time(
+		double i_time,
+		bool i_animated_only = false ) const;
+
+	/**
+		\brief Returns a hash of everything that affects the NSI shader node.
+
+		This includes the shader path, the parameters' version (which changes
+		each time a parameter is modified), whether the node is time-dependent
+		and its input connections.
+	*/
+	size_t fingerprint( void ) const;
+
+	/// Remembers the current fingerprint as already exported
+	void update_fingerprint( void ) const;
+
+	/**
+		\brief Returns true if any of the node's parameters is time-dependent,
+		including strings whose value depends on the frame.
+	*/
+	static bool has_animated_parameters( const OP_Parameters *i_parameters );
 
 	/**
 		\returns true if we should not connect this VOP to its subnetworks.
@@ -158,4 +247,16 @@ private:
 		bool i_is_node_loaded = true);
 
 	static bool is_aov_definition( VOP_Node *i_vop );
+
+private:
+
+	/// True if some of the node's parameters are time-dependent
+	bool m_time_dependent{false};
+	/// Fingerprint of the node at the time this exporter was created
+	size_t m_fingerprint{0};
+	/**
+		True if the NSI node already exists in the NSI context, with the same
+		fingerprint. In that case, only time-dependent attributes are exported.
+	*/
+	bool m_up_to_date{false};
 };